@@ -0,0 +1,248 @@
+// Convert FIG-Forth block files between the raw format, a plain array
+// of 128-byte blocks as written by screenedit.py, and the sparse,
+// compressed container of blkfile.h.  Either command accepts either
+// format as input, so "pack" also compacts a container that has been
+// written to, recovering the space taken by superseded records.
+//
+// The output is written to a temporary file in the same directory,
+// and renamed over the output file once complete, so the input and
+// output may be the same file, and an error leaves the output as it
+// was.
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "blkfile.h"
+
+char *in_fn;
+int in_fd;
+bool in_container;
+uint64_t in_blocks;
+struct blkfile_header in_header;
+struct blkfile_entry *in_index = NULL;
+
+void openInput (char *fn)
+{
+  struct stat st;
+  uint64_t alloc = 0;
+
+  in_fn = fn;
+  in_fd = open (fn, O_RDONLY);
+  if ((in_fd < 0) || (fstat (in_fd, & st) < 0))
+    {
+      fprintf (stderr, "can't open block file '%s'\n", fn);
+      exit (2);
+    }
+  in_container = blkfileCheck (in_fd);
+  if (in_container)
+    {
+      if (! blkfileLoad (in_fd, & in_header, & in_index, & alloc))
+	{
+	  fprintf (stderr, "block container '%s' is corrupt\n", fn);
+	  exit (2);
+	}
+      in_blocks = in_header.block_count;
+      return;
+    }
+  in_blocks = (st.st_size + BLKFILE_BLOCK_SIZE - 1) / BLKFILE_BLOCK_SIZE;
+  if (st.st_size % BLKFILE_BLOCK_SIZE)
+    fprintf (stderr, "'%s' ends with a partial block, padded with zeros\n", fn);
+}
+
+void readBlock (uint64_t block, uint8_t *buf)
+{
+  struct blkfile_entry *e;
+  uint8_t record [BLKFILE_BLOCK_SIZE];
+  ssize_t n;
+
+  if (! in_container)
+    {
+      memset (buf, 0, BLKFILE_BLOCK_SIZE);
+      n = pread (in_fd, buf, BLKFILE_BLOCK_SIZE, block * BLKFILE_BLOCK_SIZE);
+      if (n < 0)
+	{
+	  fprintf (stderr, "error reading '%s'\n", in_fn);
+	  exit (2);
+	}
+      return;
+    }
+  e = & in_index [block];
+  if ((e->length > BLKFILE_BLOCK_SIZE) ||
+      (pread (in_fd, record, e->length, e->offset) != e->length) ||
+      ! blkfileDecode (e, record, buf))
+    {
+      fprintf (stderr, "block %" PRIu64 " of '%s' is corrupt\n", block, in_fn);
+      exit (2);
+    }
+}
+
+char *tmp_fn = NULL;
+
+void removeOutput (void)
+{
+  if (tmp_fn)
+    unlink (tmp_fn);
+}
+
+int createOutput (char *fn)
+{
+  struct stat st;
+  mode_t mask;
+  int fd;
+
+  tmp_fn = malloc (strlen (fn) + 8);
+  if (! tmp_fn)
+    {
+      fprintf (stderr, "can't create '%s'\n", fn);
+      exit (2);
+    }
+  sprintf (tmp_fn, "%s.XXXXXX", fn);
+  fd = mkstemp (tmp_fn);
+  if (fd < 0)
+    {
+      fprintf (stderr, "can't create '%s'\n", tmp_fn);
+      free (tmp_fn);
+      tmp_fn = NULL;
+      exit (2);
+    }
+  atexit (removeOutput);
+  // mkstemp creates the file private, give it the mode a new, or the
+  // replaced, output file would have
+  if (stat (fn, & st) == 0)
+    fchmod (fd, st.st_mode & 07777);
+  else
+    {
+      mask = umask (0);
+      umask (mask);
+      fchmod (fd, 0666 & ~mask);
+    }
+  return fd;
+}
+
+void finishOutput (int fd, char *fn)
+{
+  if ((fsync (fd) < 0) || (close (fd) < 0) || (rename (tmp_fn, fn) < 0))
+    {
+      fprintf (stderr, "error writing '%s'\n", fn);
+      exit (2);
+    }
+  free (tmp_fn);
+  tmp_fn = NULL;
+}
+
+void pack (char *out_fn)
+{
+  struct blkfile_header h;
+  struct blkfile_entry *index;
+  uint8_t buf [BLKFILE_BLOCK_SIZE];
+  uint64_t b;
+  int fd;
+
+  index = calloc (in_blocks + 1, sizeof (struct blkfile_entry));
+  fd = createOutput (out_fn);
+  if (! index || ! blkfileCreate (fd, & h))
+    goto fail;
+  for (b = 0; b < in_blocks; b++)
+    {
+      readBlock (b, buf);
+      if (! blkfileAppend (fd, & h, & index [b], buf))
+	goto fail;
+    }
+  h.block_count = in_blocks;
+  if (! blkfileStore (fd, & h, index))
+    goto fail;
+  finishOutput (fd, out_fn);
+  free (index);
+  return;
+
+ fail:
+  fprintf (stderr, "error writing '%s'\n", out_fn);
+  exit (2);
+}
+
+void unpack (char *out_fn)
+{
+  uint8_t buf [BLKFILE_BLOCK_SIZE];
+  uint64_t b;
+  int fd;
+
+  fd = createOutput (out_fn);
+  for (b = 0; b < in_blocks; b++)
+    {
+      readBlock (b, buf);
+      if (pwrite (fd, buf, BLKFILE_BLOCK_SIZE, b * BLKFILE_BLOCK_SIZE) != BLKFILE_BLOCK_SIZE)
+	{
+	  fprintf (stderr, "error writing '%s'\n", out_fn);
+	  exit (2);
+	}
+    }
+  finishOutput (fd, out_fn);
+}
+
+void info (void)
+{
+  static const char *kind_name [] = { "zero", "blank", "raw", "compressed" };
+  uint64_t count [4] = { 0, 0, 0, 0 };
+  uint64_t bytes = 0;
+  uint64_t b;
+  int k;
+
+  if (! in_container)
+    {
+      printf ("raw block file, %" PRIu64 " blocks\n", in_blocks);
+      return;
+    }
+  for (b = 0; b < in_blocks; b++)
+    {
+      if (in_index [b].kind < 4)
+	count [in_index [b].kind]++;
+      bytes += in_index [b].length;
+    }
+  printf ("block container, %" PRIu64 " blocks (%" PRIu64 " bytes raw)\n",
+	  in_blocks, in_blocks * BLKFILE_BLOCK_SIZE);
+  for (k = 0; k < 4; k++)
+    printf ("  %-10s  %" PRIu64 "\n", kind_name [k], count [k]);
+  printf ("record bytes:  %" PRIu64 "\n", bytes);
+  printf ("file bytes:    %" PRIu64 " (%" PRIu64 " superseded)\n", in_header.data_end,
+	  in_header.data_end - BLKFILE_HEADER_SIZE - bytes
+	  - (uint64_t) in_header.index_room * BLKFILE_ENTRY_SIZE);
+}
+
+void usage (FILE *f)
+{
+  fprintf (f, "usage: blkconv pack in out     convert to a compressed container\n"
+	      "       blkconv unpack in out   convert to a raw block file\n"
+	      "       blkconv info file\n");
+}
+
+int main (int argc, char *argv [])
+{
+  if ((argc == 4) && (strcmp (argv [1], "pack") == 0))
+    {
+      openInput (argv [2]);
+      pack (argv [3]);
+    }
+  else if ((argc == 4) && (strcmp (argv [1], "unpack") == 0))
+    {
+      openInput (argv [2]);
+      unpack (argv [3]);
+    }
+  else if ((argc == 3) && (strcmp (argv [1], "info") == 0))
+    {
+      openInput (argv [2]);
+      info ();
+    }
+  else
+    {
+      usage (stderr);
+      exit (1);
+    }
+  exit (0);
+}
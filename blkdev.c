@@ -0,0 +1,913 @@
+// Block device for psim and isim, see blkdev.h
+//
+// The cache is an array of slots, found by block number through a
+// chained hash table and kept in least recently used order on a doubly
+// linked list.  Slots hold blocks as guest words, so a hit is a plain
+// copy.  Written blocks stay in the cache, marked dirty, until they are
+// evicted or flushed.
+//
+// The prefetcher watches for reads of consecutive blocks, and when it
+// sees a run of them asks a host thread to read the blocks that follow
+// into a small staging area, where a later read finds them without
+// touching the file.  The thread reads the mapping under a read lock
+// that is taken for writing when the file grows and is remapped, and
+// around writes to the mapping.  A write to a block also invalidates
+// any staged copy of it; a copy that was being read when the write
+// happened is discarded.
+//
+// In copy-on-write mode the file is the read-only base, mapped shared
+// so that every instance using it shares one copy in the page cache.
+// Written blocks go to a private overlay in host memory, which is
+// looked up before the base, and which is either discarded at close or
+// committed to the base.  Every instance holds a shared flock on the
+// base while it has it mapped, and a commit takes an exclusive one, so
+// the base never changes under a running instance.
+//
+// A file in the compressed container format of blkfile.h is read
+// through its index, which is kept in memory; records are read from
+// the mapping, or with pread if they were appended after it was made.
+// Written blocks are appended, and the index is stored when the device
+// is flushed.
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "blkdev.h"
+#include "blkfile.h"
+
+#define NIL (-1)
+
+#define PREFETCH_TRIGGER 2  // consecutive misses that start prefetching
+
+enum { STAGE_EMPTY, STAGE_PENDING, STAGE_READY };
+
+struct stage_slot
+{
+  uint32_t block;
+  int state;
+  uint16_t words [BLKDEV_BLOCK_WORDS];
+};
+
+struct overlay_block
+{
+  uint32_t block;
+  int next;   // next in the hash chain
+  uint16_t words [BLKDEV_BLOCK_WORDS];
+};
+
+struct blkcache_slot
+{
+  uint32_t block;
+  bool dirty;
+  int prev;   // toward the most recently used
+  int next;   // toward the least recently used
+  int hnext;  // next slot in the hash chain
+  uint16_t words [BLKDEV_BLOCK_WORDS];
+};
+
+struct blkdev
+{
+  char *fn;
+  int fd;
+  uint8_t *map;     // NULL while the file is empty
+  uint64_t size;    // of the file, in bytes
+  uint64_t map_size;  // of the mapping, which may extend past the file
+  uint64_t end;     // of the blocks that can be read, in bytes
+
+  int cow;          // BLKDEV_COW_...
+  struct timespec latency;
+  bool container;   // a blkfile.h container rather than a raw file
+  struct blkfile_header bf_header;
+  struct blkfile_entry *bf_index;
+  uint64_t bf_alloc;  // entries allocated for bf_index
+  bool bf_dirty;    // index changed since it was stored
+  struct overlay_block *overlay;
+  int overlay_count;
+  int overlay_alloc;  // also the size of overlay_hash
+  int *overlay_hash;
+  uint64_t dirty_lo;  // byte range written since the last flush
+  uint64_t dirty_hi;  // (empty if dirty_lo >= dirty_hi)
+
+  int cache_size;   // slots, 0 if there's no cache
+  int cache_used;
+  struct blkcache_slot *slot;
+  int *hash;        // first slot of each chain
+  uint32_t hash_mask;
+  int mru;          // most recently used slot
+  int lru;          // least recently used slot
+
+  int prefetch_blocks;  // how far ahead to read, 0 if not prefetching
+  uint32_t seq_next;    // block that would continue the current run
+  int seq_run;          // consecutive reads in the run
+  uint64_t prefetch_end;  // end of the blocks requested for the run
+  pthread_t prefetch_thread;
+  pthread_rwlock_t map_lock;  // for the prefetch thread's use of map
+
+  // the rest are protected by stage_mutex
+  pthread_mutex_t stage_mutex;
+  pthread_cond_t stage_cond;
+  bool stop;
+  uint64_t req_first;   // blocks requested but not yet started
+  uint64_t req_end;
+  int stage_size;
+  int stage_next;       // next slot to reuse
+  struct stage_slot *stage;
+
+  struct blkdev_stats stats;
+};
+
+static bool blkdevMap (struct blkdev *d)
+{
+  d->map = NULL;
+  if (! d->map_size)
+    return true;
+  d->map = mmap (NULL, d->map_size, PROT_READ | ((d->cow || d->container) ? 0 : PROT_WRITE),
+		 MAP_SHARED, d->fd, 0);
+  if (d->map == MAP_FAILED)
+    {
+      d->map = NULL;
+      return false;
+    }
+  return true;
+}
+
+// Grows the file to at least size bytes, which read as zeros.  The
+// mapping is made twice as large as needed, so that a file grown a
+// block at a time is only remapped a logarithmic number of times; the
+// part past the end of the file becomes usable as ftruncate extends it.
+// Pages dirtied through an old mapping are still in the page cache, so
+// the dirty range remains valid for the new one.  In copy-on-write mode
+// only the overlay grows, and a container grows as blocks are appended.
+static bool fileGrow (struct blkdev *d, uint64_t size)
+{
+  bool ok = true;
+
+  if (size <= d->end)
+    return true;
+  if (d->prefetch_blocks)
+    pthread_rwlock_wrlock (& d->map_lock);
+  d->end = size;
+  if (d->cow || d->container)
+    {
+      if (d->prefetch_blocks)
+	pthread_rwlock_unlock (& d->map_lock);
+      return true;
+    }
+  if (ftruncate (d->fd, size) == 0)
+    d->size = size;
+  d->end = d->size;
+  if (d->size > d->map_size)
+    {
+      if (d->map)
+	munmap (d->map, d->map_size);
+      d->map_size = 2 * d->size;
+      ok = blkdevMap (d);
+    }
+  if (d->prefetch_blocks)
+    pthread_rwlock_unlock (& d->map_lock);
+  if (! ok)
+    {
+      perror ("block file mmap");
+      exit (2);
+    }
+  return size <= d->size;
+}
+
+static inline uint32_t overlayHash (struct blkdev *d, uint32_t block)
+{
+  return (block * 2654435761u) & (d->overlay_alloc - 1);
+}
+
+static int overlayFind (struct blkdev *d, uint32_t block)
+{
+  int i;
+
+  if (! d->overlay_alloc)
+    return NIL;
+  for (i = d->overlay_hash [overlayHash (d, block)]; i != NIL; i = d->overlay [i].next)
+    if (d->overlay [i].block == block)
+      return i;
+  return NIL;
+}
+
+// Returns the overlay entry for a block, adding one if there isn't one.
+static int overlayAdd (struct blkdev *d, uint32_t block)
+{
+  uint32_t h;
+  int i;
+
+  i = overlayFind (d, block);
+  if (i != NIL)
+    return i;
+  if (d->overlay_count == d->overlay_alloc)
+    {
+      d->overlay_alloc = d->overlay_alloc ? 2 * d->overlay_alloc : 256;
+      d->overlay = realloc (d->overlay, d->overlay_alloc * sizeof (struct overlay_block));
+      d->overlay_hash = realloc (d->overlay_hash, d->overlay_alloc * sizeof (int));
+      if (! d->overlay || ! d->overlay_hash)
+	{
+	  fprintf (stderr, "out of memory for the block overlay\n");
+	  exit (2);
+	}
+      memset (d->overlay_hash, 0xff, d->overlay_alloc * sizeof (int));  // all NIL
+      for (i = 0; i < d->overlay_count; i++)
+	{
+	  h = overlayHash (d, d->overlay [i].block);
+	  d->overlay [i].next = d->overlay_hash [h];
+	  d->overlay_hash [h] = i;
+	}
+    }
+  i = d->overlay_count++;
+  d->stats.overlay_blocks = d->overlay_count;
+  h = overlayHash (d, block);
+  d->overlay [i].block = block;
+  d->overlay [i].next = d->overlay_hash [h];
+  d->overlay_hash [h] = i;
+  return i;
+}
+
+// The loops that convert between bytes and words are written so that
+// the compiler can vectorize the byte swapping.
+
+static void bytesToWords (const uint8_t *p, uint16_t *words)
+{
+  int i;
+
+  for (i = 0; i < BLKDEV_BLOCK_WORDS; i++)
+    words [i] = (p [2 * i] << 8) | p [2 * i + 1];
+}
+
+static void wordsToBytes (const uint16_t *words, uint8_t *p)
+{
+  int i;
+
+  for (i = 0; i < BLKDEV_BLOCK_WORDS; i++)
+    {
+      p [2 * i] = words [i] >> 8;
+      p [2 * i + 1] = words [i];
+    }
+}
+
+static bool containerRead (struct blkdev *d, uint32_t block, uint16_t *words)
+{
+  const struct blkfile_entry *e = & d->bf_index [block];
+  uint8_t record [BLKFILE_BLOCK_SIZE];
+  uint8_t buf [BLKFILE_BLOCK_SIZE];
+  const uint8_t *data = record;
+
+  if ((e->kind == BLKFILE_RAW) || (e->kind == BLKFILE_LZ))
+    {
+      if (e->length > BLKFILE_BLOCK_SIZE)
+	goto corrupt;
+      if (e->offset + e->length <= d->size)
+	data = d->map + e->offset;
+      else if (pread (d->fd, record, e->length, e->offset) != e->length)
+	goto corrupt;
+    }
+  if (! blkfileDecode (e, data, buf))
+    goto corrupt;
+  bytesToWords (buf, words);
+  return true;
+
+ corrupt:
+  fprintf (stderr, "block %" PRIu32 " of '%s' is corrupt\n", block, d->fn);
+  return false;
+}
+
+// Reads a block from the mapping or the container, or zeros for one in
+// the part of the file that has only grown in the overlay.
+static bool baseRead (struct blkdev *d, uint32_t block, uint16_t *words)
+{
+  uint64_t pos = (uint64_t) block * BLKDEV_BLOCK_SIZE;
+
+  if (d->latency.tv_sec || d->latency.tv_nsec)
+    nanosleep (& d->latency, NULL);
+  if (d->container && (block < d->bf_header.block_count))
+    return containerRead (d, block, words);
+  if (d->container || (pos + BLKDEV_BLOCK_SIZE > d->size))
+    {
+      if (pos + BLKDEV_BLOCK_SIZE > d->end)
+	return false;
+      memset (words, 0, BLKDEV_BLOCK_SIZE);
+      return true;
+    }
+  bytesToWords (d->map + pos, words);
+  return true;
+}
+
+static bool fileRead (struct blkdev *d, uint32_t block, uint16_t *words)
+{
+  int i;
+
+  if (d->cow && ((i = overlayFind (d, block)) != NIL))
+    {
+      memcpy (words, d->overlay [i].words, BLKDEV_BLOCK_SIZE);
+      return true;
+    }
+  return baseRead (d, block, words);
+}
+
+static void stageInvalidate (struct blkdev *d, uint32_t block)
+{
+  int i;
+
+  pthread_mutex_lock (& d->stage_mutex);
+  for (i = 0; i < d->stage_size; i++)
+    if (d->stage [i].block == block)
+      d->stage [i].state = STAGE_EMPTY;
+  pthread_mutex_unlock (& d->stage_mutex);
+}
+
+// Copies a block from the staging area if it's there, freeing its slot.
+static bool stageTake (struct blkdev *d, uint32_t block, uint16_t *words)
+{
+  bool found = false;
+  int i;
+
+  pthread_mutex_lock (& d->stage_mutex);
+  for (i = 0; i < d->stage_size; i++)
+    if ((d->stage [i].block == block) && (d->stage [i].state == STAGE_READY))
+      {
+	memcpy (words, d->stage [i].words, sizeof (d->stage [i].words));
+	d->stage [i].state = STAGE_EMPTY;
+	d->stats.prefetch_hits++;
+	found = true;
+	break;
+      }
+  pthread_mutex_unlock (& d->stage_mutex);
+  return found;
+}
+
+static void *prefetchThread (void *arg)
+{
+  struct blkdev *d = arg;
+  struct stage_slot *p;
+  uint16_t words [BLKDEV_BLOCK_WORDS];
+  uint32_t block;
+  bool ok;
+
+  pthread_mutex_lock (& d->stage_mutex);
+  for (;;)
+    {
+      while ((! d->stop) && (d->req_first >= d->req_end))
+	pthread_cond_wait (& d->stage_cond, & d->stage_mutex);
+      if (d->stop)
+	break;
+      block = d->req_first++;
+      p = & d->stage [d->stage_next];
+      d->stage_next = (d->stage_next + 1) % d->stage_size;
+      p->block = block;
+      p->state = STAGE_PENDING;
+      pthread_mutex_unlock (& d->stage_mutex);
+
+      pthread_rwlock_rdlock (& d->map_lock);
+      ok = baseRead (d, block, words);
+      pthread_rwlock_unlock (& d->map_lock);
+
+      pthread_mutex_lock (& d->stage_mutex);
+      if (! ok)
+	{
+	  p->state = STAGE_EMPTY;
+	  d->req_first = d->req_end;  // end of file
+	}
+      else if ((p->state == STAGE_PENDING) && (p->block == block))
+	{
+	  memcpy (p->words, words, sizeof (words));
+	  p->state = STAGE_READY;
+	  d->stats.prefetched++;
+	}
+    }
+  pthread_mutex_unlock (& d->stage_mutex);
+  return NULL;
+}
+
+// Called for every read that misses the cache, since blocks the cache
+// holds need no prefetching; once a run of consecutive blocks is seen,
+// asks the prefetch thread for the next prefetch_blocks blocks, topping
+// the request up when the run has used half of it.
+static void prefetchDetect (struct blkdev *d, uint32_t block)
+{
+  uint64_t first;
+  uint64_t end = (uint64_t) block + 1 + d->prefetch_blocks;
+
+  if (block == d->seq_next)
+    d->seq_run++;
+  else
+    {
+      d->seq_run = 0;
+      d->prefetch_end = 0;
+    }
+  d->seq_next = block + 1;
+  if (d->seq_run < PREFETCH_TRIGGER)
+    return;
+  first = (d->prefetch_end > block + 1) ? d->prefetch_end : block + 1;
+  if (end - first < (uint64_t) (d->prefetch_blocks + 1) / 2)
+    return;
+  pthread_mutex_lock (& d->stage_mutex);
+  d->req_first = first;
+  d->req_end = end;
+  pthread_cond_signal (& d->stage_cond);
+  pthread_mutex_unlock (& d->stage_mutex);
+  d->prefetch_end = end;
+}
+
+static bool prefetchStart (struct blkdev *d, int blocks)
+{
+  sigset_t all, old;
+  int err;
+
+  d->stage_size = 2 * blocks;
+  d->stage = calloc (d->stage_size, sizeof (struct stage_slot));
+  if (! d->stage)
+    return false;
+  pthread_rwlock_init (& d->map_lock, NULL);
+  pthread_mutex_init (& d->stage_mutex, NULL);
+  pthread_cond_init (& d->stage_cond, NULL);
+  // signals are handled by the simulator thread
+  sigfillset (& all);
+  pthread_sigmask (SIG_BLOCK, & all, & old);
+  err = pthread_create (& d->prefetch_thread, NULL, prefetchThread, d);
+  pthread_sigmask (SIG_SETMASK, & old, NULL);
+  if (err)
+    return false;
+  d->prefetch_blocks = blocks;
+  return true;
+}
+
+static void prefetchStop (struct blkdev *d)
+{
+  pthread_mutex_lock (& d->stage_mutex);
+  d->stop = true;
+  pthread_cond_signal (& d->stage_cond);
+  pthread_mutex_unlock (& d->stage_mutex);
+  pthread_join (d->prefetch_thread, NULL);
+  d->prefetch_blocks = 0;
+}
+
+// Appends a block to the container open as fd.
+static bool containerWrite (struct blkdev *d, int fd, uint32_t block, const uint16_t *words)
+{
+  struct blkfile_entry e;
+  uint8_t buf [BLKFILE_BLOCK_SIZE];
+  uint64_t n;
+
+  wordsToBytes (words, buf);
+  if (! blkfileAppend (fd, & d->bf_header, & e, buf))
+    {
+      fprintf (stderr, "error writing block %" PRIu32 " to '%s'\n", block, d->fn);
+      return false;
+    }
+  if (d->prefetch_blocks)
+    pthread_rwlock_wrlock (& d->map_lock);
+  if (block >= d->bf_alloc)
+    {
+      for (n = d->bf_alloc; n <= block; n *= 2)
+	;
+      d->bf_index = realloc (d->bf_index, n * sizeof (struct blkfile_entry));
+      if (! d->bf_index)
+	{
+	  fprintf (stderr, "out of memory for the block index\n");
+	  exit (2);
+	}
+      memset (d->bf_index + d->bf_alloc, 0, (n - d->bf_alloc) * sizeof (struct blkfile_entry));
+      d->bf_alloc = n;
+    }
+  if (block >= d->bf_header.block_count)
+    d->bf_header.block_count = (uint64_t) block + 1;  // any gap is BLKFILE_ZERO
+  d->bf_index [block] = e;
+  if (d->prefetch_blocks)
+    pthread_rwlock_unlock (& d->map_lock);
+  d->bf_dirty = true;
+  return true;
+}
+
+static bool fileWrite (struct blkdev *d, uint32_t block, const uint16_t *words)
+{
+  uint64_t pos = (uint64_t) block * BLKDEV_BLOCK_SIZE;
+  int i;
+
+  if (! fileGrow (d, pos + BLKDEV_BLOCK_SIZE))
+    {
+      fprintf (stderr, "can't grow block file to write block %" PRIu32 "\n", block);
+      return false;
+    }
+  if (d->cow)
+    {
+      i = overlayAdd (d, block);  // which may move the overlay
+      memcpy (d->overlay [i].words, words, BLKDEV_BLOCK_SIZE);
+      d->stats.write_backs++;
+      if (d->prefetch_blocks)
+	stageInvalidate (d, block);
+      return true;
+    }
+  if (d->container)
+    {
+      if (! containerWrite (d, d->fd, block, words))
+	return false;
+      d->stats.write_backs++;
+      if (d->prefetch_blocks)
+	stageInvalidate (d, block);
+      return true;
+    }
+  // the prefetch thread may be reading the same bytes
+  if (d->prefetch_blocks)
+    pthread_rwlock_wrlock (& d->map_lock);
+  wordsToBytes (words, d->map + pos);
+  if (d->prefetch_blocks)
+    pthread_rwlock_unlock (& d->map_lock);
+  if (pos < d->dirty_lo)
+    d->dirty_lo = pos;
+  if (pos + BLKDEV_BLOCK_SIZE > d->dirty_hi)
+    d->dirty_hi = pos + BLKDEV_BLOCK_SIZE;
+  d->stats.write_backs++;
+  if (d->prefetch_blocks)
+    stageInvalidate (d, block);
+  return true;
+}
+
+static void fileSync (struct blkdev *d)
+{
+  uint64_t lo;
+  long page = sysconf (_SC_PAGESIZE);
+
+  if (d->container && d->bf_dirty)
+    {
+      if (! blkfileStore (d->fd, & d->bf_header, d->bf_index))
+	fprintf (stderr, "error writing the block index of '%s'\n", d->fn);
+      d->bf_dirty = false;
+    }
+  if (d->dirty_lo >= d->dirty_hi)
+    return;
+  lo = d->dirty_lo & ~ (uint64_t) (page - 1);
+  if (msync (d->map + lo, d->dirty_hi - lo, MS_SYNC) < 0)
+    perror ("block file msync");
+  d->dirty_lo = UINT64_MAX;
+  d->dirty_hi = 0;
+}
+
+static inline uint32_t hashBlock (struct blkdev *d, uint32_t block)
+{
+  return (block * 2654435761u) & d->hash_mask;
+}
+
+static void lruUnlink (struct blkdev *d, int s)
+{
+  struct blkcache_slot *p = & d->slot [s];
+
+  if (p->prev != NIL)
+    d->slot [p->prev].next = p->next;
+  else
+    d->mru = p->next;
+  if (p->next != NIL)
+    d->slot [p->next].prev = p->prev;
+  else
+    d->lru = p->prev;
+}
+
+static void lruPushFront (struct blkdev *d, int s)
+{
+  d->slot [s].prev = NIL;
+  d->slot [s].next = d->mru;
+  if (d->mru != NIL)
+    d->slot [d->mru].prev = s;
+  else
+    d->lru = s;
+  d->mru = s;
+}
+
+static int cacheLookup (struct blkdev *d, uint32_t block)
+{
+  int s;
+
+  for (s = d->hash [hashBlock (d, block)]; s != NIL; s = d->slot [s].hnext)
+    if (d->slot [s].block == block)
+      {
+	if (s != d->mru)
+	  {
+	    lruUnlink (d, s);
+	    lruPushFront (d, s);
+	  }
+	return s;
+      }
+  return NIL;
+}
+
+// Returns a slot for a block that isn't in the cache, evicting the
+// least recently used block if the cache is full.  A dirty block that
+// can't be written back stays in the cache, and a clean one is evicted
+// instead; returns NIL if there's none.
+static int cacheInsert (struct blkdev *d, uint32_t block)
+{
+  bool failed = false;
+  int *link;
+  int s;
+
+  if (d->cache_used < d->cache_size)
+    s = d->cache_used++;
+  else
+    {
+      for (s = d->lru; s != NIL; s = d->slot [s].prev)
+	if (! d->slot [s].dirty)
+	  break;
+	else if (! failed)
+	  {
+	    if (fileWrite (d, d->slot [s].block, d->slot [s].words))
+	      break;
+	    failed = true;  // don't try the others, which would fail too
+	  }
+      if (s == NIL)
+	return NIL;
+      for (link = & d->hash [hashBlock (d, d->slot [s].block)];
+	   *link != s;
+	   link = & d->slot [*link].hnext)
+	;
+      *link = d->slot [s].hnext;
+      lruUnlink (d, s);
+      d->stats.evictions++;
+    }
+  d->slot [s].block = block;
+  d->slot [s].dirty = false;
+  d->slot [s].hnext = d->hash [hashBlock (d, block)];
+  d->hash [hashBlock (d, block)] = s;
+  lruPushFront (d, s);
+  return s;
+}
+
+struct dirty_block
+{
+  uint32_t block;
+  int slot;
+};
+
+static int compareDirtyBlocks (const void *a, const void *b)
+{
+  uint32_t ba = ((const struct dirty_block *) a)->block;
+  uint32_t bb = ((const struct dirty_block *) b)->block;
+
+  return (ba > bb) - (ba < bb);
+}
+
+struct blkdev *blkdevOpen (const char *fn, const struct blkdev_options *opt)
+{
+  struct blkdev *d;
+  struct stat st;
+  uint32_t n;
+
+  d = calloc (1, sizeof (struct blkdev));
+  if (! d)
+    return NULL;
+  d->cow = opt->cow;
+  d->latency.tv_sec = opt->latency_us / 1000000;
+  d->latency.tv_nsec = (opt->latency_us % 1000000) * 1000;
+  d->fn = strdup (fn);
+  d->fd = open (fn, d->cow ? O_RDONLY : O_RDWR);
+  if (d->fd < 0)
+    goto fail;
+  // waits for any instance that is committing to the base
+  if (d->cow && (flock (d->fd, LOCK_SH) < 0))
+    goto fail;
+  if (fstat (d->fd, & st) < 0)
+    goto fail;
+  d->size = st.st_size;
+  d->map_size = d->size;
+  d->end = d->size;
+  d->dirty_lo = UINT64_MAX;
+  if (blkfileCheck (d->fd))
+    {
+      d->container = true;
+      if (! blkfileLoad (d->fd, & d->bf_header, & d->bf_index, & d->bf_alloc))
+	{
+	  fprintf (stderr, "block container '%s' is corrupt\n", fn);
+	  goto fail;
+	}
+      d->end = d->bf_header.block_count * BLKDEV_BLOCK_SIZE;
+    }
+  if (! blkdevMap (d))
+    goto fail;
+
+  d->mru = d->lru = NIL;
+  if (opt->cache_blocks > 0)
+    {
+      for (n = 1; n < 2 * (uint32_t) opt->cache_blocks; n <<= 1)
+	;
+      d->slot = calloc (opt->cache_blocks, sizeof (struct blkcache_slot));
+      d->hash = malloc (n * sizeof (int));
+      if (! d->slot || ! d->hash)
+	goto fail;
+      memset (d->hash, 0xff, n * sizeof (int));  // all NIL
+      d->hash_mask = n - 1;
+      d->cache_size = opt->cache_blocks;
+    }
+  if ((opt->prefetch_blocks > 0) && ! prefetchStart (d, opt->prefetch_blocks))
+    goto fail;
+  return d;
+
+ fail:
+  if (d->map)
+    munmap (d->map, d->map_size);
+  if (d->fd >= 0)
+    close (d->fd);
+  free (d->fn);
+  free (d->bf_index);
+  free (d->slot);
+  free (d->hash);
+  free (d->stage);
+  free (d);
+  return NULL;
+}
+
+// Dirty blocks are written in block order, after growing the file once
+// for the highest of them, so that a flush is one pass over the file.
+void blkdevFlush (struct blkdev *d)
+{
+  struct dirty_block *dirty;
+  int count = 0;
+  int s;
+  int i;
+
+  dirty = malloc ((d->cache_used + 1) * sizeof (struct dirty_block));
+  for (s = 0; s < d->cache_used; s++)
+    if (d->slot [s].dirty)
+      {
+	dirty [count].block = d->slot [s].block;
+	dirty [count++].slot = s;
+      }
+  if (count)
+    {
+      qsort (dirty, count, sizeof (struct dirty_block), compareDirtyBlocks);
+      fileGrow (d, ((uint64_t) dirty [count - 1].block + 1) * BLKDEV_BLOCK_SIZE);
+      for (i = 0; i < count; i++)
+	if (fileWrite (d, dirty [i].block, d->slot [dirty [i].slot].words))
+	  d->slot [dirty [i].slot].dirty = false;
+      d->stats.flushes++;
+    }
+  free (dirty);
+  fileSync (d);
+}
+
+static int compareOverlayBlocks (const void *a, const void *b)
+{
+  uint32_t ba = ((const struct overlay_block *) a)->block;
+  uint32_t bb = ((const struct overlay_block *) b)->block;
+
+  return (ba > bb) - (ba < bb);
+}
+
+// Writes the overlay to the base file, in block order, holding an
+// exclusive lock on the file, which waits until every other instance
+// using the base has closed it.  A container's index is loaded again
+// under the lock, since an instance that committed earlier may have
+// appended to it.
+static void overlayCommit (struct blkdev *d)
+{
+  uint8_t buf [BLKDEV_BLOCK_SIZE];
+  struct overlay_block *p;
+  int fd;
+  int i;
+
+  flock (d->fd, LOCK_UN);  // our shared lock, held through another fd
+  fd = open (d->fn, O_RDWR);
+  if ((fd >= 0) && (flock (fd, LOCK_EX | LOCK_NB) < 0))
+    {
+      fprintf (stderr, "waiting for other instances using '%s' to exit, to commit the block overlay\n",
+	       d->fn);
+      if (flock (fd, LOCK_EX) < 0)
+	{
+	  close (fd);
+	  fd = -1;
+	}
+    }
+  if (fd < 0)
+    {
+      fprintf (stderr, "can't commit block overlay to '%s'\n", d->fn);
+      return;
+    }
+  // the hash chains aren't needed any more
+  qsort (d->overlay, d->overlay_count, sizeof (struct overlay_block), compareOverlayBlocks);
+  if (d->container)
+    {
+      if (! blkfileLoad (fd, & d->bf_header, & d->bf_index, & d->bf_alloc))
+	fprintf (stderr, "block container '%s' is corrupt\n", d->fn);
+      else
+	{
+	  for (i = 0; i < d->overlay_count; i++)
+	    if (! containerWrite (d, fd, d->overlay [i].block, d->overlay [i].words))
+	      break;
+	  if (! blkfileStore (fd, & d->bf_header, d->bf_index))
+	    fprintf (stderr, "error writing the block index of '%s'\n", d->fn);
+	}
+      flock (fd, LOCK_UN);
+      close (fd);
+      return;
+    }
+  for (i = 0; i < d->overlay_count; i++)
+    {
+      p = & d->overlay [i];
+      wordsToBytes (p->words, buf);
+      if (pwrite (fd, buf, BLKDEV_BLOCK_SIZE, (off_t) p->block * BLKDEV_BLOCK_SIZE)
+	  != BLKDEV_BLOCK_SIZE)
+	{
+	  fprintf (stderr, "error committing block %" PRIu32 " to '%s'\n", p->block, d->fn);
+	  break;
+	}
+    }
+  fsync (fd);
+  flock (fd, LOCK_UN);
+  close (fd);
+}
+
+void blkdevClose (struct blkdev *d)
+{
+  if (d->prefetch_blocks)
+    prefetchStop (d);
+  blkdevFlush (d);
+  if ((d->cow == BLKDEV_COW_COMMIT) && d->overlay_count)
+    overlayCommit (d);
+  if (d->map)
+    munmap (d->map, d->map_size);
+  close (d->fd);
+  free (d->fn);
+  free (d->bf_index);
+  free (d->overlay);
+  free (d->overlay_hash);
+  free (d->slot);
+  free (d->hash);
+  free (d->stage);
+  free (d);
+}
+
+// Reads a block that isn't in the cache, from the staging area or the
+// file.
+static bool deviceRead (struct blkdev *d, uint32_t block, uint16_t *words)
+{
+  if (! d->prefetch_blocks)
+    return fileRead (d, block, words);
+  prefetchDetect (d, block);
+  if (! (d->cow && (overlayFind (d, block) != NIL)) &&
+      stageTake (d, block, words))
+    return true;
+  return fileRead (d, block, words);
+}
+
+bool blkdevRead (struct blkdev *d, uint32_t block, uint16_t *words)
+{
+  int s;
+
+  if (! d->cache_size)
+    return deviceRead (d, block, words);
+  s = cacheLookup (d, block);
+  if (s != NIL)
+    d->stats.hits++;
+  else
+    {
+      d->stats.misses++;
+      if (((uint64_t) block + 1) * BLKDEV_BLOCK_SIZE > d->end)
+	return false;
+      // read before taking a slot, so that a block that can't be read
+      // isn't cached
+      if (! deviceRead (d, block, words))
+	return false;
+      s = cacheInsert (d, block);
+      if (s != NIL)
+	memcpy (d->slot [s].words, words, sizeof (d->slot [s].words));
+      return true;
+    }
+  memcpy (words, d->slot [s].words, sizeof (d->slot [s].words));
+  return true;
+}
+
+bool blkdevWrite (struct blkdev *d, uint32_t block, const uint16_t *words)
+{
+  int s;
+
+  if (! d->cache_size)
+    return fileWrite (d, block, words);
+  s = cacheLookup (d, block);
+  if (s == NIL)
+    s = cacheInsert (d, block);
+  // with every block dirty and unwritable, try writing through
+  if (s == NIL)
+    return fileWrite (d, block, words);
+  memcpy (d->slot [s].words, words, sizeof (d->slot [s].words));
+  d->slot [s].dirty = true;
+  return true;
+}
+
+// The prefetch thread's counters are read without its lock, which is
+// good enough for reporting.
+const struct blkdev_stats *blkdevStats (struct blkdev *d)
+{
+  return & d->stats;
+}
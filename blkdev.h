@@ -0,0 +1,73 @@
+// Block device for the BLOCKIO traps of psim and isim.  The block file
+// is mapped into memory, so a transfer is a copy between the mapping
+// and guest memory.  Guest words are big-endian in the file: the first
+// byte of a block is the high byte of the word at the buffer address.
+//
+// Blocks may be kept in a least recently used cache in front of the
+// file, in which case writes are held there until the block is evicted
+// or the device is flushed or closed.  Runs of consecutive reads can
+// also start a host thread reading the blocks that follow ahead of
+// time.
+//
+// In copy-on-write mode the file is only read, and written blocks are
+// kept in a private overlay that is discarded or committed to the file
+// when the device is closed, so that many simulators can share one
+// block file.
+
+#define BLKDEV_BLOCK_SIZE  128  // bytes
+#define BLKDEV_BLOCK_WORDS (BLKDEV_BLOCK_SIZE / 2)
+
+// The BLOCKIO traps take a 32-bit block number, whose high byte selects
+// a drive unit, each its own block file.
+#define BLKDEV_DRIVES       128
+#define BLKDEV_DRIVE_SHIFT  24
+#define BLKDEV_DRIVE_BLOCKS (1 << BLKDEV_DRIVE_SHIFT)
+
+#define BLKDEV_DEFAULT_CACHE    1024  // blocks
+#define BLKDEV_DEFAULT_PREFETCH 16    // blocks
+
+enum { BLKDEV_COW_OFF, BLKDEV_COW_DISCARD, BLKDEV_COW_COMMIT };
+
+struct blkdev_options
+{
+  int cache_blocks;     // size of the cache, 0 for none
+  int prefetch_blocks;  // how far to read ahead, 0 for no prefetching
+  int cow;              // BLKDEV_COW_...
+  int latency_us;       // added to every read from the file, to model
+                        // slow storage when benchmarking
+};
+
+struct blkdev;
+
+struct blkdev_stats
+{
+  uint64_t hits;         // reads found in the cache
+  uint64_t misses;       // reads from the file
+  uint64_t evictions;    // blocks dropped from the cache to make room
+  uint64_t write_backs;  // blocks written to the file
+  uint64_t flushes;      // flushes that had blocks to write
+  uint64_t prefetched;   // blocks read ahead by the prefetch thread
+  uint64_t prefetch_hits;  // reads satisfied by them
+  uint64_t overlay_blocks;  // blocks in the copy-on-write overlay
+};
+
+// Returns NULL if the file can't be opened and mapped.
+struct blkdev *blkdevOpen (const char *fn, const struct blkdev_options *opt);
+
+// Flushes and unmaps the file, first committing the overlay in
+// BLKDEV_COW_COMMIT mode.
+void blkdevClose (struct blkdev *d);
+
+// Reads a block into words, returning false, with words unchanged, if
+// the block is beyond the end of the file.
+bool blkdevRead (struct blkdev *d, uint32_t block, uint16_t *words);
+
+// Writes a block from words, growing the file if the block is beyond
+// its end.  Returns false if the file can't be grown, or if the cache
+// is full of written blocks that can't be written back.
+bool blkdevWrite (struct blkdev *d, uint32_t block, const uint16_t *words);
+
+// Writes the blocks modified since the last flush back to the file.
+void blkdevFlush (struct blkdev *d);
+
+const struct blkdev_stats *blkdevStats (struct blkdev *d);
@@ -0,0 +1,180 @@
+// Asynchronous block transfers, see blkdma.h
+//
+// The queue is a ring of requests.  A request stays in the ring while
+// the thread works on it, and after, until blkdmaFinish takes it on the
+// simulator thread.  The mutex orders the thread's use of a request's
+// buffer against the simulator's.
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "blkdev.h"
+#include "blkdma.h"
+
+struct blkdma_request
+{
+  struct blkdev *d;
+  uint32_t block;
+  uint16_t *words;
+  bool read;
+  uint16_t *status;
+  bool ok;
+  uint16_t buf [BLKDEV_BLOCK_WORDS];
+};
+
+struct blkdma
+{
+  pthread_t thread;
+  pthread_mutex_t mutex;
+  pthread_cond_t work;   // signalled when a request is queued, or to stop
+  pthread_cond_t done;   // signalled when a request is finished
+  bool stop;
+  int depth;
+  int first;             // oldest request
+  int count;
+  int finished;          // requests done by the thread, from first on
+  struct blkdma_request *ring;
+  struct blkdma_stats stats;
+};
+
+static void *blkdmaThread (void *arg)
+{
+  struct blkdma *q = arg;
+  struct blkdma_request *r;
+
+  pthread_mutex_lock (& q->mutex);
+  for (;;)
+    {
+      while ((! q->stop) && (q->finished == q->count))
+	pthread_cond_wait (& q->work, & q->mutex);
+      if (q->finished == q->count)
+	break;  // stopping, and nothing left to do
+      r = & q->ring [(q->first + q->finished) % q->depth];
+      pthread_mutex_unlock (& q->mutex);
+
+      if (r->read)
+	r->ok = blkdevRead (r->d, r->block, r->buf);
+      else
+	r->ok = blkdevWrite (r->d, r->block, r->buf);
+
+      pthread_mutex_lock (& q->mutex);
+      q->finished++;
+      pthread_cond_broadcast (& q->done);
+    }
+  pthread_mutex_unlock (& q->mutex);
+  return NULL;
+}
+
+struct blkdma *blkdmaCreate (int depth)
+{
+  struct blkdma *q;
+  sigset_t all, old;
+  int err;
+
+  q = calloc (1, sizeof (struct blkdma));
+  if (! q)
+    return NULL;
+  q->depth = depth;
+  q->ring = calloc (depth, sizeof (struct blkdma_request));
+  if (! q->ring)
+    {
+      free (q);
+      return NULL;
+    }
+  pthread_mutex_init (& q->mutex, NULL);
+  pthread_cond_init (& q->work, NULL);
+  pthread_cond_init (& q->done, NULL);
+  // signals are handled by the simulator thread
+  sigfillset (& all);
+  pthread_sigmask (SIG_BLOCK, & all, & old);
+  err = pthread_create (& q->thread, NULL, blkdmaThread, q);
+  pthread_sigmask (SIG_SETMASK, & old, NULL);
+  if (err)
+    {
+      free (q->ring);
+      free (q);
+      return NULL;
+    }
+  return q;
+}
+
+void blkdmaDestroy (struct blkdma *q)
+{
+  pthread_mutex_lock (& q->mutex);
+  q->stop = true;
+  pthread_cond_signal (& q->work);
+  pthread_mutex_unlock (& q->mutex);
+  pthread_join (q->thread, NULL);
+  pthread_mutex_destroy (& q->mutex);
+  pthread_cond_destroy (& q->work);
+  pthread_cond_destroy (& q->done);
+  free (q->ring);
+  free (q);
+}
+
+bool blkdmaStart (struct blkdma *q, struct blkdev *d, uint32_t block,
+		  uint16_t *words, bool read, uint16_t *status)
+{
+  struct blkdma_request *r;
+
+  pthread_mutex_lock (& q->mutex);
+  if (q->count == q->depth)
+    {
+      q->stats.full++;
+      pthread_mutex_unlock (& q->mutex);
+      return false;
+    }
+  r = & q->ring [(q->first + q->count) % q->depth];
+  r->d = d;
+  r->block = block;
+  r->words = words;
+  r->read = read;
+  r->status = status;
+  if (! read)
+    memcpy (r->buf, words, sizeof (r->buf));
+  *status = BLKDMA_BUSY;
+  q->count++;
+  q->stats.transfers++;
+  pthread_cond_signal (& q->work);
+  pthread_mutex_unlock (& q->mutex);
+  return true;
+}
+
+bool blkdmaFinish (struct blkdma *q, bool wait, struct blkdma_done *r)
+{
+  struct blkdma_request *e;
+
+  pthread_mutex_lock (& q->mutex);
+  if (wait && q->count && ! q->finished)
+    {
+      q->stats.waits++;
+      while (! q->finished)
+	pthread_cond_wait (& q->done, & q->mutex);
+    }
+  if (! q->finished)
+    {
+      pthread_mutex_unlock (& q->mutex);
+      return false;
+    }
+  e = & q->ring [q->first];
+  if (e->read && e->ok)
+    memcpy (e->words, e->buf, sizeof (e->buf));
+  *e->status = e->ok ? BLKDMA_DONE : BLKDMA_ERROR;
+  r->words = e->words;
+  r->read = e->read;
+  r->status = e->status;
+  q->first = (q->first + 1) % q->depth;
+  q->count--;
+  q->finished--;
+  pthread_mutex_unlock (& q->mutex);
+  return true;
+}
+
+const struct blkdma_stats *blkdmaStats (struct blkdma *q)
+{
+  return & q->stats;
+}
@@ -0,0 +1,58 @@
+// Asynchronous block transfers, for the DMA trap of psim.  Starting a
+// transfer queues it and returns at once.  A host thread then reads or
+// writes the block with blkdev, to or from a buffer of its own, so the
+// guest can go on executing while the transfer is done.  Guest memory
+// is only touched by the simulator thread: the block to be written is
+// copied when the transfer is started, and blkdmaFinish copies the
+// block read, and stores the status word, when the simulator polls for
+// finished transfers.
+//
+// A blkdev is only used by one thread at a time, so the caller must
+// not use a device itself while transfers are queued: finish them all
+// first.
+
+#define BLKDMA_DEFAULT_DEPTH 8  // transfers
+
+// status word values
+#define BLKDMA_BUSY  0x0000
+#define BLKDMA_DONE  0x0001
+#define BLKDMA_ERROR 0xffff  // no such block, or the file can't be grown
+
+struct blkdma;
+
+struct blkdma_stats
+{
+  uint64_t transfers;   // started
+  uint64_t waits;       // blkdmaFinish calls that had to wait
+  uint64_t full;        // starts refused because the queue was full
+};
+
+// a finished transfer, as returned by blkdmaFinish
+struct blkdma_done
+{
+  uint16_t *words;
+  bool read;
+  uint16_t *status;
+};
+
+// Starts the host thread, with room for depth queued transfers.
+// Returns NULL if it can't be started.
+struct blkdma *blkdmaCreate (int depth);
+
+// Waits for the queued transfers, then stops the thread.  Transfers
+// that were not finished with blkdmaFinish are dropped.
+void blkdmaDestroy (struct blkdma *q);
+
+// Queues a transfer of a block between d and words, and sets *status
+// to BLKDMA_BUSY.  A block to be written is copied from words now.
+// Returns false, doing nothing, if the queue is full.
+bool blkdmaStart (struct blkdma *q, struct blkdev *d, uint32_t block,
+		  uint16_t *words, bool read, uint16_t *status);
+
+// Finishes the oldest transfer, if the host thread is done with it:
+// copies a block read to its words, sets its *status to BLKDMA_DONE or
+// BLKDMA_ERROR, and describes it in *r.  If wait is true and transfers
+// are queued, waits for the oldest.  Returns false if there was none.
+bool blkdmaFinish (struct blkdma *q, bool wait, struct blkdma_done *r);
+
+const struct blkdma_stats *blkdmaStats (struct blkdma *q);
@@ -0,0 +1,336 @@
+// Sparse, compressed block file, see blkfile.h
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "blkfile.h"
+
+#define N BLKFILE_BLOCK_SIZE
+
+#define LZ_MIN_MATCH 3
+#define LZ_MAX_MATCH (0x7f + LZ_MIN_MATCH)
+#define LZ_MAX_OFFSET 256
+
+// Greedy LZ77, with an exhaustive search for the longest match, which
+// is cheap for a 128-byte block.  Returns N if the result wouldn't be
+// smaller than the block.
+static int lzCompress (const uint8_t *in, uint8_t *out)
+{
+  int i = 0;
+  int o = 0;
+  int lit = -1;  // index in out of the open literal token, if any
+  int best_len, best_off;
+  int len;
+  int j;
+
+  while (i < N)
+    {
+      best_len = 0;
+      best_off = 0;
+      for (j = i - 1; (j >= 0) && (i - j <= LZ_MAX_OFFSET); j--)
+	{
+	  for (len = 0; (i + len < N) && (len < LZ_MAX_MATCH) && (in [j + len] == in [i + len]); len++)
+	    ;
+	  if (len > best_len)
+	    {
+	      best_len = len;
+	      best_off = i - j;
+	    }
+	}
+      if (best_len >= LZ_MIN_MATCH)
+	{
+	  if (o + 2 >= N)
+	    return N;
+	  out [o++] = 0x80 | (best_len - LZ_MIN_MATCH);
+	  out [o++] = best_off - 1;
+	  i += best_len;
+	  lit = -1;
+	}
+      else
+	{
+	  if ((lit < 0) || (out [lit] == 0x7f))
+	    {
+	      if (o + 2 >= N)
+		return N;
+	      lit = o;
+	      out [o++] = 0;
+	    }
+	  else if (o + 1 >= N)
+	    return N;
+	  else
+	    out [lit]++;
+	  out [o++] = in [i++];
+	}
+    }
+  return o;
+}
+
+static bool lzDecompress (const uint8_t *in, int length, uint8_t *out)
+{
+  int i = 0;
+  int o = 0;
+  int n, off;
+
+  while (i < length)
+    {
+      if (in [i] & 0x80)
+	{
+	  n = (in [i++] & 0x7f) + LZ_MIN_MATCH;
+	  if (i >= length)
+	    return false;
+	  off = in [i++] + 1;
+	  if ((off > o) || (o + n > N))
+	    return false;
+	  for (; n; n--, o++)
+	    out [o] = out [o - off];
+	}
+      else
+	{
+	  n = in [i++] + 1;
+	  if ((i + n > length) || (o + n > N))
+	    return false;
+	  memcpy (out + o, in + i, n);
+	  i += n;
+	  o += n;
+	}
+    }
+  return o == N;
+}
+
+// Conversion of the header and index between host structs and their
+// little-endian form in the file.
+static void put16 (uint8_t *p, uint16_t v)
+{
+  p [0] = v;
+  p [1] = v >> 8;
+}
+
+static void put32 (uint8_t *p, uint32_t v)
+{
+  put16 (p, v);
+  put16 (p + 2, v >> 16);
+}
+
+static void put64 (uint8_t *p, uint64_t v)
+{
+  put32 (p, v);
+  put32 (p + 4, v >> 32);
+}
+
+static uint16_t get16 (const uint8_t *p)
+{
+  return p [0] | (p [1] << 8);
+}
+
+static uint32_t get32 (const uint8_t *p)
+{
+  return get16 (p) | ((uint32_t) get16 (p + 2) << 16);
+}
+
+static uint64_t get64 (const uint8_t *p)
+{
+  return get32 (p) | ((uint64_t) get32 (p + 4) << 32);
+}
+
+static void headerEncode (const struct blkfile_header *h, uint8_t *p)
+{
+  memcpy (p, h->magic, sizeof (h->magic));
+  put32 (p + 8, h->block_size);
+  put32 (p + 12, h->index_room);
+  put64 (p + 16, h->block_count);
+  put64 (p + 24, h->index_offset);
+  put64 (p + 32, h->data_end);
+}
+
+static void headerDecode (const uint8_t *p, struct blkfile_header *h)
+{
+  memcpy (h->magic, p, sizeof (h->magic));
+  h->block_size = get32 (p + 8);
+  h->index_room = get32 (p + 12);
+  h->block_count = get64 (p + 16);
+  h->index_offset = get64 (p + 24);
+  h->data_end = get64 (p + 32);
+}
+
+static bool headerWrite (int fd, const struct blkfile_header *h)
+{
+  uint8_t buf [BLKFILE_HEADER_SIZE];
+
+  headerEncode (h, buf);
+  return pwrite (fd, buf, sizeof (buf), 0) == sizeof (buf);
+}
+
+static void entryEncode (const struct blkfile_entry *e, uint8_t *p)
+{
+  put64 (p, e->offset);
+  put16 (p + 8, e->length);
+  p [10] = e->kind;
+  memcpy (p + 11, e->reserved, sizeof (e->reserved));
+}
+
+static void entryDecode (const uint8_t *p, struct blkfile_entry *e)
+{
+  e->offset = get64 (p);
+  e->length = get16 (p + 8);
+  e->kind = p [10];
+  memcpy (e->reserved, p + 11, sizeof (e->reserved));
+}
+
+static bool allBytes (const uint8_t *block, uint8_t b)
+{
+  int i;
+
+  for (i = 0; i < N; i++)
+    if (block [i] != b)
+      return false;
+  return true;
+}
+
+bool blkfileCheck (int fd)
+{
+  char magic [8];
+
+  return ((pread (fd, magic, sizeof (magic), 0) == sizeof (magic)) &&
+	  (memcmp (magic, BLKFILE_MAGIC, sizeof (magic)) == 0));
+}
+
+bool blkfileLoad (int fd, struct blkfile_header *h,
+		  struct blkfile_entry **index, uint64_t *alloc)
+{
+  uint8_t buf [BLKFILE_HEADER_SIZE];
+  uint8_t *raw;
+  size_t size;
+  uint64_t i;
+  bool ok;
+
+  if (pread (fd, buf, sizeof (buf), 0) != sizeof (buf))
+    return false;
+  headerDecode (buf, h);
+  if ((memcmp (h->magic, BLKFILE_MAGIC, sizeof (h->magic)) != 0) ||
+      (h->block_size != N))
+    return false;
+  if (! h->index_room)
+    h->index_room = h->block_count;
+  if (*alloc < h->block_count)
+    *alloc = h->block_count;
+  if (*alloc < 1)
+    *alloc = 1;
+  free (*index);
+  *index = calloc (*alloc, sizeof (struct blkfile_entry));
+  size = h->block_count * BLKFILE_ENTRY_SIZE;
+  raw = malloc (size ? size : 1);
+  ok = *index && raw && (pread (fd, raw, size, h->index_offset) == (ssize_t) size);
+  if (ok)
+    for (i = 0; i < h->block_count; i++)
+      entryDecode (raw + i * BLKFILE_ENTRY_SIZE, & (*index) [i]);
+  free (raw);
+  return ok;
+}
+
+bool blkfileCreate (int fd, struct blkfile_header *h)
+{
+  memset (h, 0, sizeof (*h));
+  memcpy (h->magic, BLKFILE_MAGIC, sizeof (h->magic));
+  h->block_size = N;
+  h->index_offset = BLKFILE_HEADER_SIZE;
+  h->data_end = BLKFILE_HEADER_SIZE;
+  return (ftruncate (fd, 0) == 0) && headerWrite (fd, h);
+}
+
+bool blkfileAppend (int fd, struct blkfile_header *h,
+		    struct blkfile_entry *e, const uint8_t *block)
+{
+  uint8_t buf [N];
+  const uint8_t *data = buf;
+
+  memset (e, 0, sizeof (*e));
+  if (allBytes (block, 0))
+    e->kind = BLKFILE_ZERO;
+  else if (allBytes (block, ' '))
+    e->kind = BLKFILE_BLANK;
+  else
+    {
+      e->length = lzCompress (block, buf);
+      e->kind = BLKFILE_LZ;
+      if (e->length >= N)
+	{
+	  e->length = N;
+	  e->kind = BLKFILE_RAW;
+	  data = block;
+	}
+      e->offset = h->data_end;
+      if (pwrite (fd, data, e->length, e->offset) != e->length)
+	return false;
+      h->data_end += e->length;
+    }
+  return true;
+}
+
+bool blkfileStore (int fd, struct blkfile_header *h,
+		   const struct blkfile_entry *index)
+{
+  size_t size = h->block_count * BLKFILE_ENTRY_SIZE;
+  uint64_t offset = h->index_offset;
+  uint64_t room = h->index_room;
+  uint8_t *raw;
+  uint64_t i;
+  bool ok;
+
+  if (h->block_count > room)
+    {
+      // a new area, after the records; a new file's index gets no
+      // more room than it needs
+      offset = h->data_end + (- h->data_end & (BLKFILE_ENTRY_SIZE - 1));
+      room = room ? 2 * h->block_count : h->block_count;
+    }
+  // the records the index will point to must be written first
+  else if (fdatasync (fd) < 0)
+    return false;
+  raw = malloc (size ? size : 1);
+  if (! raw)
+    return false;
+  for (i = 0; i < h->block_count; i++)
+    entryEncode (& index [i], raw + i * BLKFILE_ENTRY_SIZE);
+  ok = pwrite (fd, raw, size, offset) == (ssize_t) size;
+  free (raw);
+  if (! ok)
+    return false;
+  if (offset != h->index_offset)
+    {
+      h->index_offset = offset;
+      h->index_room = room;
+      h->data_end = offset + room * BLKFILE_ENTRY_SIZE;
+    }
+  if (fdatasync (fd) < 0)
+    return false;
+  // the header goes last, so that it never points to an incomplete index
+  if (! headerWrite (fd, h))
+    return false;
+  return fdatasync (fd) == 0;
+}
+
+bool blkfileDecode (const struct blkfile_entry *e, const uint8_t *data,
+		    uint8_t *block)
+{
+  switch (e->kind)
+    {
+    case BLKFILE_ZERO:
+      memset (block, 0, N);
+      return true;
+    case BLKFILE_BLANK:
+      memset (block, ' ', N);
+      return true;
+    case BLKFILE_RAW:
+      if (e->length != N)
+	return false;
+      memcpy (block, data, N);
+      return true;
+    case BLKFILE_LZ:
+      return lzDecompress (data, e->length, block);
+    default:
+      return false;
+    }
+}
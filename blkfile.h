@@ -0,0 +1,93 @@
+// Sparse, compressed block file, which blkdev reads and writes in place
+// of a raw block file, and which blkconv converts to and from the raw
+// format.
+//
+// The file starts with a BLKFILE_HEADER_SIZE byte header, laid out as
+// struct blkfile_header without padding.  Block records follow, each
+// the data of one block, encoded as given by its index entry.  The
+// index, block_count BLKFILE_ENTRY_SIZE byte entries laid out as
+// struct blkfile_entry, is at index_offset, in an area with room for
+// index_room entries (block_count, if index_room is 0).  All values are
+// stored little-endian, whatever the host's byte order; blkfile.c
+// converts them.
+//
+// Blocks that are all zero or all blanks have no record.  Others are
+// compressed with a simple LZ77 scheme, or stored raw if that doesn't
+// save anything.  The compressed data is a sequence of tokens:
+//
+//   0lllllll  followed by l + 1 literal bytes
+//   1lllllll  followed by one byte o: copy l + 3 bytes starting
+//             o + 1 bytes back in the output (which may overlap it,
+//             so a run of one byte is a match with o = 0)
+//
+// Records are only appended: a block that is written again gets a new
+// record.  When the file is flushed the index is rewritten in place, if
+// its area has room, or else written to a new area after the records,
+// with room for twice as many entries, so that a file that grows a
+// block at a time only moves its index a logarithmic number of times.
+// The header is updated last.  Records are synced before the index is
+// rewritten, and an index area starts at a multiple of the entry size,
+// so no entry straddles a sector, and an index torn by a crash still
+// gives each block either its old record or its new one.  The space
+// taken by old records and index areas is recovered by "blkconv pack".
+
+#define BLKFILE_MAGIC "NS16BK01"
+
+#define BLKFILE_BLOCK_SIZE 128
+
+#define BLKFILE_HEADER_SIZE 40  // bytes in the file
+#define BLKFILE_ENTRY_SIZE  16
+
+enum
+{
+  BLKFILE_ZERO,   // all zero bytes, including blocks never written
+  BLKFILE_BLANK,  // all ASCII blanks
+  BLKFILE_RAW,    // BLKFILE_BLOCK_SIZE bytes
+  BLKFILE_LZ,     // compressed
+};
+
+struct blkfile_header
+{
+  char magic [8];
+  uint32_t block_size;
+  uint32_t index_room;   // entries the index area has room for
+  uint64_t block_count;
+  uint64_t index_offset;
+  uint64_t data_end;     // where the next record will be written
+};
+
+struct blkfile_entry
+{
+  uint64_t offset;       // of the record
+  uint16_t length;       // of the record
+  uint8_t kind;          // BLKFILE_...
+  uint8_t reserved [5];
+};
+
+// Is the file, open for reading, a block container?
+bool blkfileCheck (int fd);
+
+// Reads the header and index.  The index is allocated with room for at
+// least *alloc entries, and *alloc is set to its actual size.  Returns
+// false if the file isn't a valid block container.  h->index_room is
+// set to the actual room of the index area.
+bool blkfileLoad (int fd, struct blkfile_header *h,
+		  struct blkfile_entry **index, uint64_t *alloc);
+
+// Starts a new, empty container in a file open for writing.
+bool blkfileCreate (int fd, struct blkfile_header *h);
+
+// Encodes a block and appends its record, if it needs one, filling in
+// its index entry.
+bool blkfileAppend (int fd, struct blkfile_header *h,
+		    struct blkfile_entry *e, const uint8_t *block);
+
+// Writes the index, in place or after the records, then the header,
+// and syncs.
+bool blkfileStore (int fd, struct blkfile_header *h,
+		   const struct blkfile_entry *index);
+
+// Decodes a record; data is ignored for blocks that have no record.
+// Returns false if the record is corrupt.
+bool blkfileDecode (const struct blkfile_entry *e, const uint8_t *data,
+		    uint8_t *block);
@@ -0,0 +1,248 @@
+// Decode a binary instruction trace written by "psim --btrace" into the
+// text format of "psim -i" and "psim -w".
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "btrace.h"
+#include "figforth.h"
+#include "pdis.h"
+
+#define WORD_MASK 0xffff
+
+#define NEXT_ADDR    0x010b  // FIG-Forth NEXT, where -w traces words
+
+FILE *in_f;
+FILE *trace_f;
+
+bool inst_trace = false;
+bool word_trace = false;
+
+uint16_t mem [65536];
+uint16_t inst [65536];
+uint16_t ac [4];
+uint16_t pc;
+uint16_t fr;
+uint16_t write_addr;
+
+bool cy, lk;
+
+int getByte (void)
+{
+  int c = getc_unlocked (in_f);
+  if (c == EOF)
+    {
+      fprintf (stderr, "truncated trace\n");
+      exit (2);
+    }
+  return c;
+}
+
+uint16_t getWord (void)
+{
+  int lo = getByte ();
+  return lo | (getByte () << 8);
+}
+
+uint32_t getVarint (void)
+{
+  uint32_t v = 0;
+  int shift = 0;
+  int c;
+
+  do
+    {
+      c = getByte ();
+      v |= (uint32_t) (c & 0x7f) << shift;
+      shift += 7;
+    }
+  while (c & 0x80);
+  return v;
+}
+
+void printStack (void)
+{
+  int a;
+
+  if ((ac [3] < (FORTH_S0 - FORTH_STACK_DEPTH)) || (ac [3] > FORTH_S0))
+    return;
+  fprintf (trace_f, "stack: ");
+  if (ac [3] >= FORTH_S0)
+    {
+      fprintf (trace_f, "empty ");
+      return;
+    }
+  for (a = FORTH_S0 - 1; a >= ac [3]; a--)
+    {
+      fprintf (trace_f, "%04x ", mem [a]);
+    }
+}
+
+void printWordName (int addr)
+{
+  int c;
+  int b = 1;
+  addr -= 2;  // back up past PFA to last word of name
+  if ((mem [addr] & 0x8080) == 0x8080)
+    {
+      // short word, we're done
+    }
+  else
+    {
+      // long word, find start of name
+      do
+	{
+	  addr --;
+	}
+      while ((mem [addr] & 0x8000) == 0);
+    }
+  for (;;)
+    {
+      c = mem [addr];
+      if (b == 0)
+	c >>= 8;
+      fprintf (trace_f, "%c", c & 0x7f);
+      if ((c & 0x80) != 0)
+	break;
+      b++;
+      if (b == 2)
+	{
+	  addr++;
+	  b = 0;
+	}
+    }
+}
+
+void hostWrite (void)
+{
+  uint32_t addr = getVarint ();
+  uint32_t count = getVarint ();
+
+  while (count--)
+    mem [addr++ & WORD_MASK] = getWord ();
+}
+
+void memWrite (void)
+{
+  write_addr = (write_addr + btUnzigzag (getVarint ())) & WORD_MASK;
+  mem [write_addr] = getWord ();
+}
+
+void instruction (int tag)
+{
+  int i;
+  int mask;
+  char buf [80];
+
+  if (tag & BT_PC)
+    pc = (pc + 1 + btUnzigzag (getVarint ())) & WORD_MASK;
+  else
+    pc = (pc + 1) & WORD_MASK;
+  if (tag & BT_INST)
+    inst [pc] = getWord ();
+  if (tag & BT_REGS)
+    {
+      mask = getByte ();
+      for (i = 0; i < 4; i++)
+	if (mask & (BT_REG_AC0 << i))
+	  ac [i] = getWord ();
+      if (mask & BT_REG_FR)
+	{
+	  fr = getWord ();
+	  cy = (fr & 0x0080) != 0;
+	  lk = (fr & 0x0100) != 0;
+	}
+    }
+
+  if (inst_trace)
+    {
+      printStack ();
+      fprintf (trace_f, "\n");
+      for (i = 0; i < 4; i++)
+	fprintf (trace_f, "AC%d=%04x ", i, ac [i]);
+      fprintf (trace_f, "%s %s ",
+	       cy ? "cy" : "  ",
+	       lk ? "link" : "    ");
+      disassembleInstruction (pc, inst [pc], ac, false, buf);
+      fprintf (trace_f, "PC=%04x, instruction=%04x: %s\n", pc, inst [pc], buf);
+    }
+  if ((word_trace) && (pc == NEXT_ADDR))
+    {
+      if (! inst_trace)
+	printStack ();
+      fprintf (trace_f,"\n");
+      fprintf (trace_f,"executing word at %04x: %04x ", ac [2], mem [ac [2]]);
+      printWordName (mem [ac [2]]);
+      fprintf (trace_f,"\n");
+    }
+
+  // the memory write happens after the state shown above
+  if (tag & BT_MEMW)
+    memWrite ();
+}
+
+void usage (FILE *f)
+{
+  fprintf (f, "usage: btdecode [-i] [-w] tracefile\n");
+}
+
+int main (int argc, char *argv [])
+{
+  char *fn = NULL;
+  char magic [sizeof (BTRACE_MAGIC)];
+  int tag;
+
+  while (--argc)
+    {
+      argv++;
+      if (strcmp (argv [0], "-w") == 0)
+	word_trace = true;
+      else if (strcmp (argv [0], "-i") == 0)
+	inst_trace = true;
+      else if ((argv [0] [0] == '-') || fn)
+	{
+	  usage (stderr);
+	  exit (1);
+	}
+      else
+	fn = argv [0];
+    }
+  if (! fn)
+    {
+      usage (stderr);
+      exit (1);
+    }
+  if (! (inst_trace || word_trace))
+    inst_trace = true;
+
+  in_f = fopen (fn, "rb");
+  if (! in_f)
+    {
+      fprintf (stderr, "can't open trace file '%s'\n", fn);
+      exit (2);
+    }
+  setvbuf (in_f, NULL, _IOFBF, 1 << 20);
+  trace_f = stdout;
+  setvbuf (trace_f, NULL, _IOFBF, 1 << 20);
+
+  if ((fread (magic, 1, strlen (BTRACE_MAGIC), in_f) != strlen (BTRACE_MAGIC)) ||
+      (memcmp (magic, BTRACE_MAGIC, strlen (BTRACE_MAGIC)) != 0))
+    {
+      fprintf (stderr, "'%s' is not a binary trace file\n", fn);
+      exit (2);
+    }
+
+  while ((tag = getc_unlocked (in_f)) != EOF)
+    {
+      if (tag == BT_HOSTW)
+	hostWrite ();
+      else if (tag == BT_WRITE)
+	memWrite ();
+      else
+	instruction (tag);
+    }
+  exit (0);
+}
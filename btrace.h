@@ -0,0 +1,73 @@
+// Binary instruction trace format, written by "psim --btrace" and
+// decoded by btdecode.
+//
+// The file starts with the eight byte magic string BTRACE_MAGIC.  Each
+// instruction record describes the machine state at the time the
+// instruction was fetched, as the text trace does, encoded as deltas
+// against the previous record:
+//
+//   tag byte
+//   BT_PC:    signed varint, pc minus (previous record's pc + 1)
+//   BT_INST:  16-bit instruction, if it differs from the last one
+//             recorded at this pc
+//   BT_REGS:  change mask byte (BT_REG_AC0..3, BT_REG_FR), then the
+//             new 16-bit value of each changed register
+//   BT_MEMW:  signed varint, address written minus previous address
+//             written, then the 16-bit value written
+//
+// A record with the BT_HOSTW tag describes memory written by the host
+// rather than by an instruction (e.g., block I/O), and contains an
+// unsigned varint address, an unsigned varint word count, and that many
+// 16-bit values.
+//
+// A record with the BT_WRITE tag describes memory written by an
+// instruction that was not recorded, because a trace filter or trigger
+// excluded it, and contains the address and value as for BT_MEMW.  With
+// these and BT_HOSTW, the decoder's copy of memory always matches the
+// simulator's, whatever was traced.
+//
+// All 16-bit values are little-endian.  Varints are LEB128, with
+// signed values zigzag encoded.
+
+#define BTRACE_MAGIC "NS16BT01"
+
+#define BT_PC    0x01
+#define BT_INST  0x02
+#define BT_REGS  0x04
+#define BT_MEMW  0x08
+#define BT_HOSTW 0x10
+#define BT_WRITE 0x20
+
+#define BT_REG_AC0 0x01  // AC1..AC3 are the following bits
+#define BT_REG_FR  0x10
+
+// largest possible instruction record
+#define BT_MAX_RECORD (1 + 3 + 2 + 1 + 5 * 2 + 3 + 2)
+
+static inline uint8_t *btPutVarint (uint8_t *p, uint32_t v)
+{
+  while (v >= 0x80)
+    {
+      *p++ = (v & 0x7f) | 0x80;
+      v >>= 7;
+    }
+  *p++ = v;
+  return p;
+}
+
+static inline uint8_t *btPutSigned (uint8_t *p, int32_t v)
+{
+  return btPutVarint (p, ((uint32_t) v << 1) ^ (uint32_t) (v >> 31));
+}
+
+static inline uint8_t *btPutWord (uint8_t *p, uint16_t v)
+{
+  *p++ = v & 0xff;
+  *p++ = v >> 8;
+  return p;
+}
+
+static inline int32_t btUnzigzag (uint32_t v)
+{
+  return (int32_t) (v >> 1) ^ -(int32_t) (v & 1);
+}
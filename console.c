@@ -0,0 +1,305 @@
+// Console I/O threads, see console.h
+//
+// Each ring has one producer and one consumer, and is lock free while
+// it is neither full nor empty.  A side that finds it can't proceed
+// registers itself in sleepers and waits on the ring's condition
+// variable; the other side, after moving head or tail, only takes the
+// mutex to wake it if sleepers is nonzero.  Both the registration and
+// the head or tail update are sequentially consistent, so either the
+// sleeper sees the update when it checks again under the mutex, or the
+// other side sees the sleeper and wakes it.
+//
+// Signal handlers can't signal a condition variable, so the simulator
+// side waits with a timeout, and gives up once *stop is set.
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "console.h"
+
+#define RING_MASK (CONSOLE_RING_SIZE - 1)
+
+#define STOP_POLL_NS 50000000  // how often a waiting simulator checks *stop
+
+struct ring
+{
+  _Alignas (64) _Atomic uint32_t head;  // advanced by the producer
+  _Alignas (64) _Atomic uint32_t tail;  // advanced by the consumer
+  _Alignas (64) _Atomic int sleepers;
+  _Atomic bool closed;                  // no more data will be produced
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  uint8_t buf [CONSOLE_RING_SIZE];
+};
+
+static struct ring in_ring;
+static struct ring out_ring;
+static pthread_t in_thread;
+static pthread_t out_thread;
+static bool started = false;
+static bool sync_out;
+static volatile sig_atomic_t *stop_flag;
+
+static void ringInit (struct ring *r)
+{
+  atomic_init (& r->head, 0);
+  atomic_init (& r->tail, 0);
+  atomic_init (& r->sleepers, 0);
+  atomic_init (& r->closed, false);
+  pthread_condattr_t attr;
+
+  pthread_mutex_init (& r->mutex, NULL);
+  pthread_condattr_init (& attr);
+  pthread_condattr_setclock (& attr, CLOCK_MONOTONIC);
+  pthread_cond_init (& r->cond, & attr);
+  pthread_condattr_destroy (& attr);
+}
+
+static inline uint32_t ringUsed (struct ring *r)
+{
+  return atomic_load (& r->head) - atomic_load (& r->tail);
+}
+
+static void ringWake (struct ring *r)
+{
+  if (atomic_load (& r->sleepers))
+    {
+      pthread_mutex_lock (& r->mutex);
+      pthread_cond_broadcast (& r->cond);
+      pthread_mutex_unlock (& r->mutex);
+    }
+}
+
+// Waits until the ring has at least one byte (want_data) or one free
+// byte (! want_data), or is closed, or, for the simulator side
+// (stoppable), until *stop_flag is set.
+static void ringWait (struct ring *r, bool want_data, bool stoppable)
+{
+  struct timespec ts;
+
+  atomic_fetch_add (& r->sleepers, 1);
+  pthread_mutex_lock (& r->mutex);
+  while (! atomic_load (& r->closed) &&
+	 ! (stoppable && *stop_flag) &&
+	 (want_data ? (ringUsed (r) == 0) : (ringUsed (r) == CONSOLE_RING_SIZE)))
+    {
+      if (! stoppable)
+	{
+	  pthread_cond_wait (& r->cond, & r->mutex);
+	  continue;
+	}
+      clock_gettime (CLOCK_MONOTONIC, & ts);
+      ts.tv_nsec += STOP_POLL_NS;
+      if (ts.tv_nsec >= 1000000000)
+	{
+	  ts.tv_sec++;
+	  ts.tv_nsec -= 1000000000;
+	}
+      pthread_cond_timedwait (& r->cond, & r->mutex, & ts);
+    }
+  pthread_mutex_unlock (& r->mutex);
+  atomic_fetch_sub (& r->sleepers, 1);
+}
+
+static void ringClose (struct ring *r)
+{
+  atomic_store (& r->closed, true);
+  pthread_mutex_lock (& r->mutex);
+  pthread_cond_broadcast (& r->cond);
+  pthread_mutex_unlock (& r->mutex);
+}
+
+static void *inputThread (void *arg)
+{
+  struct ring *r = & in_ring;
+  uint8_t buf [4096];
+  uint32_t head;
+  uint32_t space;
+  ssize_t n;
+  ssize_t i;
+
+  (void) arg;
+  for (;;)
+    {
+      while ((space = CONSOLE_RING_SIZE - ringUsed (r)) == 0)
+	ringWait (r, false, false);
+      n = read (STDIN_FILENO, buf, (space < sizeof (buf)) ? space : sizeof (buf));
+      if ((n < 0) && (errno == EINTR))
+	continue;
+      if (n <= 0)
+	break;
+      head = atomic_load_explicit (& r->head, memory_order_relaxed);
+      for (i = 0; i < n; i++)
+	r->buf [(head + i) & RING_MASK] = buf [i];
+      atomic_store (& r->head, head + n);
+      ringWake (r);
+    }
+  ringClose (r);  // end of file
+  return NULL;
+}
+
+static void *outputThread (void *arg)
+{
+  struct ring *r = & out_ring;
+  uint32_t tail;
+  uint32_t used;
+  uint32_t n;
+  ssize_t w;
+
+  (void) arg;
+  for (;;)
+    {
+      used = ringUsed (r);
+      if (! used)
+	{
+	  if (atomic_load (& r->closed))
+	    break;
+	  ringWait (r, true, false);
+	  continue;
+	}
+      // write everything available, up to the end of the buffer
+      tail = atomic_load_explicit (& r->tail, memory_order_relaxed);
+      n = CONSOLE_RING_SIZE - (tail & RING_MASK);
+      if (n > used)
+	n = used;
+      w = write (STDOUT_FILENO, & r->buf [tail & RING_MASK], n);
+      if ((w < 0) && (errno == EINTR))
+	continue;
+      if (w <= 0)
+	w = n;  // output is gone, discard it rather than stall the guest
+      atomic_store (& r->tail, tail + w);
+      ringWake (r);
+    }
+  return NULL;
+}
+
+void consoleStart (bool sync_output, volatile sig_atomic_t *stop)
+{
+  sigset_t all, old;
+
+  ringInit (& in_ring);
+  ringInit (& out_ring);
+  sync_out = sync_output;
+  stop_flag = stop;
+  // signals are handled by the simulator thread
+  sigfillset (& all);
+  pthread_sigmask (SIG_BLOCK, & all, & old);
+  if (pthread_create (& in_thread, NULL, inputThread, NULL) ||
+      pthread_create (& out_thread, NULL, outputThread, NULL))
+    {
+      fprintf (stderr, "can't start console threads\n");
+      exit (2);
+    }
+  pthread_sigmask (SIG_SETMASK, & old, NULL);
+  started = true;
+}
+
+void consoleStop (void)
+{
+  if (! started)
+    return;
+  started = false;
+  ringClose (& out_ring);
+  pthread_join (out_thread, NULL);
+  // the input thread is usually blocked in read
+  pthread_cancel (in_thread);
+  pthread_join (in_thread, NULL);
+  fflush (stdout);
+}
+
+bool consoleAvail (void)
+{
+  return ringUsed (& in_ring) != 0;
+}
+
+int consoleGet (void)
+{
+  struct ring *r = & in_ring;
+  uint32_t tail;
+  int c;
+
+  while (ringUsed (r) == 0)
+    {
+      if (atomic_load (& r->closed))
+	{
+	  if (ringUsed (r) == 0)
+	    return -1;
+	  break;
+	}
+      if (*stop_flag)
+	return -1;
+      ringWait (r, true, true);
+    }
+  tail = atomic_load_explicit (& r->tail, memory_order_relaxed);
+  c = r->buf [tail & RING_MASK];
+  atomic_store (& r->tail, tail + 1);
+  ringWake (r);
+  return c;
+}
+
+void consolePut (int c)
+{
+  struct ring *r = & out_ring;
+  uint32_t head;
+
+  if (sync_out)
+    {
+      fputc (c, stdout);
+      return;
+    }
+  while (ringUsed (r) == CONSOLE_RING_SIZE)
+    {
+      if (*stop_flag)
+	return;  // stopping, and the output is stuck
+      ringWait (r, false, true);
+    }
+  head = atomic_load_explicit (& r->head, memory_order_relaxed);
+  r->buf [head & RING_MASK] = c;
+  atomic_store (& r->head, head + 1);
+  ringWake (r);
+}
+
+// Pushes a whole buffer, waking the output thread at most once per
+// piece that fits in the ring.
+void consoleWrite (const uint8_t *buf, int count)
+{
+  struct ring *r = & out_ring;
+  uint32_t head;
+  uint32_t n;
+  uint32_t space;
+
+  if (sync_out)
+    {
+      fwrite (buf, 1, count, stdout);
+      return;
+    }
+  while (count > 0)
+    {
+      while ((space = CONSOLE_RING_SIZE - ringUsed (r)) == 0)
+	{
+	  if (*stop_flag)
+	    return;  // stopping, and the output is stuck
+	  ringWait (r, false, true);
+	}
+      head = atomic_load_explicit (& r->head, memory_order_relaxed);
+      n = CONSOLE_RING_SIZE - (head & RING_MASK);  // up to the end of buf
+      if (n > space)
+	n = space;
+      if (n > (uint32_t) count)
+	n = count;
+      memcpy (& r->buf [head & RING_MASK], buf, n);
+      atomic_store (& r->head, head + n);
+      ringWake (r);
+      buf += n;
+      count -= n;
+    }
+}
@@ -0,0 +1,23 @@
+// Console I/O for psim and isim, done by host threads that exchange
+// characters with the simulator through lock-free single-producer,
+// single-consumer rings.  The simulator only blocks when it needs input
+// that hasn't arrived, or when the output ring is full, and then only
+// until *stop, the simulator's halt flag, is set by a signal handler.
+
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define CONSOLE_RING_SIZE 65536  // power of two
+
+// If sync_output is true, output is written to stdout as it is
+// produced, so that it stays in order with traces written there.
+void consoleStart (bool sync_output, volatile sig_atomic_t *stop);
+
+// Writes any output still in the ring, and stops the threads.
+void consoleStop (void);
+
+bool consoleAvail (void);  // is input waiting?
+int consoleGet (void);     // returns the next input byte, or -1 at EOF or stop
+void consolePut (int c);
+void consoleWrite (const uint8_t *buf, int count);
@@ -0,0 +1,12 @@
+// Memory layout of the FIG-Forth images, figforth_pace.asm and
+// figforth_imp16.asm, for the simulators' stack traces and heatmap.
+// These must be kept in step with the MEMORY ASSIGNMENTS of the images.
+
+#define FORTH_DICT    0x0100  // first word of the dictionary
+#define FORTH_S0      0x1d87  // top of the empty data stack, and the TIB
+#define FORTH_UVARS   0x1dc8  // user area, above the return stack
+#define FORTH_BUFFS   0x1de8  // block buffers
+#define FORTH_TOPMEM  0x2000  // last word of the block buffers + 1
+
+// the data stack as far as printStack examines it
+#define FORTH_STACK_DEPTH 100
@@ -57,7 +57,7 @@ SEL	=	2
 BLKSIZ	=	128		; BLOCK SIZE IN BYTES
 NBUF	=	8		; NO OF BLOCK BUFFERS
 TOPMEM	=	02000		; LWA+1 OF DISK BUFFS
-BUFMEM	=	BLKSIZ/2+2*NBUF	; LTH OF BUFFER AREA
+BUFMEM	=	BLKSIZ/2+3*NBUF	; LTH OF BUFFER AREA
 BUFFS	=	TOPMEM-BUFMEM	; FWA OF DISK BUFFERS
 UVARS	=	BUFFS-32	; START OF USER AREA
 DICT	=	0100		; FWA OF DICTIONARY
@@ -104,6 +104,9 @@ SP	=	Y		; FORTH STACK PTR
 GETC	=	07E3B
 PUTC	=	07E59
 INTEST	=	07EDF
+LINEIN	=	07EFC
+TYPOUT	=	07EFD
+PERFCTR	=	07EFE
 BLOCKIO	=	07EFF
 ;
 INIT:	LI	0,0		; clear flags
@@ -902,10 +905,13 @@ OUT:	.WORD	DOUSER,0D
 	HEAD	ORD,3,LONG,'S'/256
 	.WORD	'CR'+ODD,OUT-3
 SCR:	.WORD	DOUSER,0E
+;
+;   OFFSET IS A DOUBLE, LOW WORD FIRST, SO THAT  OFFSET @
+;   STILL GIVES THE LOW WORD.  THE HIGH BYTE IS THE DRIVE.
 ;
 	HEAD	ORD,6,LONG,'O'/256
 	.WORD	'FF','SE','T'+EVEN,SCR-3
-OFFSET:	.WORD	DOUSER,0F
+OFFSET:	.WORD	DOUSER,019
 ;
 	HEAD	ORD,7,LONG,'C'/256
 	.WORD	'ON','TE','XT'+ODD,OFFSET-5
@@ -1174,16 +1180,17 @@ DODOES:	DSZ	RP		; EXTEND RETURN STACK
 	HEAD	ORD,5,LONG,'C'/256
 	.WORD	'OU','NT'+ODD,DOES-4
 COUNT:	.WORD	DOCOL,BYTE,DUP,ONEP,SWAP,CAT,SEMIS
+;
+;   TYPE  ( ADDR COUNT -- )  THE SIMULATOR WRITES THE STRING
+;         AT ONCE, AS  : TYPE  -DUP  IF  OVER  +  SWAP
+;         DO  I  C@  EMIT  LOOP  ELSE  DROP  ENDIF  ;  WOULD
 ;
 	HEAD	ORD,4,LONG,'T'/256
 	.WORD	'YP','E'+EVEN,COUNT-4
-TYPE:	.WORD	DOCOL,DDUP,ZBRAN
-	.WORD	TYPE2-.,OVER,PLUS,SWAP,XDO
-TYPE1:	.WORD	I,CAT,EMIT,XLOOP
-	.WORD	TYPE1-.,BRAN
-	.WORD	TYPE3-.
-TYPE2:	.WORD	DROP
-TYPE3:	.WORD	SEMIS
+TYPE:	.WORD	.+1
+	JSR	@TYPEA
+	JMP	POP2
+TYPEA:	.WORD	TYPOUT
 ;
 	HEAD	ORD,9,LONG,'-'/256
 	.WORD	'TR','AI','LI','NG'+ODD,TYPE-4
@@ -1234,18 +1241,11 @@ DOTQ2:	     .WORD	SEMIS
 ;
 	HEAD	ORD,6,LONG,'E'/256
 	.WORD	'XP','EC','T'+EVEN,DOTQ-3
-EXPECT:	.WORD	DOCOL,OVER,PLUS,OVER,XDO
-EXPEC1:	.WORD	KEY,DUP,LIT,07,PORIG,AT,EQUAL,ZBRAN
-	.WORD	EXPEC2-.,DROP,LIT,08,OVER,I,EQUAL
-	.WORD	DUP,FROMR,TWO,SUB,PLUS,TOR,SUB,BRAN
-	.WORD	EXPEC5-.
-EXPEC2:	.WORD	DUP,LIT,0D,EQUAL,ZBRAN
-	.WORD	EXPEC3-.,LEAVE,DROP,BL,ZERO,BRAN
-	.WORD	EXPEC4-.
-EXPEC3:	.WORD	DUP
-EXPEC4:	.WORD	I,CSTORE,ZERO,I,ONEP,CSTORE
-EXPEC5:	.WORD	EMIT,XLOOP
-	.WORD	EXPEC1-.,DROP,SEMIS
+EXPECT:	.WORD	.+1		; THE SIMULATOR READS THE LINE
+	LD	0,BACKSP
+	JSR	@EXPA
+	JMP	POP2
+EXPA:	.WORD	LINEIN
 ;
 ;   : QUERY   TIB  @  BYTE  50  EXPECT  0  IN  !  ;
 ;
@@ -1687,7 +1687,7 @@ PREV:	.WORD	DOVAR,BUFFS
 ;
 	HEAD	ORD,4,LONG,'+'/256
 	.WORD	'BU','F'+EVEN,PREV-4
-PBUF:	.WORD	DOCOL,LIT,BLKSIZ/2+2,PLUS
+PBUF:	.WORD	DOCOL,LIT,BLKSIZ/2+3,PLUS
 	.WORD	DUP,LIMIT,EQUAL,ZBRAN
 	.WORD	PBUF1-.,DROP,FIRST
 PBUF1:	.WORD	DUP,PREV,AT,SUB,SEMIS
@@ -1702,24 +1702,54 @@ UPDATE:	.WORD	DOCOL,PREV,AT,AT,LIT,08000
 	.WORD	'FE','RS'+ODD,UPDATE-5
 MTBUF:	.WORD	DOCOL,FIRST,LIMIT
 	.WORD	OVER,SUB,ERASE,SEMIS
+;
+;   : FLUSH   LIMIT  FIRST  DO  I  @  0<
+;       IF  I  2+  I  1+  @  I  @  7FFF  AND  DUP  I  !  0  R/W
+;       ENDIF  BLKSIZ/2+3  +LOOP  0  0  0  2  R/W  ;
+;
+;   WRITES BACK THE UPDATED BUFFERS, THEN HAS THE HOST
+;   SYNC THE BLOCK FILES (R/W FLAG 2)
+;
+	HEAD	ORD,5,LONG,'F'/256
+	.WORD	'LU','SH'+ODD,MTBUF-8
+FLUSH:	.WORD	DOCOL,LIMIT,FIRST,XDO
+FLUS1:	.WORD	I,AT,ZLESS,ZBRAN
+	.WORD	FLUS2-.,I,TWOP,I,ONEP,AT,I,AT
+	.WORD	LIT,07FFF,AND,DUP,I,STORE,ZERO,RW
+FLUS2:	.WORD	LIT,BLKSIZ/2+3,XPLOOP
+	.WORD	FLUS1-.,ZERO,ZERO,ZERO,TWO,RW,SEMIS
+;
+;   : DRIVE   0  OFFSET  !  256  *  OFFSET  1+  !  ;
+;
+;   SELECTS DRIVE UNIT N, WHICH THE HOST MAPS TO ITS
+;   OWN BLOCK FILE.  BLOCK NUMBERS ARE 32 BITS, WITH
+;   THE DRIVE IN THE HIGH BYTE.
+;
+	HEAD	ORD,5,LONG,'D'/256
+	.WORD	'RI','VE'+ODD,FLUSH-4
+DRIVE:	.WORD	DOCOL,ZERO,OFFSET,STORE,LIT,256,STAR
+	.WORD	OFFSET,ONEP,STORE,SEMIS
 ;
 	HEAD	ORD,3,LONG,'D'/256
-	.WORD	'R1'+ODD,MTBUF-8
-DRONE:	.WORD	DOCOL,ZERO,OFFSET,STORE,SEMIS
+	.WORD	'R1'+ODD,DRIVE-4
+DRONE:	.WORD	DOCOL,ZERO,DRIVE,SEMIS
 ;
 	HEAD	ORD,3,LONG,'D'/256
 	.WORD	'R2'+ODD,DRONE-3
-DRTWO:	.WORD	DOCOL,LIT,2000
-	.WORD	OFFSET,STORE,SEMIS
+DRTWO:	.WORD	DOCOL,ONE,DRIVE,SEMIS
 ;
 ;***************************************************
 ;*                     BUFFER                      *
 ;***************************************************
 ;
 ;   : BUFFER   USE  @  DUP  >R  BEGIN  +BUF  UNTIL
-;       USE  !  R  @  0<  IF  R  1+  R  @  7FFF
-;                             AND  0  R/W  ENDIF
-;       R  !  R  PREV  !  R>  1+  ;
+;       USE  !  R  @  0<  IF  R  2+  R  1+  @  R  @
+;                             7FFF  AND  0  R/W  ENDIF
+;       R  !  R  1+  !  R  PREV  !  R>  2+  ;
+;
+;   ( LO HI -- ADDR )  A BUFFER STARTS WITH THE HIGH
+;   WORD OF ITS BLOCK NUMBER, WITH THE UPDATE FLAG,
+;   THEN THE LOW WORD
 ;
 	HEAD	ORD,6,LONG,'B'/256
 	.WORD	'UF','FE','R'+EVEN,DRTWO-3
@@ -1727,36 +1757,39 @@ BUFFER:	.WORD	DOCOL,USE,AT,DUP,TOR
 BUFF1:	.WORD	PBUF,ZBRAN
 	.WORD	BUFF1-.,USE,STORE
 	.WORD	R,AT,ZLESS,ZBRAN
-	.WORD	BUFF2-.,R,ONEP,R,AT
+	.WORD	BUFF2-.,R,TWOP,R,ONEP,AT,R,AT
 	.WORD	LIT,07FFF,AND,ZERO,RW
-BUFF2:	.WORD	R,STORE,R,PREV,STORE
-	.WORD	FROMR,ONEP,SEMIS
+BUFF2:	.WORD	R,STORE,R,ONEP,STORE,R,PREV,STORE
+	.WORD	FROMR,TWOP,SEMIS
 ;
 ;***************************************************
 ;*                      BLOCK                      *
 ;***************************************************
 ;
-;   : BLOCK   OFFSET  @  +  >R
-;       PREV  @  DUP  @  R  -  DUP  +
+;   : BLOCK   0  OFFSET  @  OFFSET  1+  @  D+  SWAP  >R
+;       PREV  @  OVER  OVER  @  -  DUP  +
+;       OVER  1+  @  R  -  OR
 ;       IF  BEGIN  +BUF  0=
-;           IF  DROP  R  BUFFER
-;           DUP  R  1  R/W  1  -  ENDIF
-;           DUP  @  R  -  DUP  +  0=  UNTIL
-;       DUP  PREV  !  ENDIF  R>  DROP  1+  ;
+;           IF  DROP  R  OVER  BUFFER
+;           DUP  R  OVER  2  -  @  1  R/W  2  -  ENDIF
+;           OVER  OVER  @  -  DUP  +
+;           OVER  1+  @  R  -  OR  0=  UNTIL
+;       DUP  PREV  !  ENDIF  R>  DROP  SWAP  DROP  2+  ;
 ;
 	HEAD	ORD,5,LONG,'B'/256
 	.WORD	'LO','CK'+ODD,BUFFER-5
-BLOCK:	.WORD	DOCOL,OFFSET,AT,PLUS,TOR
-	.WORD	PREV,AT,DUP,AT,R
-	.WORD	SUB,DUP,PLUS,ZBRAN
+BLOCK:	.WORD	DOCOL,ZERO,OFFSET,AT,OFFSET,ONEP,AT
+	.WORD	DPLUS,SWAP,TOR
+	.WORD	PREV,AT,OVER,OVER,AT,SUB,DUP,PLUS
+	.WORD	OVER,ONEP,AT,R,SUB,OR,ZBRAN
 	.WORD	BLOCK3-.
 BLOCK1:	.WORD	PBUF,ZEQU,ZBRAN
-	.WORD	BLOCK2-.,DROP,R,BUFFER
-	.WORD	DUP,R,ONE,RW,ONE,SUB
-BLOCK2:	.WORD	DUP,AT,R,SUB,DUP
-	.WORD	PLUS,ZEQU,ZBRAN
+	.WORD	BLOCK2-.,DROP,R,OVER,BUFFER
+	.WORD	DUP,R,OVER,TWO,SUB,AT,ONE,RW,TWO,SUB
+BLOCK2:	.WORD	OVER,OVER,AT,SUB,DUP,PLUS
+	.WORD	OVER,ONEP,AT,R,SUB,OR,ZEQU,ZBRAN
 	.WORD	BLOCK1-.,DUP,PREV,STORE
-BLOCK3:	.WORD	FROMR,DROP,ONEP,SEMIS
+BLOCK3:	.WORD	FROMR,DROP,SWAP,DROP,TWOP,SEMIS
 ;
 ;***************************************************
 ;*              TEXT OUTPUT FORMATTING             *
@@ -1830,20 +1863,56 @@ PCR:	LI	0,0D
 ;***************************************************
 ;*                     DISK I/O                    *
 ;***************************************************
+;
+;   R/W  ( ADDR LO HI F -- )  READS (F=1) OR WRITES (F=0)
+;        THE 32-BIT BLOCK HI:LO AT ADDR.  THE HIGH BYTE OF
+;        HI SELECTS THE DRIVE.  F=2 SYNCS ALL DRIVES.
 ;
 	HEAD	ORD,3,LONG,'R'/256
 	.WORD	'/W'+ODD,ARROW-3
 RW:	.WORD	.+1
 	JSR	BLOCKIO
-	AISZ	SP,1
+	AISZ	SP,2
 	JMP	POP2
 ;
 ;***************************************************
+;*          PERFORMANCE COUNTERS (SIMULATOR)       *
+;***************************************************
+;
+;   PERF  ( N -- D )  READ SIMULATOR COUNTER N:
+;         0 INSTRUCTIONS, 1 CYCLES, 2 HOST NANOSECONDS,
+;         3 RESET, 4 SNAPSHOT, 16+N SNAPSHOT OF N
+;
+	HEAD	ORD,4,LONG,'P'/256
+	.WORD	'ER','F'+EVEN,RW-3
+PERF:	.WORD	.+1
+	PUSH	IP		; SAVE IP
+	LD	0,0(SP)		; FUNCTION CODE
+	JSR	@PERFA		; RETURNS AC0 LO, AC1 HI
+	ST	0,0(SP)		; LO-ORDER SECOND
+	RCPY	1,0
+	PULL	IP		; RESTORE IP
+	JMP	PUSH		; HI-ORDER ON TOP
+PERFA:	.WORD	PERFCTR		; (BASE PAGE POINTERS ARE FULL)
+;
+;   : TICKS   0  PERF  ;
+;
+	HEAD	ORD,5,LONG,'T'/256
+	.WORD	'IC','KS'+ODD,PERF-4
+TICKS:	.WORD	DOCOL,ZERO,PERF,SEMIS
+;
+;   : ELAPSED   DMINUS  TICKS  D+  ;
+;
+	HEAD	ORD,7,LONG,'E'/256
+	.WORD	'LA','PS','ED'+ODD,TICKS-4
+ELAPS:	.WORD	DOCOL,DMINUS,TICKS,DPLUS,SEMIS
+;
+;***************************************************
 ;*                    ', FORGET                    *
 ;***************************************************
 ;
 	HEAD	IMM,1,SHORT,''''/256
-	.WORD	RW-3
+	.WORD	ELAPS-5
 TICK:	.WORD	DOCOL,DFIND,ZEQU,ZERO
 	.WORD	QERROR,DROP,LITER,SEMIS
 ;
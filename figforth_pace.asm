@@ -41,7 +41,7 @@ M	=      11
 BLKSIZ	=	128		; BLOCK SIZE IN BYTES
 NBUF	=	8		; NO OF BLOCK BUFFERS
 TOPMEM	=	02000		; LWA+1 OF DISK BUFFS
-BUFMEM	=	BLKSIZ/2+2*NBUF	; LTH OF BUFFER AREA
+BUFMEM	=	BLKSIZ/2+3*NBUF	; LTH OF BUFFER AREA
 BUFFS	=	TOPMEM-BUFMEM	; FWA OF DISK BUFFERS
 UVARS	=	BUFFS-32	; START OF USER AREA
 DICT	=	0100		; FWA OF DICTIONARY
@@ -88,7 +88,12 @@ SP	=	Y		; FORTH STACK PTR
 GETC	=	07E3B
 PUTC	=	07E44
 INTEST	=	07ECC
+INCLUD	=	07EFB
+LINEIN	=	07EFC
+TYPOUT	=	07EFD
+PERFCTR	=	07EFE
 BLOCKIO	=	07EFF
+BLKDMA	=	07EFA
 ;
 INIT:	LI	0,0
 	CRF	0
@@ -905,10 +910,13 @@ OUT:	.WORD	DOUSER,0D
 	HEAD	ORD,3,LONG,'S'/256
 	.WORD	'CR'+ODD,OUT-3
 SCR:	.WORD	DOUSER,0E
+;
+;   OFFSET IS A DOUBLE, LOW WORD FIRST, SO THAT  OFFSET @
+;   STILL GIVES THE LOW WORD.  THE HIGH BYTE IS THE DRIVE.
 ;
 	HEAD	ORD,6,LONG,'O'/256
 	.WORD	'FF','SE','T'+EVEN,SCR-3
-OFFSET:	.WORD	DOUSER,0F
+OFFSET:	.WORD	DOUSER,019
 ;
 	HEAD	ORD,7,LONG,'C'/256
 	.WORD	'ON','TE','XT'+ODD,OFFSET-5
@@ -1178,16 +1186,17 @@ DODOES:	DSZ	RP		; EXTEND RETURN STACK
 	HEAD	ORD,5,LONG,'C'/256
 	.WORD	'OU','NT'+ODD,DOES-4
 COUNT:	.WORD	DOCOL,BYTE,DUP,ONEP,SWAP,CAT,SEMIS
+;
+;   TYPE  ( ADDR COUNT -- )  THE SIMULATOR WRITES THE STRING
+;         AT ONCE, AS  : TYPE  -DUP  IF  OVER  +  SWAP
+;         DO  I  C@  EMIT  LOOP  ELSE  DROP  ENDIF  ;  WOULD
 ;
 	HEAD	ORD,4,LONG,'T'/256
 	.WORD	'YP','E'+EVEN,COUNT-4
-TYPE:	.WORD	DOCOL,DDUP,ZBRAN
-	.WORD	TYPE2-.,OVER,PLUS,SWAP,XDO
-TYPE1:	.WORD	I,CAT,EMIT,XLOOP
-	.WORD	TYPE1-.,BRAN
-	.WORD	TYPE3-.
-TYPE2:	.WORD	DROP
-TYPE3:	.WORD	SEMIS
+TYPE:	.WORD	.+1
+	JSR	@TYPEA
+	JMP	POP2
+TYPEA:	.WORD	TYPOUT
 ;
 	HEAD	ORD,9,LONG,'-'/256
 	.WORD	'TR','AI','LI','NG'+ODD,TYPE-4
@@ -1238,18 +1247,11 @@ DOTQ2:	     .WORD	SEMIS
 ;
 	HEAD	ORD,6,LONG,'E'/256
 	.WORD	'XP','EC','T'+EVEN,DOTQ-3
-EXPECT:	.WORD	DOCOL,OVER,PLUS,OVER,XDO
-EXPEC1:	.WORD	KEY,DUP,LIT,07,PORIG,AT,EQUAL,ZBRAN
-	.WORD	EXPEC2-.,DROP,LIT,08,OVER,I,EQUAL
-	.WORD	DUP,FROMR,TWO,SUB,PLUS,TOR,SUB,BRAN
-	.WORD	EXPEC5-.
-EXPEC2:	.WORD	DUP,LIT,0D,EQUAL,ZBRAN
-	.WORD	EXPEC3-.,LEAVE,DROP,BL,ZERO,BRAN
-	.WORD	EXPEC4-.
-EXPEC3:	.WORD	DUP
-EXPEC4:	.WORD	I,CSTORE,ZERO,I,ONEP,CSTORE
-EXPEC5:	.WORD	EMIT,XLOOP
-	.WORD	EXPEC1-.,DROP,SEMIS
+EXPECT:	.WORD	.+1		; THE SIMULATOR READS THE LINE
+	LD	0,BACKSP
+	JSR	@EXPA
+	JMP	POP2
+EXPA:	.WORD	LINEIN
 ;
 ;   : QUERY   TIB  @  BYTE  50  EXPECT  0  IN  !  ;
 ;
@@ -1691,7 +1693,7 @@ PREV:	.WORD	DOVAR,BUFFS
 ;
 	HEAD	ORD,4,LONG,'+'/256
 	.WORD	'BU','F'+EVEN,PREV-4
-PBUF:	.WORD	DOCOL,LIT,BLKSIZ/2+2,PLUS
+PBUF:	.WORD	DOCOL,LIT,BLKSIZ/2+3,PLUS
 	.WORD	DUP,LIMIT,EQUAL,ZBRAN
 	.WORD	PBUF1-.,DROP,FIRST
 PBUF1:	.WORD	DUP,PREV,AT,SUB,SEMIS
@@ -1704,63 +1706,167 @@ UPDATE:	.WORD	DOCOL,PREV,AT,AT,LIT,08000
 	HEAD	ORD,13,LONG,'E'/256
 	.WORD	'MP','TY','-B','UF'
 	.WORD	'FE','RS'+ODD,UPDATE-5
-MTBUF:	.WORD	DOCOL,FIRST,LIMIT
+MTBUF:	.WORD	DOCOL,WAIT,FIRST,LIMIT
 	.WORD	OVER,SUB,ERASE,SEMIS
+;
+;   : FLUSH   WAIT  LIMIT  FIRST  DO  I  @  0<
+;       IF  I  2+  I  1+  @  I  @  7FFF  AND  DUP  I  !  0  R/W
+;       ENDIF  BLKSIZ/2+3  +LOOP  0  0  0  2  R/W  ;
+;
+;   WRITES BACK THE UPDATED BUFFERS, THEN HAS THE HOST
+;   SYNC THE BLOCK FILES (R/W FLAG 2)
+;
+	HEAD	ORD,5,LONG,'F'/256
+	.WORD	'LU','SH'+ODD,MTBUF-8
+FLUSH:	.WORD	DOCOL,WAIT,LIMIT,FIRST,XDO
+FLUS1:	.WORD	I,AT,ZLESS,ZBRAN
+	.WORD	FLUS2-.,I,TWOP,I,ONEP,AT,I,AT
+	.WORD	LIT,07FFF,AND,DUP,I,STORE,ZERO,RW
+FLUS2:	.WORD	LIT,BLKSIZ/2+3,XPLOOP
+	.WORD	FLUS1-.,ZERO,ZERO,ZERO,TWO,RW,SEMIS
+;
+;   : DRIVE   0  OFFSET  !  256  *  OFFSET  1+  !  ;
+;
+;   SELECTS DRIVE UNIT N, WHICH THE HOST MAPS TO ITS
+;   OWN BLOCK FILE.  BLOCK NUMBERS ARE 32 BITS, WITH
+;   THE DRIVE IN THE HIGH BYTE.
+;
+	HEAD	ORD,5,LONG,'D'/256
+	.WORD	'RI','VE'+ODD,FLUSH-4
+DRIVE:	.WORD	DOCOL,ZERO,OFFSET,STORE,LIT,256,STAR
+	.WORD	OFFSET,ONEP,STORE,SEMIS
 ;
 	HEAD	ORD,3,LONG,'D'/256
-	.WORD	'R1'+ODD,MTBUF-8
-DRONE:	.WORD	DOCOL,ZERO,OFFSET,STORE,SEMIS
+	.WORD	'R1'+ODD,DRIVE-4
+DRONE:	.WORD	DOCOL,ZERO,DRIVE,SEMIS
 ;
 	HEAD	ORD,3,LONG,'D'/256
 	.WORD	'R2'+ODD,DRONE-3
-DRTWO:	.WORD	DOCOL,LIT,2000
-	.WORD	OFFSET,STORE,SEMIS
+DRTWO:	.WORD	DOCOL,ONE,DRIVE,SEMIS
 ;
 ;***************************************************
 ;*                     BUFFER                      *
 ;***************************************************
 ;
-;   : BUFFER   USE  @  DUP  >R  BEGIN  +BUF  UNTIL
-;       USE  !  R  @  0<  IF  R  1+  R  @  7FFF
-;                             AND  0  R/W  ENDIF
-;       R  !  R  PREV  !  R>  1+  ;
+;   WHEN BLOCK MOVES TO ANOTHER BLOCK, IT STARTS READING
+;   THE ONE AFTER IT AHEAD OF TIME, INTO ANOTHER BUFFER,
+;   WITH (DMA), WHICH RETURNS AT ONCE.  SO WHILE BLOCKS
+;   ARE USED IN ORDER, ONE IS BEING READ WHILE THE OTHER
+;   IS USED.  AHEAD IS 0 WHILE THE READ IS UNDER WAY, AND
+;   AHEAD 1+ HOLDS THE ADDRESS OF ITS BUFFER.  EVERY WORD
+;   THAT MAY PICK, WRITE, OR ERASE A BUFFER OTHER THAN
+;   PREV WAITS FOR IT, AND NOTHING ELSE TOUCHES THE BUFFER
+;   UNTIL THEN.
+;
+	HEAD	ORD,5,LONG,'A'/256
+	.WORD	'HE','AD'+ODD,DRTWO-3
+AHEAD:	.WORD	DOVAR,1,BUFFS
+;
+;   : WAIT   BEGIN  AHEAD  @  UNTIL  AHEAD  @  0<
+;       IF  7FFF  AHEAD  1+  @  !  -1  AHEAD  1+  @  1+  !
+;           1  AHEAD  !  ENDIF  ;
+;
+;   A READ AHEAD THAT FAILED (AHEAD -1) LEAVES ITS BUFFER
+;   MARKED EMPTY, WITH BLOCK NUMBER 7FFFFFFF, SO THAT BLOCK
+;   READS THE BLOCK AGAIN AND REPORTS THE ERROR.
+;
+	HEAD	ORD,4,LONG,'W'/256
+	.WORD	'AI','T'+EVEN,AHEAD-4
+WAIT:	.WORD	DOCOL
+WAIT1:	.WORD	AHEAD,AT,ZBRAN
+	.WORD	WAIT1-.,AHEAD,AT,ZLESS,ZBRAN
+	.WORD	WAIT2-.,LIT,07FFF,AHEAD,ONEP,AT,STORE
+	.WORD	LIT,-1,AHEAD,ONEP,AT,ONEP,STORE
+	.WORD	ONE,AHEAD,STORE
+WAIT2:	.WORD	SEMIS
+;
+;   : ?BUF   0  LIMIT  FIRST  DO  ROT  ROT  OVER  OVER
+;       I  @  7FFF  AND  =  SWAP  I  1+  @  =  AND
+;       >R  ROT  R>  OR  BLKSIZ/2+3  +LOOP
+;       >R  DROP  DROP  R>  ;
+;
+;   ( LO HI -- F )  IS THE BLOCK IN A BUFFER?
+;
+	HEAD	ORD,4,LONG,'?'/256
+	.WORD	'BU','F'+EVEN,WAIT-4
+QBUF:	.WORD	DOCOL,ZERO,LIMIT,FIRST,XDO
+QBUF1:	.WORD	ROT,ROT,OVER,OVER
+	.WORD	I,AT,LIT,07FFF,AND,EQUAL
+	.WORD	SWAP,I,ONEP,AT,EQUAL,AND
+	.WORD	TOR,ROT,FROMR,OR
+	.WORD	LIT,BLKSIZ/2+3,XPLOOP
+	.WORD	QBUF1-.,TOR,DROP,DROP,FROMR,SEMIS
+;
+;   : BUFFER   WAIT  USE  @  DUP  >R  BEGIN  +BUF  UNTIL
+;       USE  !  R  @  0<  IF  R  2+  R  1+  @  R  @
+;                             7FFF  AND  0  R/W  ENDIF
+;       R  !  R  1+  !  R  PREV  !  R>  2+  ;
+;
+;   ( LO HI -- ADDR )  A BUFFER STARTS WITH THE HIGH
+;   WORD OF ITS BLOCK NUMBER, WITH THE UPDATE FLAG,
+;   THEN THE LOW WORD
 ;
 	HEAD	ORD,6,LONG,'B'/256
-	.WORD	'UF','FE','R'+EVEN,DRTWO-3
-BUFFER:	.WORD	DOCOL,USE,AT,DUP,TOR
+	.WORD	'UF','FE','R'+EVEN,QBUF-4
+BUFFER:	.WORD	DOCOL,WAIT,USE,AT,DUP,TOR
 BUFF1:	.WORD	PBUF,ZBRAN
 	.WORD	BUFF1-.,USE,STORE
 	.WORD	R,AT,ZLESS,ZBRAN
-	.WORD	BUFF2-.,R,ONEP,R,AT
+	.WORD	BUFF2-.,R,TWOP,R,ONEP,AT,R,AT
 	.WORD	LIT,07FFF,AND,ZERO,RW
-BUFF2:	.WORD	R,STORE,R,PREV,STORE
-	.WORD	FROMR,ONEP,SEMIS
+BUFF2:	.WORD	R,STORE,R,ONEP,STORE,R,PREV,STORE
+	.WORD	FROMR,TWOP,SEMIS
+;
+;   : (AHEAD)   1  0  D+  OVER  OVER  ?BUF
+;       IF  DROP  DROP
+;       ELSE  OVER  OVER  BUFFER  PREV  @  AHEAD  1+  !
+;       ROT  ROT  1  AHEAD  (DMA)  ENDIF  ;
+;
+;   ( LO HI -- )  STARTS READING THE NEXT BLOCK AHEAD,
+;   UNLESS IT IS ALREADY IN A BUFFER
+;
+	HEAD	ORD,7,LONG,'('/256
+	.WORD	'AH','EA','D)'+ODD,BUFFER-5
+PAHEAD:	.WORD	DOCOL,ONE,ZERO,DPLUS,OVER,OVER,QBUF,ZBRAN
+	.WORD	PAHD1-.,DROP,DROP,BRAN
+	.WORD	PAHD2-.
+PAHD1:	.WORD	OVER,OVER,BUFFER,PREV,AT,AHEAD,ONEP,STORE
+	.WORD	ROT,ROT,ONE,AHEAD,PDMA
+PAHD2:	.WORD	SEMIS
 ;
 ;***************************************************
 ;*                      BLOCK                      *
 ;***************************************************
 ;
-;   : BLOCK   OFFSET  @  +  >R
-;       PREV  @  DUP  @  R  -  DUP  +
-;       IF  BEGIN  +BUF  0=
-;           IF  DROP  R  BUFFER
-;           DUP  R  1  R/W  1  -  ENDIF
-;           DUP  @  R  -  DUP  +  0=  UNTIL
-;       DUP  PREV  !  ENDIF  R>  DROP  1+  ;
+;   : BLOCK   0  OFFSET  @  OFFSET  1+  @  D+  SWAP  >R
+;       PREV  @  OVER  OVER  @  -  DUP  +
+;       OVER  1+  @  R  -  OR
+;       IF  WAIT  BEGIN  +BUF  0=
+;           IF  DROP  R  OVER  BUFFER
+;           DUP  R  OVER  2  -  @  1  R/W  2  -  ENDIF
+;           OVER  OVER  @  -  DUP  +
+;           OVER  1+  @  R  -  OR  0=  UNTIL
+;       DUP  PREV  !  OVER  R  SWAP  (AHEAD)  DUP  PREV  !
+;       ENDIF  R>  DROP  SWAP  DROP  2+  ;
+;
+;   PREV IS SET BEFORE (AHEAD), SO THAT ITS BUFFER ISN'T
+;   PICKED FOR THE NEXT BLOCK, AND AGAIN AFTER IT.
 ;
 	HEAD	ORD,5,LONG,'B'/256
-	.WORD	'LO','CK'+ODD,BUFFER-5
-BLOCK:	.WORD	DOCOL,OFFSET,AT,PLUS,TOR
-	.WORD	PREV,AT,DUP,AT,R
-	.WORD	SUB,DUP,PLUS,ZBRAN
-	.WORD	BLOCK3-.
+	.WORD	'LO','CK'+ODD,PAHEAD-5
+BLOCK:	.WORD	DOCOL,ZERO,OFFSET,AT,OFFSET,ONEP,AT
+	.WORD	DPLUS,SWAP,TOR
+	.WORD	PREV,AT,OVER,OVER,AT,SUB,DUP,PLUS
+	.WORD	OVER,ONEP,AT,R,SUB,OR,ZBRAN
+	.WORD	BLOCK3-.,WAIT
 BLOCK1:	.WORD	PBUF,ZEQU,ZBRAN
-	.WORD	BLOCK2-.,DROP,R,BUFFER
-	.WORD	DUP,R,ONE,RW,ONE,SUB
-BLOCK2:	.WORD	DUP,AT,R,SUB,DUP
-	.WORD	PLUS,ZEQU,ZBRAN
+	.WORD	BLOCK2-.,DROP,R,OVER,BUFFER
+	.WORD	DUP,R,OVER,TWO,SUB,AT,ONE,RW,TWO,SUB
+BLOCK2:	.WORD	OVER,OVER,AT,SUB,DUP,PLUS
+	.WORD	OVER,ONEP,AT,R,SUB,OR,ZEQU,ZBRAN
 	.WORD	BLOCK1-.,DUP,PREV,STORE
-BLOCK3:	.WORD	FROMR,DROP,ONEP,SEMIS
+	.WORD	OVER,R,SWAP,PAHEAD,DUP,PREV,STORE
+BLOCK3:	.WORD	FROMR,DROP,SWAP,DROP,TWOP,SEMIS
 ;
 ;***************************************************
 ;*              TEXT OUTPUT FORMATTING             *
@@ -1832,22 +1938,109 @@ PCR:	LI	0,0D
 	JMP	NEXT
 ;
 ;***************************************************
+;*                     INCLUDE                     *
+;***************************************************
+;
+;   (INCLUDE)  ( ADDR 0 -- F )  THE SIMULATOR OPENS THE HOST
+;              FILE NAMED BY THE COUNTED STRING AT BYTE ADDR
+;              ( ADDR 1 -- N )  AND COPIES ITS NEXT LINE TO
+;              BYTE ADDR, OR AT END OF FILE CLOSES IT, RESTORES
+;              THE TEXT IT REPLACED, AND LEAVES 0.  LEAVES -1 IF
+;              THE LINE IS TOO LONG FOR THE TIB
+;
+	HEAD	ORD,9,LONG,'('/256
+	.WORD	'IN','CL','UD','E)'+ODD,ARROW-3
+PINCL:	.WORD	.+1
+	LD	0,0(SP)		; FUNCTION
+	JSR	@INCLA		; RETURNS FLAG IN AC0
+	AISZ	SP,1
+	JMP	PUT
+INCLA:	.WORD	INCLUD
+;
+;   : INCLUDE   BL  WORD  HERE  BYTE  0  (INCLUDE)  0=  0  ?ERROR
+;               BLK  @  >R  IN  @  >R
+;               BEGIN  TIB  @  BYTE  1  (INCLUDE)  DUP  0<  0  ?ERROR
+;               WHILE  0  BLK  !  0  IN  !  INTERPRET
+;               REPEAT  R>  IN  !  R>  BLK  !  ;
+;
+	HEAD	ORD,7,LONG,'I'/256
+	.WORD	'NC','LU','DE'+ODD,PINCL-6
+INCL:	.WORD	DOCOL,BL,WORD,HERE,BYTE,ZERO,PINCL
+	.WORD	ZEQU,ZERO,QERROR
+	.WORD	BLK,AT,TOR,IN,AT,TOR
+INCL1:	.WORD	TIB,AT,BYTE,ONE,PINCL,DUP,ZLESS,ZERO,QERROR,ZBRAN
+	.WORD	INCL2-.,ZERO,BLK,STORE,ZERO,IN,STORE
+	.WORD	INTER,BRAN
+	.WORD	INCL1-.
+INCL2:	.WORD	FROMR,IN,STORE,FROMR,BLK,STORE,SEMIS
+;
+;***************************************************
 ;*                     DISK I/O                    *
 ;***************************************************
+;
+;   R/W  ( ADDR LO HI F -- )  READS (F=1) OR WRITES (F=0)
+;        THE 32-BIT BLOCK HI:LO AT ADDR.  THE HIGH BYTE OF
+;        HI SELECTS THE DRIVE.  F=2 SYNCS ALL DRIVES.
 ;
 	HEAD	ORD,3,LONG,'R'/256
-	.WORD	'/W'+ODD,ARROW-3
+	.WORD	'/W'+ODD,INCL-5
 RW:	.WORD	.+1
 	JSR	BLOCKIO
-	AISZ	SP,1
+	AISZ	SP,2
+	JMP	POP2
+;
+;   (DMA)  ( ADDR LO HI F STATUS -- )  STARTS READING OR
+;          WRITING THE BLOCK AS R/W DOES, AND RETURNS AT
+;          ONCE.  THE SIMULATOR SETS THE WORD AT STATUS TO 0,
+;          THEN TO 1 WHEN THE TRANSFER IS DONE, OR -1 IF IT
+;          FAILED.
+;
+	HEAD	ORD,5,LONG,'('/256
+	.WORD	'DM','A)'+ODD,RW-3
+PDMA:	.WORD	.+1
+	JSR	@DMAA
+	AISZ	SP,3
 	JMP	POP2
+DMAA:	.WORD	BLKDMA
+;
+;***************************************************
+;*          PERFORMANCE COUNTERS (SIMULATOR)       *
+;***************************************************
+;
+;   PERF  ( N -- D )  READ SIMULATOR COUNTER N:
+;         0 INSTRUCTIONS, 1 CYCLES, 2 HOST NANOSECONDS,
+;         3 RESET, 4 SNAPSHOT, 16+N SNAPSHOT OF N
+;
+	HEAD	ORD,4,LONG,'P'/256
+	.WORD	'ER','F'+EVEN,PDMA-4
+PERF:	.WORD	.+1
+	PUSH	IP		; SAVE IP
+	LD	0,0(SP)		; FUNCTION CODE
+	JSR	@PERFA		; RETURNS AC0 LO, AC1 HI
+	ST	0,0(SP)		; LO-ORDER SECOND
+	RCPY	1,0
+	PULL	IP		; RESTORE IP
+	JMP	PUSH		; HI-ORDER ON TOP
+PERFA:	.WORD	PERFCTR		; (BASE PAGE POINTERS ARE FULL)
+;
+;   : TICKS   0  PERF  ;
+;
+	HEAD	ORD,5,LONG,'T'/256
+	.WORD	'IC','KS'+ODD,PERF-4
+TICKS:	.WORD	DOCOL,ZERO,PERF,SEMIS
+;
+;   : ELAPSED   DMINUS  TICKS  D+  ;
+;
+	HEAD	ORD,7,LONG,'E'/256
+	.WORD	'LA','PS','ED'+ODD,TICKS-4
+ELAPS:	.WORD	DOCOL,DMINUS,TICKS,DPLUS,SEMIS
 ;
 ;***************************************************
 ;*                    ', FORGET                    *
 ;***************************************************
 ;
 	HEAD	IMM,1,SHORT,''''/256
-	.WORD	RW-3
+	.WORD	ELAPS-5
 TICK:	.WORD	DOCOL,DFIND,ZEQU,ZERO
 	.WORD	QERROR,DROP,LITER,SEMIS
 ;
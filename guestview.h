@@ -0,0 +1,34 @@
+// Layout of the shared memory segment in which "psim --shared-mem name"
+// keeps guest memory, so that other processes can map it read only and
+// inspect the dictionary, stacks and block buffers of a running FORTH.
+//
+// Guest memory is always live.  The register snapshot is written when
+// the simulator stops to wait for console input or halts, and every
+// SIMSTATS_BATCH instructions while it runs.  generation is odd only
+// while the snapshot is being written, so a reader's copy of the
+// snapshot is consistent if generation was even, and unchanged, both
+// before and after the copy.  Guest memory changes as the simulator
+// runs, so a copy of it also matches the snapshot only if running was
+// clear in that snapshot.
+
+#include <stdatomic.h>
+
+#define GUESTVIEW_MAGIC      0x5647364e  // "N6GV"
+#define GUESTVIEW_VERSION    2
+#define GUESTVIEW_MEM_OFFSET 4096        // byte offset of guest memory
+#define GUESTVIEW_SIZE       (GUESTVIEW_MEM_OFFSET + 65536 * 2)
+
+struct guestview
+{
+  uint32_t magic;
+  uint32_t version;
+  int32_t pid;
+  _Atomic uint32_t generation;
+  uint64_t inst_count;
+  uint16_t pc;
+  uint16_t ac [4];
+  uint16_t fr;
+  int16_t sp;           // index of top of hardware stack, -1 if empty
+  uint16_t stack [16];
+  _Atomic uint32_t running;  // clear while stopped for input, or halted
+};
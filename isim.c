@@ -7,6 +7,8 @@
 //  I/O instructions (RIN, ROUT) not supported
 //  EIS, POWR I/O, Arithmetic CROM instructions not supported
 
+#include <inttypes.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -15,15 +17,63 @@
 #include <termios.h>
 #include <unistd.h>
 
+#include "blkdev.h"
+#include "console.h"
+#include "figforth.h"
+#include "perfctr.h"
+#include "simstats.h"
+
 typedef uint16_t word_t;
 
-char *block_fn = "figforth_blocks";
-FILE *block_f;
+// drive 0 is figforth_blocks unless --drive gives another file
+char *block_fn [BLKDEV_DRIVES] = { "figforth_blocks" };
+struct blkdev *block_dev [BLKDEV_DRIVES];
+struct blkdev_options block_options =
+  {
+    .cache_blocks = BLKDEV_DEFAULT_CACHE,
+    .prefetch_blocks = BLKDEV_DEFAULT_PREFETCH,
+  };
 
 FILE *trace_f = NULL;
 bool inst_trace = false;
 bool word_trace = false;
 
+uint64_t inst_count = 0;  // instructions executed
+uint64_t cycle_count = 0;  // approximate microcycles executed
+uint64_t block_reads = 0;
+uint64_t block_writes = 0;
+uint64_t console_in_count = 0;
+uint64_t console_out_count = 0;
+
+bool live_stats_enabled = false;
+struct simstats *live_stats = NULL;
+
+#define JMP_THRU_W 0x2600 // JMP @(W), used by NEXT and EXECUTE to enter a word
+
+int live_word = 0;  // W at the last JMP @(W), the word being executed
+
+// approximate execution times in microcycles, indexed by the top four
+// bits of the instruction
+const int opcode_cycles [16] =
+  {
+    [0x0] = 4,  // HALT, PUSHF, RTI, RTS, PULLF, JSRI, SFLG, PFLG
+    [0x1] = 5,  // BOC
+    [0x2] = 5,  // JMP, JSR
+    [0x3] = 4,  // RADD, RXCH, RCPY, RXOR, RAND
+    [0x4] = 5,  // PUSH, PULL, AISZ, LI
+    [0x5] = 5,  // CAI, XCHRS, ROL, ROR, SHL, SHR
+    [0x6] = 5,  // AND, OR
+    [0x7] = 7,  // SKAZ, ISZ, DSZ
+    [0x8] = 4,  // LD
+    [0x9] = 6,  // LD @
+    [0xa] = 4,  // ST
+    [0xb] = 6,  // ST @
+    [0xc] = 4,  // ADD
+    [0xd] = 4,  // SUB
+    [0xe] = 6,  // SKG
+    [0xf] = 6   // SKNE
+  };
+
 uint16_t mem [65536];
 
 uint16_t ac [4];  // accumulators
@@ -33,7 +83,7 @@ uint16_t pc;  // program counter
 int sp;  // index of top item on stack [0..stackSize-1], or -1 when empty
 uint16_t stack [STACK_SIZE];
 
-bool halt;
+volatile sig_atomic_t halt;  // set by signal handlers
 
 bool flags [16];  // general-purpose flags
 #define cy (flags [13])
@@ -218,26 +268,69 @@ void pulseFlag (int flag)
   ext_flag [flag] = false;
 }
 
-#define STACK_LIMIT  0x1d8f
-
 void printStack (void)
 {
   int a;
 
-  if ((ac [3] < (STACK_LIMIT - 100)) || (ac [3] > STACK_LIMIT))
+  if ((ac [3] < (FORTH_S0 - FORTH_STACK_DEPTH)) || (ac [3] > FORTH_S0))
     return;
   fprintf (trace_f, "stack: ");
-  if (ac [3] >= STACK_LIMIT)
+  if (ac [3] >= FORTH_S0)
     {
       fprintf (trace_f, "empty ");
       return;
     }
-  for (a = STACK_LIMIT - 1; a >= ac [3]; a--)
+  for (a = FORTH_S0 - 1; a >= ac [3]; a--)
     {
       fprintf (trace_f, "%04x ", mem [a]);
     }
 }
 
+#define MAX_WORD_NAME 32
+
+// copies the name of the word with code field address addr into name,
+// which must have room for MAX_WORD_NAME characters
+void getWordName (int addr, char *name)
+{
+  int c;
+  int b = 1;
+  int len = 0;
+  addr -= 2;  // back up past PFA to last word of name
+  if ((mem [addr & WORD_MASK] & 0x8080) == 0x8080)
+    {
+      // short word, we're done
+    }
+  else
+    {
+      // long word, find start of name
+      do
+	{
+	  addr --;
+	}
+      while (((mem [addr & WORD_MASK] & 0x8000) == 0) &&
+	     (++len < MAX_WORD_NAME / 2));
+    }
+  for (len = 0; len < MAX_WORD_NAME - 1; len++)
+    {
+      c = mem [addr & WORD_MASK];
+      if (b == 0)
+	c >>= 8;
+      name [len] = c & 0x7f;
+      if ((c & 0x80) != 0)
+	{
+	  len++;
+	  break;
+	}
+      b++;
+      if (b == 2)
+	{
+	  addr++;
+	  b = 0;
+	}
+    }
+  name [len] = '\0';
+}
+
 void printWordName (int addr)
 {
   int c;
@@ -510,6 +603,10 @@ void executeInstruction ()
   if (halt)
     return;
   instruction = mem [pc];
+  inst_count++;
+  cycle_count += opcode_cycles [instruction >> 12];
+  if (live_stats && (instruction == JMP_THRU_W))
+    live_word = ac [2];
   if (inst_trace)
     {
       char buf [80];
@@ -847,13 +944,16 @@ void loadHexFile (char *name)
 
 bool consoleInputAvail ()
 {
-  return false;  // $$$
+  return consoleAvail ();
 }
 
-// blocking read one character from console
+// blocking read one character from console, or -1 at end of input or
+// when a signal has stopped the simulator
 int consoleInputCharacter (void)
 {
-  int b = fgetc (stdin);
+  int b = consoleGet ();
+  if (b < 0)
+    return b;
   b &= 0x7f;
   if (b == '\n')
     b = '\r';
@@ -864,7 +964,7 @@ void consoleOutputCharacter (int c)
 {
   if (c == '\r')
     c = '\n';
-  fprintf (stdout, "%c", c);
+  consolePut (c);
 }
 
 int get_mem_byte (int addr)
@@ -883,47 +983,99 @@ void put_mem_byte (int addr, int b)
     mem [addr >> 1] = ((mem [addr >> 1]) & 0x00ff) | ((b & 0xff) << 8);
 }
 
-// addr is word addr
-#define BLOCK_SIZE 128
+void blockOpen (void)
+{
+  int i;
+
+  for (i = 0; i < BLKDEV_DRIVES; i++)
+    {
+      if (! block_fn [i])
+	continue;
+      block_dev [i] = blkdevOpen (block_fn [i], & block_options);
+      if (! block_dev [i])
+	{
+	  fprintf (stderr, "can't open block file '%s'\n", block_fn [i]);
+	  exit (2);
+	}
+    }
+}
+
+void blockFlush (void)
+{
+  int i;
+
+  for (i = 0; i < BLKDEV_DRIVES; i++)
+    if (block_dev [i])
+      blkdevFlush (block_dev [i]);
+}
+
+void blockClose (void)
+{
+  int i;
+
+  for (i = 0; i < BLKDEV_DRIVES; i++)
+    if (block_dev [i])
+      {
+	blkdevClose (block_dev [i]);
+	block_dev [i] = NULL;
+      }
+}
+
+// addr is word addr, block is the 32-bit block number, with the drive
+// in its high byte.  The first FIRST_BLOCK blocks of each drive aren't
+// in its file.
+#define BLOCK_SIZE BLKDEV_BLOCK_SIZE
 #define FIRST_BLOCK 8
-void block_io (int addr, int block, bool read)
+void block_io (int addr, uint32_t block, bool read)
 {
-  int baddr = addr << 1;
-  int count;
-  int b;
-  int new_pos;
+  uint16_t bounce [BLKDEV_BLOCK_WORDS];
+  uint16_t *words = & mem [addr];
+  uint32_t drive = block >> BLKDEV_DRIVE_SHIFT;
+  struct blkdev *dev = (drive < BLKDEV_DRIVES) ? block_dev [drive] : NULL;
+  char msg [80];
+  char *p;
+  int i;
 
-  fprintf (stdout, "%sing block %d, addr %04x, byte addr %04x\n",
-	   (read ? "read" : "write"), block, addr, baddr);
+  // through the console, to stay in order with the guest's output
+  snprintf (msg, sizeof (msg), "%sing block %" PRIu32 ", addr %04x, byte addr %04x\n",
+	    (read ? "read" : "write"), block, addr, addr << 1);
+  for (p = msg; *p; p++)
+    consolePut (*p);
+  if (! dev)
+    {
+      fprintf (stderr, "no drive %" PRIu32 "\n", drive);
+      return;
+    }
+  block &= BLKDEV_DRIVE_BLOCKS - 1;
   if (block < FIRST_BLOCK)
     return;
+  if (read)
+    block_reads++;
+  else
+    block_writes++;
 
-  new_pos = (block - FIRST_BLOCK) * BLOCK_SIZE;
-  fprintf (stderr, "seeking to %d\n", new_pos);
-  if (fseek (block_f, new_pos, SEEK_SET) < 0)
+  // a buffer that wraps around the end of memory is copied through a
+  // bounce buffer
+  if (addr + BLKDEV_BLOCK_WORDS > WORD_MASK + 1)
     {
-      fprintf (stderr, "error seeking to %d\n", new_pos);
-      return;
+      words = bounce;
+      if (! read)
+	for (i = 0; i < BLKDEV_BLOCK_WORDS; i++)
+	  bounce [i] = mem [(addr + i) & WORD_MASK];
     }
-  count = BLOCK_SIZE;
-  while (count--)
+  if (read)
     {
-      if (read)
+      if (! blkdevRead (dev, block - FIRST_BLOCK, words))
 	{
-	  b = fgetc (block_f);
-	  if (b < 0)
-	    {
-	      fprintf (stdout, "end of file\n");
-	      return;
-	    }
-	  put_mem_byte (baddr++, b);
-	}
-      else
-	{
-	  b = get_mem_byte (baddr++);
-	  fputc (b, block_f);
+	  fprintf (stdout, "end of file\n");
+	  return;
 	}
+      if (words == bounce)
+	for (i = 0; i < BLKDEV_BLOCK_WORDS; i++)
+	  mem [(addr + i) & WORD_MASK] = bounce [i];
     }
+  else if (! blkdevWrite (dev, block - FIRST_BLOCK, words))
+    fprintf (stderr, "can't write block %" PRIu32 "\n", block);
 }
 
 #define ABSTTY_BASE    0x7e00
@@ -941,20 +1093,137 @@ void block_io (int addr, int block, bool read)
 #define ABSTTY_LDM     0x7eea
 #define ABSTTY_STM     0x7ef2  // 0x7efa according to IMP-16P man V1 p.7-19
 
+#define ABSTTY_EXPECT  0x7efc  // read a line, also my own
+#define ABSTTY_TYPE    0x7efd  // write a string, also my own
+#define ABSTTY_PERF    0x7efe  // performance counters, also my own
 #define ABSTTY_BLOCKIO 0x7eff  // my own hack for disk I/O
 
-void run (void)
+// BLOCKIO takes ( addr lo hi flag ), where hi:lo is a 32-bit block
+// number: flag is 0 to write, 1 to read, or BLOCKIO_SYNC to flush
+// written blocks to the files of all drives
+#define BLOCKIO_SYNC 2
+
+void trapPerf (int function)
+{
+  uint32_t result = perfCounter (function, inst_count, cycle_count);
+
+  ac [0] = result & WORD_MASK;
+  ac [1] = result >> 16;
+}
+
+void liveStatsUpdate (void)
+{
+  struct simstats_counters c;
+  char name [MAX_WORD_NAME];
+
+  c.instructions = inst_count;
+  c.cycles = cycle_count;
+  c.block_reads = block_reads;
+  c.block_writes = block_writes;
+  c.console_in = console_in_count;
+  c.console_out = console_out_count;
+  getWordName (live_word, name);
+  simstatsUpdate (live_stats, & c, pc, live_word, name);
+}
+
+// read a console character, halting at the end of input
+int trapGetc (void)
 {
   int c;
 
-  loadHexFile ("figforth_imp16.obj");
+  if (live_stats)
+    liveStatsUpdate ();  // show where we are while waiting
+  console_in_count++;
+  c = consoleInputCharacter ();
+  if (c < 0)
+    {
+      halt = true;  // the console has gone away, as if it hung up
+      c = 0x0d;
+    }
+  return c;
+}
+
+void trapPutc (int c)
+{
+  c &= 0x7f;
+  console_out_count++;
+  consoleOutputCharacter (c);
+  if (c == 0x0d)
+    consoleOutputCharacter (0x0a);
+}
+
+// TYPE ( addr count -- ) for FIG-Forth: write count characters from
+// byte address addr to the console at once, as EMIT would write them
+void hostType (void)
+{
+  uint8_t buf [512];
+  int addr = mem [(ac [3] + 1) & WORD_MASK];
+  int count = (int16_t) mem [ac [3]];
+  int n = 0;
+  int c;
 
-  block_f = fopen (block_fn, "r+b");
-  if (! block_f)
+  for (; count > 0; count--)
     {
-      fprintf (stderr, "can't open block file '%s'\n", block_fn);
-      exit (2);
+      if (n >= (int) sizeof (buf) - 1)
+	{
+	  consoleWrite (buf, n);
+	  n = 0;
+	}
+      c = get_mem_byte (addr) & 0x7f;
+      addr = (addr + 1) & WORD_MASK;
+      buf [n++] = (c == '\r') ? '\n' : c;
+      if (c == 0x0d)
+	buf [n++] = 0x0a;
+      console_out_count++;
     }
+  consoleWrite (buf, n);
+}
+
+// EXPECT ( addr count -- ) for FIG-Forth: read a line of up to count
+// characters into byte address addr, echoing it and handling the
+// backspace character in AC0, as the FIG-Forth definition does.  At
+// the end of input the line ends, and the simulator halts.
+void hostExpect (void)
+{
+  int start = mem [(ac [3] + 1) & WORD_MASK];
+  int end = start + (int16_t) mem [ac [3]];
+  int i = start;
+  int c;
+
+  do
+    {
+      c = trapGetc ();
+      if (c == ac [0])
+	{
+	  if (i == start)
+	    trapPutc (0x07);
+	  else
+	    {
+	      i--;
+	      trapPutc (0x08);
+	    }
+	  continue;
+	}
+      if (c == 0x0d)
+	{
+	  end = i;  // LEAVE, storing a null and echoing a blank
+	  put_mem_byte (i & WORD_MASK, 0);
+	  c = ' ';
+	}
+      else
+	put_mem_byte (i & WORD_MASK, c);
+      put_mem_byte ((i + 1) & WORD_MASK, 0);
+      trapPutc (c);
+      i++;
+    }
+  while ((i < end) && ! halt);
+}
+
+void run (void)
+{
+  loadHexFile ("figforth_imp16.obj");
+
+  blockOpen ();
 	
   pc = 0x10;
   halt = false;
@@ -966,14 +1235,19 @@ void run (void)
 	  switch (pc)
 	    {
 	    case ABSTTY_GETC:
-	      ac [0] = consoleInputCharacter ();
+	      ac [0] = trapGetc ();
 	      pc = pull ();
 	      continue;;
 	    case ABSTTY_PUTC:
-	      c = ac [0] & 0x7f;
-	      consoleOutputCharacter (c);
-	      if (c == 0x0d)
-		consoleOutputCharacter (0x0a);
+	      trapPutc (ac [0]);
+	      pc = pull ();
+	      continue;
+	    case ABSTTY_TYPE:
+	      hostType ();
+	      pc = pull ();
+	      continue;
+	    case ABSTTY_EXPECT:
+	      hostExpect ();
 	      pc = pull ();
 	      continue;
 	    case ABSTTY_INTEST:
@@ -983,8 +1257,17 @@ void run (void)
 	      else
 		pc = (pull () + 1) & WORD_MASK;
 	      continue;
+	    case ABSTTY_PERF:
+	      trapPerf (ac [0]);
+	      pc = pull ();
+	      continue;
 	    case ABSTTY_BLOCKIO:
-	      block_io (mem [ac [3] + 2], mem [ac [3] + 1], mem [ac [3]] != 0);
+	      if (mem [ac [3]] == BLOCKIO_SYNC)
+		blockFlush ();
+	      else
+		block_io (mem [(ac [3] + 3) & WORD_MASK],
+			  ((uint32_t) mem [(ac [3] + 1) & WORD_MASK] << 16) | mem [(ac [3] + 2) & WORD_MASK],
+			  mem [ac [3]] != 0);
 	      pc = pull ();
 	      continue;
 	    default:
@@ -993,12 +1276,31 @@ void run (void)
 	    }
 	}
       else
-	executeInstruction ();
+	{
+	  executeInstruction ();
+	  if (live_stats && ((inst_count & (SIMSTATS_BATCH - 1)) == 0))
+	    liveStatsUpdate ();
+	}
     }
+  consoleStop ();
+  blockClose ();
   printf ("halted at %04x\n", pc);
+  if (live_stats)
+    {
+      liveStatsUpdate ();
+      simstatsDestroy (live_stats);
+    }
 }
 
 
+// let a terminated run halt cleanly, so that cached blocks reach the
+// block file
+void sigint_handler (int sig)
+{
+  (void) sig;
+  halt = true;
+}
+
 static struct termios orig_trm;
 
 void get_tty_settings (void)
@@ -1034,8 +1336,55 @@ void set_tty_raw (bool raw)
 
 int main (int argc, char *argv [])
 {
+  while (--argc)
+    {
+      argv++;
+      if (strcmp (argv [0], "--live-stats") == 0)
+	{
+	  live_stats_enabled = true;
+	}
+      else if ((strcmp (argv [0], "--block-cache") == 0) && (argc > 1))
+	{
+	  argc--;
+	  argv++;
+	  block_options.cache_blocks = strtol (argv [0], NULL, 0);
+	}
+      else if ((strcmp (argv [0], "--block-cow") == 0) && (argc > 1))
+	{
+	  argc--;
+	  argv++;
+	  block_options.cow = (strcmp (argv [0], "commit") == 0) ? BLKDEV_COW_COMMIT : BLKDEV_COW_DISCARD;
+	}
+      else if ((strcmp (argv [0], "--drive") == 0) && (argc > 2)
+	       && ((unsigned) strtol (argv [1], NULL, 0) < BLKDEV_DRIVES))
+	{
+	  block_fn [strtol (argv [1], NULL, 0)] = argv [2];
+	  argc -= 2;
+	  argv += 2;
+	}
+      else if ((strcmp (argv [0], "--block-prefetch") == 0) && (argc > 1))
+	{
+	  argc--;
+	  argv++;
+	  block_options.prefetch_blocks = strtol (argv [0], NULL, 0);
+	}
+      else
+	{
+	  fprintf (stderr, "unrecognized argument '%s'\n", argv [0]);
+	  exit (1);
+	}
+    }
+
+  if (live_stats_enabled)
+    live_stats = simstatsCreate ("isim");
+
+  signal (SIGINT, sigint_handler);
+  signal (SIGTERM, sigint_handler);
+  signal (SIGHUP, sigint_handler);
+
   get_tty_settings ();
   set_tty_raw (true);
+  consoleStart (false, & halt);
   run ();
   restore_tty_settings ();
   exit (0);
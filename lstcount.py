@@ -0,0 +1,132 @@
+#!/usr/bin/python
+# Python 2.6 or later required
+
+# Annotate a pasm listing with the execution counts written by
+# "psim --profile", in the style of gcov.  Each source line that generated
+# an instruction is prefixed by the number of times it was executed, or by
+# "#####" if it was never executed.  Lines that did not generate an
+# instruction (data, pseudo-ops, comments) are prefixed by "-".
+#
+# Any number of count files may be given; their counts are summed, so the
+# coverage of a whole regression suite can be combined, and the merged
+# counts can be saved with --output for later use.
+
+import argparse
+import re
+import sys
+
+mnemonics = set (['ADD', 'AISZ', 'AND', 'BOC', 'CAI', 'CFR', 'CRF', 'DECA',
+                  'DSZ', 'HALT', 'ISZ', 'LD', 'LI', 'JMP', 'JSR', 'LSEX',
+                  'OR', 'PFLG', 'PULL', 'PULLF', 'PUSH', 'PUSHF', 'RADC',
+                  'RADD', 'RAND', 'RCPY', 'ROL', 'ROR', 'RTI', 'RTS', 'RXCH',
+                  'RXOR', 'SFLG', 'SHL', 'SHR', 'SKAZ', 'SKG', 'SKNE', 'ST',
+                  'SUBB', 'XCHRS', 'NOP'])
+
+# "lineno addr word A  source", as written by format_listing() in asm.c
+listing_re = re.compile (r'^([ 0-9]{5}) ([0-9A-F]{4}) ([0-9A-F]{4}) A  (.*)$')
+
+
+def read_counts (counts, f):
+    for line in f:
+        line = line.strip ()
+        if not line:
+            continue
+        (addr, count) = line.split (':')
+        addr = int (addr, 16)
+        counts [addr] = counts.get (addr, 0) + int (count)
+
+
+def write_counts (counts, f):
+    for addr in sorted (counts.keys ()):
+        f.write ('%04x: %d\n' % (addr, counts [addr]))
+
+
+def is_instruction (source):
+    source = source.split (';') [0]
+    tokens = source.split ()
+    if tokens and tokens [0].endswith (':'):
+        tokens = tokens [1:]
+    return len (tokens) > 0 and tokens [0].upper () in mnemonics
+
+
+def annotate (lf, counts, out, color, unexecuted_only):
+    code_lines = 0
+    executed_lines = 0
+    hot = []
+    for line in lf:
+        line = line.rstrip ('\n')
+        m = listing_re.match (line)
+        if m and m.group (1).strip () and is_instruction (m.group (4)):
+            addr = int (m.group (2), 16)
+            count = counts.get (addr, 0)
+            code_lines += 1
+            if count:
+                executed_lines += 1
+                hot.append ((count, line))
+                if unexecuted_only:
+                    continue
+                prefix = '%9d' % count
+            else:
+                prefix = '%9s' % '#####'
+                if color:
+                    line = '\033[1;31m' + line + '\033[0m'
+        else:
+            if unexecuted_only:
+                continue
+            prefix = '%9s' % '-'
+        out.write ('%s: %s\n' % (prefix, line))
+    return (code_lines, executed_lines, hot)
+
+
+parser = argparse.ArgumentParser (description = 'annotate a pasm listing with psim execution counts')
+
+parser.add_argument ('listing',
+                     type = argparse.FileType ('r'),
+                     help = 'listing file produced by pasm -l')
+
+parser.add_argument ('counts', metavar = 'count_file',
+                     nargs = '+',
+                     type = argparse.FileType ('r'),
+                     help = 'execution count file produced by psim --profile')
+
+parser.add_argument ('--output', '-o',
+                     type = argparse.FileType ('w'),
+                     help = 'write the merged execution counts to this file')
+
+parser.add_argument ('--color', '-c',
+                     action = 'store_true',
+                     help = 'highlight unexecuted lines in red')
+
+parser.add_argument ('--unexecuted', '-u',
+                     action = 'store_true',
+                     help = 'only show instructions that were never executed')
+
+parser.add_argument ('--hot', '-t',
+                     type = int,
+                     default = 0,
+                     help = 'summarize the N most frequently executed lines')
+
+args = parser.parse_args ()
+
+counts = {}
+for cf in args.counts:
+    read_counts (counts, cf)
+    cf.close ()
+
+if args.output:
+    write_counts (counts, args.output)
+    args.output.close ()
+
+(code_lines, executed_lines, hot) = annotate (args.listing, counts, sys.stdout,
+                                              args.color, args.unexecuted)
+
+if code_lines:
+    sys.stdout.write ('\n%d of %d instruction lines executed (%.1f%%)\n' %
+                      (executed_lines, code_lines,
+                       100.0 * executed_lines / code_lines))
+
+if args.hot:
+    sys.stdout.write ('\nmost frequently executed lines:\n\n')
+    hot.sort (key = lambda h: h [0], reverse = True)
+    for (count, line) in hot [:args.hot]:
+        sys.stdout.write ('%12d: %s\n' % (count, line))
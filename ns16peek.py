@@ -0,0 +1,167 @@
+#!/usr/bin/python
+# Python 2.6 or later required
+
+# Inspect a running FIG-Forth through the guest memory that
+# "psim --shared-mem name" keeps in shared memory, without stopping it.
+# Shows the registers, the data and return stacks (with the names of
+# the words the return addresses lie in), and optionally a memory dump.
+# The layout of the shared memory is described in guestview.h.
+
+import argparse
+import mmap
+import os
+import struct
+import sys
+import time
+
+GUESTVIEW_MAGIC = 0x5647364e
+GUESTVIEW_VERSION = 2
+GUESTVIEW_MEM_OFFSET = 4096
+
+header_fmt = '<IIiIQH4HHh16HxxI'
+
+# FIG-Forth PACE base page
+FORTH0 = 0x16
+S0 = 0x19
+R0 = 0x1a
+RP = 0x21
+UP = 0x22
+CURRENT = 0x11  # user variable offset
+
+
+class GuestView (object):
+    def __init__ (self, name):
+        fd = os.open ('/dev/shm/' + name.lstrip ('/'), os.O_RDONLY)
+        self.map = mmap.mmap (fd, 0, mmap.MAP_SHARED, mmap.PROT_READ)
+        os.close (fd)
+        (magic, version) = struct.unpack_from ('<II', self.map, 0)
+        if magic != GUESTVIEW_MAGIC or version != GUESTVIEW_VERSION:
+            raise ValueError ('not a psim guest view')
+
+    def generation (self):
+        return struct.unpack_from ('<I', self.map, 12) [0]
+
+    # Returns a copy of the header and memory, retrying until the copy is
+    # consistent and taken while the simulator was stopped, or returns
+    # the last copy, marked live, if it keeps running for the whole
+    # timeout.
+    def snapshot (self, timeout):
+        deadline = time.time () + timeout
+        while True:
+            gen = self.generation ()
+            header = struct.unpack_from (header_fmt, self.map, 0)
+            mem = struct.unpack_from ('<65536H', self.map, GUESTVIEW_MEM_OFFSET)
+            running = header [-1]
+            consistent = ((gen & 1) == 0 and not running and
+                          gen == self.generation ())
+            if consistent or time.time () >= deadline:
+                return (header, mem, consistent)
+            time.sleep (0.01)
+
+
+def word_name (mem, cfa):
+    addr = (cfa - 2) & 0xffff  # last word of name
+    if (mem [addr] & 0x8080) != 0x8080:
+        for i in range (16):
+            addr = (addr - 1) & 0xffff
+            if mem [addr] & 0x8000:
+                break
+    name = ''
+    b = 1
+    while len (name) < 31:
+        c = mem [addr]
+        if b == 0:
+            c >>= 8
+        name += chr (c & 0x7f)
+        if c & 0x80:
+            break
+        b += 1
+        if b == 2:
+            addr = (addr + 1) & 0xffff
+            b = 0
+    return name
+
+
+# find the word containing addr, by searching the dictionary links
+def containing_word (mem, addr):
+    best = None
+    nfa = mem [mem [(mem [UP] + CURRENT) & 0xffff]]  # LATEST
+    if not nfa:
+        nfa = mem [FORTH0]
+    for i in range (2000):
+        if not nfa:
+            break
+        # the name's characters follow the length byte, and the last
+        # one is marked
+        lfa = nfa
+        b = 1
+        while True:
+            c = mem [lfa] if b else mem [lfa] >> 8
+            if c & 0x80:
+                break
+            b ^= 1
+            if b == 0:
+                lfa = (lfa + 1) & 0xffff
+        lfa = (lfa + 1) & 0xffff
+        cfa = (lfa + 1) & 0xffff
+        if cfa <= addr and (best is None or cfa > best):
+            best = cfa
+        nfa = mem [lfa]
+    if best is None:
+        return '?'
+    return '%s+%d' % (word_name (mem, best), addr - best)
+
+
+parser = argparse.ArgumentParser (description = 'inspect a FIG-Forth running in psim --shared-mem')
+
+parser.add_argument ('name',
+                     help = 'shared memory name given to psim --shared-mem')
+
+parser.add_argument ('--dump', '-d',
+                     nargs = 2,
+                     metavar = ('addr', 'count'),
+                     help = 'also dump count words of memory starting at addr (hex)')
+
+parser.add_argument ('--timeout', '-t',
+                     type = float,
+                     default = 1.0,
+                     help = 'seconds to wait for a consistent snapshot')
+
+args = parser.parse_args ()
+
+view = GuestView (args.name)
+(header, mem, consistent) = view.snapshot (args.timeout)
+(magic, version, pid, gen, inst_count, pc, ac0, ac1, ac2, ac3, fr, sp) = header [:12]
+stack = header [12:28]
+
+sys.stdout.write ('psim pid %d, %d instructions, generation %d%s\n' %
+                  (pid, inst_count, gen,
+                   '' if consistent else ' (running, memory may not match the registers)'))
+sys.stdout.write ('PC=%04x AC0=%04x AC1=%04x AC2=%04x AC3=%04x FR=%04x\n' %
+                  (pc, ac0, ac1, ac2, ac3, fr))
+sys.stdout.write ('hardware stack: %s\n' %
+                  ' '.join ('%04x' % stack [i] for i in range (sp, -1, -1)))
+sys.stdout.write ('executing: %s\n' % word_name (mem, ac2))
+
+s0 = mem [S0]
+sys.stdout.write ('data stack: ')
+if ac3 >= s0 or s0 - ac3 > 100:
+    sys.stdout.write ('empty')
+else:
+    sys.stdout.write (' '.join ('%04x' % mem [a] for a in range (s0 - 1, ac3 - 1, -1)))
+sys.stdout.write ('\n')
+
+r0 = mem [R0]
+rp = mem [RP]
+sys.stdout.write ('return stack:\n')
+if r0 - rp > 100:
+    rp = r0
+for a in range (rp, r0):
+    sys.stdout.write ('  %04x  %s\n' % (mem [a], containing_word (mem, mem [a])))
+
+if args.dump:
+    addr = int (args.dump [0], 16)
+    count = int (args.dump [1], 0)
+    for line in range (addr, addr + count, 8):
+        words = [mem [a & 0xffff] for a in range (line, min (line + 8, addr + count))]
+        sys.stdout.write ('%04x: %s\n' % (line & 0xffff, ' '.join ('%04x' % w for w in words)))
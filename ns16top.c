@@ -0,0 +1,242 @@
+// Show the live statistics of every running psim and isim that was
+// started with --live-stats.  The statistics segments are mapped read
+// only, so watching a simulator doesn't slow it down.
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "simstats.h"
+
+#define SHM_DIR "/dev/shm"
+#define MAX_INSTANCES 256
+
+struct instance
+{
+  char name [64];
+  struct simstats *s;
+  bool seen;      // found in the latest scan
+  bool sampled;   // prev holds a sample
+  struct simstats_counters prev;
+  uint64_t prev_ns;
+} instance [MAX_INSTANCES];
+int instance_count = 0;
+
+struct instance *findInstance (char *name)
+{
+  int i;
+  int fd;
+  struct simstats *s;
+
+  for (i = 0; i < instance_count; i++)
+    if (strcmp (instance [i].name, name) == 0)
+      return & instance [i];
+  if (instance_count == MAX_INSTANCES)
+    return NULL;
+  fd = shm_open (name, O_RDONLY, 0);
+  if (fd < 0)
+    return NULL;
+  s = mmap (NULL, sizeof (struct simstats), PROT_READ, MAP_SHARED, fd, 0);
+  close (fd);
+  if (s == MAP_FAILED)
+    return NULL;
+  if ((s->magic != SIMSTATS_MAGIC) || (s->version != SIMSTATS_VERSION))
+    {
+      // not ready yet, or from an incompatible simulator
+      munmap (s, sizeof (struct simstats));
+      return NULL;
+    }
+  memset (& instance [instance_count], 0, sizeof (struct instance));
+  strncpy (instance [instance_count].name, name, sizeof (instance [0].name) - 1);
+  instance [instance_count].s = s;
+  return & instance [instance_count++];
+}
+
+void scan (void)
+{
+  DIR *d;
+  struct dirent *de;
+  struct instance *in;
+  char name [64];
+  int i;
+
+  for (i = 0; i < instance_count; i++)
+    instance [i].seen = false;
+  d = opendir (SHM_DIR);
+  if (! d)
+    {
+      fprintf (stderr, "can't read " SHM_DIR "\n");
+      exit (2);
+    }
+  while ((de = readdir (d)))
+    {
+      if ((strncmp (de->d_name, SIMSTATS_PREFIX, strlen (SIMSTATS_PREFIX)) != 0) ||
+	  (strlen (de->d_name) >= sizeof (name) - 1))
+	continue;
+      name [0] = '/';
+      strcpy (name + 1, de->d_name);
+      in = findInstance (name);
+      if (in)
+	in->seen = true;
+    }
+  closedir (d);
+
+  // forget simulators that have exited
+  for (i = 0; i < instance_count; )
+    {
+      if (instance [i].seen)
+	{
+	  i++;
+	  continue;
+	}
+      munmap (instance [i].s, sizeof (struct simstats));
+      instance [i] = instance [--instance_count];
+    }
+}
+
+void getWord (struct simstats *s, char *word)
+{
+  uint32_t seq;
+  int tries = 0;
+
+  do
+    {
+      seq = atomic_load_explicit (& s->word_seq, memory_order_acquire);
+      memcpy (word, s->word, SIMSTATS_WORD_SIZE);
+      atomic_thread_fence (memory_order_acquire);
+    }
+  while (((seq & 1) || (seq != atomic_load_explicit (& s->word_seq, memory_order_relaxed))) &&
+	 (++tries < 100));
+  word [SIMSTATS_WORD_SIZE - 1] = '\0';
+}
+
+double rate (uint64_t now, uint64_t prev, uint64_t ns)
+{
+  return ns ? (now - prev) * 1.0e9 / ns : 0.0;
+}
+
+void show (bool clear)
+{
+  int i;
+  struct instance *in;
+  struct simstats *s;
+  struct simstats_counters c;
+  uint64_t now;
+  uint64_t ns;
+  char word [SIMSTATS_WORD_SIZE];
+  const char *state;
+
+  if (clear)
+    printf ("\033[H\033[2J");
+  printf ("%7s %-4s %-7s %8s %8s %14s %14s %9s %9s %9s %9s %4s %s\n",
+	  "PID", "SIM", "STATE", "MIPS", "MCPS", "INSTRUCTIONS", "CYCLES",
+	  "BLK RD/S", "BLK WR/S", "CON IN", "CON OUT", "PC", "WORD");
+  for (i = 0; i < instance_count; i++)
+    {
+      in = & instance [i];
+      s = in->s;
+      now = simstatsNow ();
+      c.instructions = atomic_load_explicit (& s->instructions, memory_order_relaxed);
+      c.cycles = atomic_load_explicit (& s->cycles, memory_order_relaxed);
+      c.block_reads = atomic_load_explicit (& s->block_reads, memory_order_relaxed);
+      c.block_writes = atomic_load_explicit (& s->block_writes, memory_order_relaxed);
+      c.console_in = atomic_load_explicit (& s->console_in, memory_order_relaxed);
+      c.console_out = atomic_load_explicit (& s->console_out, memory_order_relaxed);
+      getWord (s, word);
+      if (! in->sampled)
+	{
+	  // no rates yet, so use the simulator's own measurement
+	  in->prev = c;
+	  in->prev_ns = now;
+	  in->sampled = true;
+	}
+      ns = now - in->prev_ns;
+
+      if (! atomic_load_explicit (& s->running, memory_order_relaxed))
+	state = "halted";
+      else if ((kill (s->pid, 0) < 0) && (errno == ESRCH))
+	state = "dead";
+      else if (now - atomic_load_explicit (& s->update_ns, memory_order_relaxed) > 1000000000ULL)
+	state = "waiting";  // usually for console input
+      else
+	state = "running";
+
+      printf ("%7d %-4.4s %-7s %8.2f %8.2f %14llu %14llu %9.1f %9.1f %9llu %9llu %04x %s\n",
+	      s->pid, s->sim, state,
+	      ns ? rate (c.instructions, in->prev.instructions, ns) / 1.0e6 :
+	        atomic_load_explicit (& s->ips, memory_order_relaxed) / 1.0e6,
+	      rate (c.cycles, in->prev.cycles, ns) / 1.0e6,
+	      (unsigned long long) c.instructions,
+	      (unsigned long long) c.cycles,
+	      rate (c.block_reads, in->prev.block_reads, ns),
+	      rate (c.block_writes, in->prev.block_writes, ns),
+	      (unsigned long long) c.console_in,
+	      (unsigned long long) c.console_out,
+	      atomic_load_explicit (& s->pc, memory_order_relaxed),
+	      word);
+      in->prev = c;
+      in->prev_ns = now;
+    }
+  if (! instance_count)
+    printf ("no simulators running with --live-stats\n");
+  fflush (stdout);
+}
+
+void usage (FILE *f)
+{
+  fprintf (f, "usage: ns16top [-d seconds] [-n iterations]\n");
+}
+
+int main (int argc, char *argv [])
+{
+  double delay = 1.0;
+  int iterations = 0;  // forever
+  int n;
+  bool clear = isatty (STDOUT_FILENO);
+  struct timespec ts;
+
+  while (--argc)
+    {
+      argv++;
+      if ((strcmp (argv [0], "-d") == 0) && (argc > 1))
+	{
+	  argc--;
+	  delay = atof ((++argv) [0]);
+	}
+      else if ((strcmp (argv [0], "-n") == 0) && (argc > 1))
+	{
+	  argc--;
+	  iterations = atoi ((++argv) [0]);
+	}
+      else
+	{
+	  usage (stderr);
+	  exit (1);
+	}
+    }
+  if (delay <= 0.0)
+    {
+      usage (stderr);
+      exit (1);
+    }
+
+  ts.tv_sec = (time_t) delay;
+  ts.tv_nsec = (long) ((delay - ts.tv_sec) * 1.0e9);
+  for (n = 0; (! iterations) || (n < iterations); n++)
+    {
+      if (n)
+	nanosleep (& ts, NULL);
+      scan ();
+      show (clear);
+    }
+  exit (0);
+}
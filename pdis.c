@@ -0,0 +1,232 @@
+// Copyright 2009 Eric Smith <eric@brouhaha.com>
+// All rights reserved.
+
+// PACE disassembler, shared by psim and the binary trace decoder
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "pdis.h"
+
+#define BYTE_MASK 0xff
+#define WORD_MASK 0xffff
+
+static int signExtend (int b)
+{
+  if ((b & 0x80) != 0)
+    return b | 0xff00;
+  else
+    return b & 0x00ff;
+}
+
+const char *boc_cond [16] =
+  {
+    [0x0] = "stack",
+    [0x1] = "zero",
+    [0x2] = "positive",
+    [0x3] = "bit0",
+    [0x4] = "bit1",
+    [0x5] = "nonzero",
+    [0x6] = "bit2",
+    [0x7] = "continue",
+    [0x8] = "link",
+    [0x9] = "ien",
+    [0xa] = "cy",
+    [0xb] = "negative",
+    [0xc] = "ov",
+    [0xd] = "jc13",
+    [0xe] = "jc14",
+    [0xf] = "jc15"
+  };
+
+void disassembleInstruction (int addr, int instruction, uint16_t *ac,
+			     bool base_page_split, char *buf)
+{
+  int inst1110 = (instruction >> 10) & 0x3;
+  int inst98 = (instruction >> 8) & 0x3;
+  int inst76 = (instruction >> 6) & 0x3;
+  int instLowByte = instruction & 0xff;
+  int count = instLowByte >> 1;
+  int ea = 0;
+  int target = (addr + 1 + signExtend (instruction & BYTE_MASK)) & WORD_MASK;
+
+  switch (inst98)
+    {
+    case 0:
+      if (base_page_split)
+	ea = signExtend (instLowByte);
+      else
+	ea = instLowByte;
+      break;
+    case 1:
+      ea = (addr + 1 + signExtend (instLowByte)) & WORD_MASK;
+      break;
+    case 2:
+    case 3:
+      ea = (ac [inst98] + signExtend (instLowByte)) & WORD_MASK;
+    }
+  
+  switch (instruction >> 10)
+    {
+    case 0x00:  // HALT
+      sprintf (buf, "HALT");
+      return;
+    case 0x01:  // CFR: copy flags to register
+      sprintf (buf, "CFR");
+      return;
+    case 0x02:  // CRF: copy register into flags
+      sprintf (buf, "CRF");
+      return;
+    case 0x03:  // PUSHF: push flags onto stack
+      sprintf (buf, "PUSHF");
+      return;
+    case 0x04:  // PULLF: pull stack into flags
+      sprintf (buf, "PULLF");
+      return;
+    case 0x05:  // JSR: jump to subroutine
+      sprintf (buf, "JSR %04x", ea);
+      return;
+    case 0x06:  // JMP
+      sprintf (buf, "JMP %04x", ea);
+      return;
+    case 0x07:  // XCHRS: exchange register and stack
+      sprintf (buf, "XCHRS %d", inst98);
+      return;
+    case 0x08:  // ROL: rotate left
+      sprintf (buf, "ROL %d,%d,%d", inst98, count, instruction & 1);
+      return;
+    case 0x09:  // ROR: rotate right
+      sprintf (buf, "ROR %d,%d,%d", inst98, count, instruction & 1);
+      return;
+    case 0x0a:  // SHL: shift left
+      sprintf (buf, "SHL %d,%d,%d", inst98, count, instruction & 1);
+      return;
+    case 0x0b:  // SHR: shift right
+      sprintf (buf, "SHR %d,%d,%d", inst98, count, instruction & 1);
+      return;
+    case 0x0c:
+    case 0x0d:
+    case 0x0e:
+    case 0x0f:
+      if ((instruction & 0x0080) != 0)
+	sprintf (buf, "SFLG %d", (instruction >> 8) & 0x0f);
+      else
+	sprintf (buf, "PFLG %d", (instruction >> 8) & 0x0f);
+      return;
+    case 0x10:
+    case 0x11:
+    case 0x12:
+    case 0x13:	// BOC:  branch on condition
+      sprintf (buf, "BOC %s %04x", boc_cond [(instruction >> 8) & 0xf], target);
+      return;
+    case 0x14:  // LI: load immediate
+      sprintf (buf, "LI %d,%04x", inst98, signExtend (instLowByte));
+      return;
+    case 0x15:  // RAND: register and
+      sprintf (buf, "RAND %d,%d", inst76, inst98);
+      return;
+    case 0x16:  // RXOR: register exclusive or
+      sprintf (buf, "RXOR %d,%d", inst76, inst98);
+      return;
+    case 0x17:  // RCPY: register copy
+      if ((inst98 == 0) && (inst76 == 0))
+	sprintf (buf, "NOP");
+      else
+	sprintf (buf, "RCPY %d,%d", inst76, inst98);
+      return;
+    case 0x18:  // PUSH: push register onto stack
+      sprintf (buf, "PUSH %d", inst98);
+      return;
+    case 0x19:  // PULL: pull stack into register
+      sprintf (buf, "PULL %d", inst98);
+      return;
+    case 0x1a:  // RADD: register add
+      sprintf (buf, "RADD %d,%d", inst76, inst98);
+      return;
+    case 0x1b:  // RXCH: register exchange
+      sprintf (buf, "RXCH %d,%d", inst76, inst98);
+      return;
+    case 0x1c:  // CAI: complement and add immediate
+      sprintf (buf, "CAI %d,%04x", inst98, signExtend (instLowByte));
+      return;
+    case 0x1d:  // RADC: register add with carry
+      sprintf (buf, "RADC %d,%d", inst76, inst98);
+      return;
+    case 0x1e:  // AISZ: add immediate, skip if zero
+      sprintf (buf, "AISZ %d,%04x", inst98, signExtend (instLowByte));
+      return;
+    case 0x1f:  // RTI: return from interrupt
+      sprintf (buf, "RTI %d", instLowByte);
+      return;
+    case 0x20:  // RTS: return from subroutine
+      sprintf (buf, "RTS %d", instLowByte);
+      return;
+    case 0x22:  // DECA: decimal add
+      sprintf (buf, "DECA %04x", ea);
+      return;
+    case 0x23:  // ISZ: increment and skip if zero
+      sprintf (buf, "ISZ %04x", ea);
+      return;
+    case 0x24:  // SUBB: subtract with borrow
+      sprintf (buf, "SUBB %04x", ea);
+      return;
+    case 0x25:  // JSR @: jump to subroutine indirect
+      sprintf (buf, "JSR @ %04x", ea);
+      return;
+    case 0x26:  // JMP @: jump indirect
+      sprintf (buf, "JMP @ %04x", ea);
+      return;
+    case 0x27:  // SKG: skip if greater
+      sprintf (buf, "SKG %04x", ea);
+      return;
+    case 0x28:  // LD @: load indirect
+      sprintf (buf, "LD @ %04x", ea);
+      return;
+    case 0x29:  // OR: logical or
+      sprintf (buf, "OR %04x", ea);
+      return;
+    case 0x2a:  // AND: logical and
+      sprintf (buf, "AND %04x", ea);
+      return;
+    case 0x2b:  // DSZ: decrement and skip if zero
+      sprintf (buf, "DSZ %04x", ea);
+      return;
+    case 0x2c:  // ST @: store indirect
+      sprintf (buf, "ST @ %04x", ea);
+      return;
+    case 0x2e:  // SKAZ: skip if AND is zero
+      sprintf (buf, "SKAZ %04x", ea);
+      return;
+    case 0x2f:  // LSEX: load with sign extend
+      sprintf (buf, "LSEX %04x", ea);
+      return;
+    case 0x30:
+    case 0x31:
+    case 0x32:
+    case 0x33:  // LD: load
+      sprintf (buf, "LD %d,%04x", inst1110, ea);
+      return;
+    case 0x34:
+    case 0x35:
+    case 0x36:
+    case 0x37:  // ST: store
+      sprintf (buf, "ST %d,%04x", inst1110, ea);
+      return;
+    case 0x38:
+    case 0x39:
+    case 0x3a:
+    case 0x3b:  // ADD
+      sprintf (buf, "ADD %d,%04x", inst1110, ea);
+      return;
+    case 0x3c:
+    case 0x3d:
+    case 0x3e:
+    case 0x3f:  // SKNE: skip if not equal
+      sprintf (buf, "SKNE %d,%04x", inst1110, ea);
+      return;
+    default:
+      sprintf (buf, "ill op %04x", instruction);
+      return;
+    }
+}
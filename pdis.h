@@ -0,0 +1,10 @@
+// Copyright 2009 Eric Smith <eric@brouhaha.com>
+// All rights reserved.
+
+extern const char *boc_cond [16];
+
+// Disassemble the instruction at addr into buf, which should have room
+// for at least 40 characters.  The accumulators are used to compute
+// indexed effective addresses.
+void disassembleInstruction (int addr, int instruction, uint16_t *ac,
+			     bool base_page_split, char *buf);
@@ -0,0 +1,48 @@
+// In-guest performance counters, shared by psim and isim
+
+#include <stdint.h>
+#include <string.h>
+
+#include "perfctr.h"
+#include "simstats.h"
+
+#define PERF_COUNTERS 3
+
+static uint64_t perf_base [PERF_COUNTERS];
+static uint64_t perf_latched [PERF_COUNTERS];
+
+static void perfRead (uint64_t *v, uint64_t instructions, uint64_t cycles)
+{
+  v [PERF_INSTRUCTIONS] = instructions - perf_base [PERF_INSTRUCTIONS];
+  v [PERF_CYCLES] = cycles - perf_base [PERF_CYCLES];
+  v [PERF_HOST_NS] = simstatsNow () - perf_base [PERF_HOST_NS];
+}
+
+uint32_t perfCounter (int function, uint64_t instructions, uint64_t cycles)
+{
+  uint64_t v [PERF_COUNTERS];
+  uint64_t result = 0;
+
+  switch (function)
+    {
+    case PERF_INSTRUCTIONS:
+    case PERF_CYCLES:
+    case PERF_HOST_NS:
+      perfRead (v, instructions, cycles);
+      result = v [function];
+      break;
+    case PERF_RESET:
+      memset (perf_base, 0, sizeof (perf_base));
+      perfRead (perf_base, instructions, cycles);
+      break;
+    case PERF_SNAPSHOT:
+      perfRead (perf_latched, instructions, cycles);
+      break;
+    case PERF_LATCHED + PERF_INSTRUCTIONS:
+    case PERF_LATCHED + PERF_CYCLES:
+    case PERF_LATCHED + PERF_HOST_NS:
+      result = perf_latched [function - PERF_LATCHED];
+      break;
+    }
+  return result;
+}
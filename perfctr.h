@@ -0,0 +1,14 @@
+// In-guest performance counters, for the PERF trap of psim and isim.
+// The guest selects a function in AC0, and gets the result back in AC0
+// (low) and AC1 (high).  Counts are relative to the last reset.
+
+#define PERF_INSTRUCTIONS 0x00
+#define PERF_CYCLES       0x01
+#define PERF_HOST_NS      0x02  // host monotonic time in nanoseconds
+#define PERF_RESET        0x03  // reset all counters
+#define PERF_SNAPSHOT     0x04  // latch all counters
+#define PERF_LATCHED      0x10  // plus one of the above, read latched value
+
+// Performs a function, given the simulator's instruction and cycle
+// counts, and returns its result, or 0 for a function with none.
+uint32_t perfCounter (int function, uint64_t instructions, uint64_t cycles);
@@ -6,22 +6,229 @@
 //  interrupts not supported
 //  decimal add (DECA) instruction not supported
 
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <termios.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 
-char *block_fn = "figforth_blocks";
-FILE *block_f;
+#include "blkdev.h"
+#include "blkdma.h"
+#include "btrace.h"
+#include "console.h"
+#include "figforth.h"
+#include "perfctr.h"
+#include "tstore.h"
+#include "guestview.h"
+#include "pdis.h"
+#include "simstats.h"
+
+// drive 0 is figforth_blocks unless --drive gives another file
+char *block_fn [BLKDEV_DRIVES] = { "figforth_blocks" };
+struct blkdev *block_dev [BLKDEV_DRIVES];
+int block_dma_depth = BLKDMA_DEFAULT_DEPTH;
+struct blkdma *block_queue;  // NULL if DMA transfers are done at once
+int block_dma_pending;       // transfers started but not finished
+#define BLOCK_DMA_POLL 256   // instructions between polls while pending
+struct blkdev_options block_options =
+  {
+    .cache_blocks = BLKDEV_DEFAULT_CACHE,
+    .prefetch_blocks = BLKDEV_DEFAULT_PREFETCH,
+  };
 
 FILE *trace_f = NULL;
 bool inst_trace = false;
 bool word_trace = false;
 
-uint16_t mem [65536];
+uint64_t inst_count = 0;  // instructions executed
+uint64_t cycle_count = 0;  // approximate microcycles executed
+uint64_t block_reads = 0;
+uint64_t block_writes = 0;
+uint64_t console_in_count = 0;
+uint64_t console_out_count = 0;
+uint64_t console_wait_ns = 0;  // host time blocked reading console input
+
+bool stats = false;
+char *stats_json_fn = NULL;
+
+bool live_stats_enabled = false;
+struct simstats *live_stats = NULL;
+
+#define NEXT_ADDR 0x010b  // FIG-Forth NEXT, where the next word is fetched
+#define JMP_THRU_W 0x9a00 // JMP @(W), used by NEXT and EXECUTE to enter a word
+
+int live_word = 0;  // W at the last JMP @(W), the word being executed
+
+// Tracing, by any of the above or the binary trace, can be started and
+// stopped by triggers, and limited to a set of instruction addresses.
+// The trace_wait_* variables hold the conditions of whichever trigger
+// is waiting to fire, or impossible values if there is none.
+enum trigger_kind { TRIG_NONE, TRIG_PC, TRIG_WRITE, TRIG_COUNT, TRIG_WORD };
+
+struct trigger
+{
+  enum trigger_kind kind;
+  uint64_t value;
+  char *word;
+} trace_start_trigger, trace_stop_trigger;
+
+uint64_t trace_window = 0;  // instructions to trace after start, if nonzero
+
+bool trace_output = false; // any of the above traces is being written
+bool tracing = true;       // trace the current instruction, if in filter
+bool trace_armed = false;  // a trigger is waiting to fire
+int trace_wait_pc = -1;
+int trace_wait_write = -1;
+uint64_t trace_wait_count = UINT64_MAX;
+char *trace_wait_word = NULL;
+uint8_t *trace_word_match;  // per-CFA match cache for trace_wait_word
+
+uint8_t trace_filter [65536 / 8];  // bitmap of instruction addresses to trace
+bool trace_filter_used = false;    // an include range has been given
+
+// Timeline of FIG-Forth word execution, in Chrome trace-event JSON
+// format, with one microsecond of timeline per instruction executed.
+#define FORTH_FORTH0 0x0016  // NFA of the top word in the dictionary, TASK
+#define FORTH_RP     0x0021  // return stack pointer
+#define MAX_TIMELINE_DEPTH 256
+
+char *timeline_fn = NULL;
+FILE *timeline_f = NULL;
+uint64_t timeline_budget = 1000000;  // maximum events to write
+uint64_t timeline_min = 0;           // minimum duration of word events
+uint64_t timeline_events = 0;
+uint64_t timeline_dropped = 0;
+int timeline_docol;                  // code address of colon definitions
+
+struct timeline_frame
+{
+  int cfa;
+  uint64_t start;
+  int rp;  // return stack pointer before the word was entered
+} timeline_stack [MAX_TIMELINE_DEPTH];
+int timeline_depth = 0;
+int timeline_prim_cfa = -1;  // primitive currently executing
+uint64_t timeline_prim_start;
+
+// Flight recorder: a ring of the machine state at the fetch of each of
+// the last flight_mask + 1 instructions, recorded by both cores and
+// written to flight_fn when the simulation stops.
+struct flight_entry
+{
+  uint16_t pc;
+  uint16_t inst;
+  uint16_t ac [4];
+  uint16_t flags;  // FL_CY, FL_LK, FL_OV, FL_BYTE
+  uint16_t sp;
+};
+
+#define FL_CY   0x01
+#define FL_LK   0x02
+#define FL_OV   0x04
+#define FL_BYTE 0x08
+
+#define FLIGHT_MAX_SIZE (1 << 24)  // instructions, 256 MiB of ring
+
+char *flight_fn = "psim.flight";
+uint32_t flight_size = 65536;
+struct flight_entry *flight_ring = NULL;
+uint32_t flight_mask;
+
+bool illegal_opcode = false;
+volatile sig_atomic_t interrupted = false;  // set by signal handlers
+
+// instrumentation, only done by the instrumented variant of the core
+bool instrumented = false;
+
+// binary instruction trace, see btrace.h
+#define BTRACE_BUF_SIZE (1 << 20)
+char *btrace_fn = NULL;
+FILE *btrace_f = NULL;
+uint8_t *btrace_buf;
+uint8_t *btrace_ptr;
+uint8_t *btrace_tag;      // tag byte of the record being written
+bool btrace_recording;    // the current instruction is being recorded
+uint16_t bt_pc;           // state as of the previous record
+uint16_t bt_ac [4];
+uint16_t bt_fr;
+uint16_t bt_write_addr;
+uint16_t *bt_inst;        // last instruction recorded at each address
+uint8_t *bt_inst_valid;
+
+// indexed trace store, see tstore.h
+#define TSTORE_WRITE_BUF 65536  // writes buffered before being written out
+char *tstore_dir = NULL;
+bool tstore_open = false;
+enum { TS_PC, TS_INST, TS_XR, TS_WTIME, TS_WADDR, TS_WVALUE, TS_WKIND,
+       TS_WPOST, TS_WLIST_ADDR, TS_WLIST_START, TS_INDEX, TS_FILES };
+FILE *tstore_f [TS_FILES];
+const char *tstore_file_name [TS_FILES] =
+  { "pc", "inst", "xr", "wtime", "waddr", "wvalue", "wkind",
+    "wpost", "wlist_addr", "wlist_start", "index" };
+struct tstore_header tstore_header;
+struct tstore_block tstore_block;
+uint16_t *tstore_pc;      // instruction columns of the current block
+uint16_t *tstore_inst;
+uint16_t *tstore_xr;
+uint64_t *tstore_wtime;   // buffered write columns
+uint16_t *tstore_waddr;
+uint16_t *tstore_wvalue;
+uint8_t *tstore_wkind;
+int tstore_write_count;
+uint16_t *tstore_block_waddr;   // addresses of the current block's writes
+uint32_t *tstore_post;          // and its posting lists
+uint32_t tstore_block_room;
+uint32_t *tstore_list_next;     // per address, while sorting
+uint16_t *tstore_list_addr;     // posting lists of the current block
+uint32_t *tstore_list_start;
+
+char *profile_fn = NULL;
+uint64_t *exec_count = NULL;  // per-address execution counts
+
+char *opstats_fn = NULL;
+bool op_stats = false;
+uint64_t op_count [64];       // executed instructions by opcode
+uint64_t op_skips [64];       // skips taken by opcode
+uint64_t mode_count [2] [4];  // memory references by [indirect] [mode]
+
+// Per-site branch statistics for BOC and skip instructions.  Each site
+// also has a two-bit saturating counter, to estimate how well a simple
+// dynamic predictor would do on it.
+char *branch_fn = NULL;
+uint64_t *branch_taken = NULL;
+uint64_t *branch_not_taken = NULL;
+uint64_t *branch_mispredicts = NULL;
+uint8_t *branch_predictor = NULL;
+
+char *heatmap_fn = NULL;
+uint64_t *mem_reads = NULL;   // per-address data read counts
+uint64_t *mem_writes = NULL;  // per-address data write counts
+
+// Write provenance: for every word of memory, what last wrote it, and
+// for instruction writes, the address and count of the instruction.
+enum { PROV_NONE, PROV_IMAGE, PROV_DISK, PROV_CONSOLE, PROV_FILE, PROV_INST };
+const char *prov_source_name [] = { "none", "image", "disk", "console", "file", "instruction" };
+char *provenance_fn = NULL;
+uint8_t *prov_source = NULL;
+uint16_t *prov_pc = NULL;
+uint64_t *prov_time = NULL;
+uint16_t prov_inst_addr;      // address of the instruction being executed
+
+uint16_t mem_array [65536];
+uint16_t *mem = mem_array;  // or guest memory in a shared guestview
+
+char *guest_view_name = NULL;
+struct guestview *guest_view = NULL;
 
 uint16_t ac [4];  // accumulators
 uint16_t pc;  // program counter
@@ -30,7 +237,7 @@ uint16_t pc;  // program counter
 int sp;  // index of top item on stack [0..stackSize-1], or -1 when empty
 uint16_t stack [STACK_SIZE];
 
-bool halt;
+volatile sig_atomic_t halt;  // set by signal handlers
 
 bool ov;
 bool cy;
@@ -265,32 +472,35 @@ void pulseFlag (int flag)
     }
 }
 
-#define STACK_LIMIT  0x1d8f
-
 void printStack (void)
 {
   int a;
 
-  if ((ac [3] < (STACK_LIMIT - 100)) || (ac [3] > STACK_LIMIT))
+  if ((ac [3] < (FORTH_S0 - FORTH_STACK_DEPTH)) || (ac [3] > FORTH_S0))
     return;
   fprintf (trace_f, "stack: ");
-  if (ac [3] >= STACK_LIMIT)
+  if (ac [3] >= FORTH_S0)
     {
       fprintf (trace_f, "empty ");
       return;
     }
-  for (a = STACK_LIMIT - 1; a >= ac [3]; a--)
+  for (a = FORTH_S0 - 1; a >= ac [3]; a--)
     {
       fprintf (trace_f, "%04x ", mem [a]);
     }
 }
 
-void printWordName (int addr)
+#define MAX_WORD_NAME 32
+
+// Get the name of the FIG-Forth word with the given code field address.
+// The name is truncated if the dictionary entry is not well formed.
+void getWordName (int addr, char *name)
 {
   int c;
   int b = 1;
+  int len = 0;
   addr -= 2;  // back up past PFA to last word of name
-  if ((mem [addr] & 0x8080) == 0x8080)
+  if ((mem [addr & WORD_MASK] & 0x8080) == 0x8080)
     {
       // short word, we're done
     }
@@ -301,16 +511,20 @@ void printWordName (int addr)
 	{
 	  addr --;
 	}
-      while ((mem [addr] & 0x8000) == 0);
+      while (((mem [addr & WORD_MASK] & 0x8000) == 0) &&
+	     (++len < MAX_WORD_NAME / 2));
     }
-  for (;;)
+  for (len = 0; len < MAX_WORD_NAME - 1; len++)
     {
-      c = mem [addr];
+      c = mem [addr & WORD_MASK];
       if (b == 0)
 	c >>= 8;
-      fprintf (trace_f, "%c", c & 0x7f);
+      name [len] = c & 0x7f;
       if ((c & 0x80) != 0)
-	break;
+	{
+	  len++;
+	  break;
+	}
       b++;
       if (b == 2)
 	{
@@ -318,283 +532,807 @@ void printWordName (int addr)
 	  b = 0;
 	}
     }
+  name [len] = '\0';
 }
 
-const char *boc_cond [16] =
+void printWordName (int addr)
+{
+  char name [MAX_WORD_NAME];
+
+  getWordName (addr, name);
+  fprintf (trace_f, "%s", name);
+}
+
+#define OP_MEMREF   0x01  // uses an effective address
+#define OP_INDIRECT 0x02  // effective address is indirect
+#define OP_SKIP     0x04  // conditionally skips the next instruction
+#define OP_BOC      0x08  // branch on condition
+#define OP_BRANCH   (OP_SKIP | OP_BOC)
+
+// indexed by the top six bits of the instruction; the cycle counts are
+// approximate execution times in microcycles, ignoring the extra time
+// taken by multiple bit shifts and by skips
+const struct opcode_info
+{
+  char *name;
+  int flags;
+  int cycles;
+} opcode_info [64] =
+  {
+    [0x00] = { "HALT", 0, 4 },
+    [0x01] = { "CFR", 0, 4 },
+    [0x02] = { "CRF", 0, 4 },
+    [0x03] = { "PUSHF", 0, 4 },
+    [0x04] = { "PULLF", 0, 5 },
+    [0x05] = { "JSR", OP_MEMREF, 5 },
+    [0x06] = { "JMP", OP_MEMREF, 4 },
+    [0x07] = { "XCHRS", 0, 5 },
+    [0x08] = { "ROL", 0, 5 },
+    [0x09] = { "ROR", 0, 5 },
+    [0x0a] = { "SHL", 0, 5 },
+    [0x0b] = { "SHR", 0, 5 },
+    [0x0c ... 0x0f] = { "SFLG/PFLG", 0, 4 },
+    [0x10 ... 0x13] = { "BOC", OP_BOC, 5 },
+    [0x14] = { "LI", 0, 4 },
+    [0x15] = { "RAND", 0, 4 },
+    [0x16] = { "RXOR", 0, 4 },
+    [0x17] = { "RCPY", 0, 4 },
+    [0x18] = { "PUSH", 0, 4 },
+    [0x19] = { "PULL", 0, 5 },
+    [0x1a] = { "RADD", 0, 4 },
+    [0x1b] = { "RXCH", 0, 4 },
+    [0x1c] = { "CAI", 0, 4 },
+    [0x1d] = { "RADC", 0, 4 },
+    [0x1e] = { "AISZ", OP_SKIP, 5 },
+    [0x1f] = { "RTI", 0, 6 },
+    [0x20] = { "RTS", 0, 5 },
+    [0x21] = { "ill op", 0, 4 },
+    [0x22] = { "DECA", OP_MEMREF, 6 },
+    [0x23] = { "ISZ", OP_MEMREF | OP_SKIP, 7 },
+    [0x24] = { "SUBB", OP_MEMREF, 5 },
+    [0x25] = { "JSR @", OP_MEMREF | OP_INDIRECT, 7 },
+    [0x26] = { "JMP @", OP_MEMREF | OP_INDIRECT, 6 },
+    [0x27] = { "SKG", OP_MEMREF | OP_SKIP, 6 },
+    [0x28] = { "LD @", OP_MEMREF | OP_INDIRECT, 6 },
+    [0x29] = { "OR", OP_MEMREF, 5 },
+    [0x2a] = { "AND", OP_MEMREF, 5 },
+    [0x2b] = { "DSZ", OP_MEMREF | OP_SKIP, 7 },
+    [0x2c] = { "ST @", OP_MEMREF | OP_INDIRECT, 6 },
+    [0x2d] = { "ill op", 0, 4 },
+    [0x2e] = { "SKAZ", OP_MEMREF | OP_SKIP, 6 },
+    [0x2f] = { "LSEX", OP_MEMREF, 5 },
+    [0x30 ... 0x33] = { "LD", OP_MEMREF, 4 },
+    [0x34 ... 0x37] = { "ST", OP_MEMREF, 4 },
+    [0x38 ... 0x3b] = { "ADD", OP_MEMREF, 4 },
+    [0x3c ... 0x3f] = { "SKNE", OP_MEMREF | OP_SKIP, 6 },
+  };
+
+const char *addr_mode_name [4] =
   {
-    [0x0] = "stack",
-    [0x1] = "zero",
-    [0x2] = "positive",
-    [0x3] = "bit0",
-    [0x4] = "bit1",
-    [0x5] = "nonzero",
-    [0x6] = "bit2",
-    [0x7] = "continue",
-    [0x8] = "link",
-    [0x9] = "ien",
-    [0xa] = "cy",
-    [0xb] = "negative",
-    [0xc] = "ov",
-    [0xd] = "jc13",
-    [0xe] = "jc14",
-    [0xf] = "jc15"
+    [0x0] = "base page",
+    [0x1] = "pc relative",
+    [0x2] = "ac2 indexed",
+    [0x3] = "ac3 indexed"
   };
 
-void disassembleInstruction (int addr, int instruction, char *buf)
+static inline void recordBranch (int addr, bool taken)
 {
-  int inst1110 = (instruction >> 10) & 0x3;
-  int inst98 = (instruction >> 8) & 0x3;
-  int inst76 = (instruction >> 6) & 0x3;
-  int instLowByte = instruction & 0xff;
-  int count = instLowByte >> 1;
-  int ea = 0;
-  int target = (addr + 1 + signExtend (instruction & BYTE_MASK)) & WORD_MASK;
+  uint8_t *p = & branch_predictor [addr];
 
-  switch (inst98)
+  if (taken)
     {
-    case 0:
-      if (base_page_split)
-	ea = signExtend (instLowByte);
-      else
-	ea = instLowByte;
-      break;
-    case 1:
-      ea = (addr + 1 + signExtend (instLowByte)) & WORD_MASK;
-      break;
-    case 2:
-    case 3:
-      ea = (ac [inst98] + signExtend (instLowByte)) & WORD_MASK;
+      branch_taken [addr]++;
+      if (*p < 2)
+	branch_mispredicts [addr]++;
+      if (*p < 3)
+	(*p)++;
     }
-  
-  switch (instruction >> 10)
+  else
     {
-    case 0x00:  // HALT
-      sprintf (buf, "HALT");
-      return;
-    case 0x01:  // CFR: copy flags to register
-      sprintf (buf, "CFR");
-      return;
-    case 0x02:  // CRF: copy register into flags
-      sprintf (buf, "CRF");
-      return;
-    case 0x03:  // PUSHF: push flags onto stack
-      sprintf (buf, "PUSHF");
-      return;
-    case 0x04:  // PULLF: pull stack into flags
-      sprintf (buf, "PULLF");
-      return;
-    case 0x05:  // JSR: jump to subroutine
-      sprintf (buf, "JSR %04x", ea);
-      return;
-    case 0x06:  // JMP
-      sprintf (buf, "JMP %04x", ea);
-      return;
-    case 0x07:  // XCHRS: exchange register and stack
-      sprintf (buf, "XCHRS %d", inst98);
-      return;
-    case 0x08:  // ROL: rotate left
-      sprintf (buf, "ROL %d,%d,%d", inst98, count, instruction & 1);
-      return;
-    case 0x09:  // ROR: rotate right
-      sprintf (buf, "ROR %d,%d,%d", inst98, count, instruction & 1);
-      return;
-    case 0x0a:  // SHL: shift left
-      sprintf (buf, "SHL %d,%d,%d", inst98, count, instruction & 1);
-      return;
-    case 0x0b:  // SHR: shift right
-      sprintf (buf, "SHR %d,%d,%d", inst98, count, instruction & 1);
-      return;
-    case 0x0c:
-    case 0x0d:
-    case 0x0e:
-    case 0x0f:
-      if ((instruction & 0x0080) != 0)
-	sprintf (buf, "SFLG %d", (instruction >> 8) & 0x0f);
-      else
-	sprintf (buf, "PFLG %d", (instruction >> 8) & 0x0f);
-      return;
-    case 0x10:
-    case 0x11:
-    case 0x12:
-    case 0x13:	// BOC:  branch on condition
-      sprintf (buf, "BOC %s %04x", boc_cond [(instruction >> 8) & 0xf], target);
-      return;
-    case 0x14:  // LI: load immediate
-      sprintf (buf, "LI %d,%04x", inst98, signExtend (instLowByte));
-      return;
-    case 0x15:  // RAND: register and
-      sprintf (buf, "RAND %d,%d", inst76, inst98);
-      return;
-    case 0x16:  // RXOR: register exclusive or
-      sprintf (buf, "RXOR %d,%d", inst76, inst98);
-      return;
-    case 0x17:  // RCPY: register copy
-      if ((inst98 == 0) && (inst76 == 0))
-	sprintf (buf, "NOP");
-      else
-	sprintf (buf, "RCPY %d,%d", inst76, inst98);
-      return;
-    case 0x18:  // PUSH: push register onto stack
-      sprintf (buf, "PUSH %d", inst98);
-      return;
-    case 0x19:  // PULL: pull stack into register
-      sprintf (buf, "PULL %d", inst98);
-      return;
-    case 0x1a:  // RADD: register add
-      sprintf (buf, "RADD %d,%d", inst76, inst98);
-      return;
-    case 0x1b:  // RXCH: register exchange
-      sprintf (buf, "RXCH %d,%d", inst76, inst98);
-      return;
-    case 0x1c:  // CAI: complement and add immediate
-      sprintf (buf, "CAI %d,%04x", inst98, signExtend (instLowByte));
-      return;
-    case 0x1d:  // RADC: register add with carry
-      sprintf (buf, "RADC %d,%d", inst76, inst98);
-      return;
-    case 0x1e:  // AISZ: add immediate, skip if zero
-      sprintf (buf, "AISZ %d,%04x", inst98, signExtend (instLowByte));
-      return;
-    case 0x1f:  // RTI: return from interrupt
-      sprintf (buf, "RTI %d", instLowByte);
-      return;
-    case 0x20:  // RTS: return from subroutine
-      sprintf (buf, "RTS %d", instLowByte);
-      return;
-    case 0x22:  // DECA: decimal add
-      sprintf (buf, "DECA %04x", ea);
-      return;
-    case 0x23:  // ISZ: increment and skip if zero
-      sprintf (buf, "ISZ %04x", ea);
-      return;
-    case 0x24:  // SUBB: subtract with borrow
-      sprintf (buf, "SUBB %04x", ea);
-      return;
-    case 0x25:  // JSR @: jump to subroutine indirect
-      sprintf (buf, "JSR @ %04x", ea);
-      return;
-    case 0x26:  // JMP @: jump indirect
-      sprintf (buf, "JMP @ %04x", ea);
-      return;
-    case 0x27:  // SKG: skip if greater
-      sprintf (buf, "SKG %04x", ea);
-      return;
-    case 0x28:  // LD @: load indirect
-      sprintf (buf, "LD @ %04x", ea);
-      return;
-    case 0x29:  // OR: logical or
-      sprintf (buf, "OR %04x", ea);
-      return;
-    case 0x2a:  // AND: logical and
-      sprintf (buf, "AND %04x", ea);
-      return;
-    case 0x2b:  // DSZ: decrement and skip if zero
-      sprintf (buf, "DSZ %04x", ea);
-      return;
-    case 0x2c:  // ST @: store indirect
-      sprintf (buf, "ST @ %04x", ea);
-      return;
-    case 0x2e:  // SKAZ: skip if AND is zero
-      sprintf (buf, "SKAZ %04x", ea);
-      return;
-    case 0x2f:  // LSEX: load with sign extend
-      sprintf (buf, "LSEX %04x", ea);
-      return;
-    case 0x30:
-    case 0x31:
-    case 0x32:
-    case 0x33:  // LD: load
-      sprintf (buf, "LD %d,%04x", inst1110, ea);
-      return;
-    case 0x34:
-    case 0x35:
-    case 0x36:
-    case 0x37:  // ST: store
-      sprintf (buf, "ST %d,%04x", inst1110, ea);
-      return;
-    case 0x38:
-    case 0x39:
-    case 0x3a:
-    case 0x3b:  // ADD
-      sprintf (buf, "ADD %d,%04x", inst1110, ea);
-      return;
-    case 0x3c:
-    case 0x3d:
-    case 0x3e:
-    case 0x3f:  // SKNE: skip if not equal
-      sprintf (buf, "SKNE %d,%04x", inst1110, ea);
-      return;
-    default:
-      sprintf (buf, "ill op %04x", instruction);
-      return;
+      branch_not_taken [addr]++;
+      if (*p >= 2)
+	branch_mispredicts [addr]++;
+      if (*p > 0)
+	(*p)--;
     }
 }
 
-void executeInstruction ()
+void btraceFlush (void)
 {
-  // temporaries
-  int instruction;
-  int inst1110;
-  int inst98;
-  int inst76;
-  int instLowByte;
-  int count;
-  int ea = 0;
-  bool condition = false;
-  int temp;
-  
-  if (halt)
-    return;
-  instruction = mem [pc];
-  if (inst_trace)
+  fwrite (btrace_buf, 1, btrace_ptr - btrace_buf, btrace_f);
+  btrace_ptr = btrace_buf;
+}
+
+void btraceOpen (char *fn)
+{
+  btrace_f = fopen (fn, "wb");
+  if (! btrace_f)
     {
-      char buf [80];
-      int i;
+      fprintf (stderr, "can't create trace file '%s'\n", fn);
+      exit (2);
+    }
+  btrace_buf = malloc (BTRACE_BUF_SIZE);
+  btrace_ptr = btrace_buf;
+  bt_inst = calloc (65536, sizeof (uint16_t));
+  bt_inst_valid = calloc (65536, sizeof (uint8_t));
+  fwrite (BTRACE_MAGIC, 1, strlen (BTRACE_MAGIC), btrace_f);
+}
 
-      printStack ();
-      fprintf (trace_f, "\n");
-      for (i = 0; i < 4; i++)
-	fprintf (trace_f, "AC%d=%04x ", i, ac [i]);
-      fprintf (trace_f, "%s %s ",
-	       cy ? "cy" : "  ",
-	       lk ? "link" : "    ");
-      disassembleInstruction (pc, instruction, buf);
-      fprintf (trace_f, "PC=%04x, instruction=%04x: %s\n", pc, instruction, buf);
+void btraceClose (void)
+{
+  btraceFlush ();
+  fclose (btrace_f);
+  btrace_f = NULL;
+}
+
+static inline void btraceFetch (int addr, int instruction)
+{
+  uint8_t *p;
+  int tag = 0;
+  int mask = 0;
+  int fr = getFR ();
+  int i;
+
+  if (btrace_ptr + BT_MAX_RECORD > btrace_buf + BTRACE_BUF_SIZE)
+    btraceFlush ();
+  btrace_tag = btrace_ptr;
+  p = btrace_ptr + 1;
+  if (addr != ((bt_pc + 1) & WORD_MASK))
+    {
+      tag |= BT_PC;
+      p = btPutSigned (p, (int16_t) (addr - bt_pc - 1));
     }
-  if ((word_trace) && (pc == 0x010b))
+  bt_pc = addr;
+  if ((! bt_inst_valid [addr]) || (bt_inst [addr] != instruction))
     {
-      if (! inst_trace)
-	printStack ();
-      fprintf (trace_f,"\n");
-      fprintf (trace_f,"executing word at %04x: %04x ", ac [2], mem [ac [2]]);
-      printWordName (mem [ac [2]]);
-      fprintf (trace_f,"\n");
+      tag |= BT_INST;
+      p = btPutWord (p, instruction);
+      bt_inst [addr] = instruction;
+      bt_inst_valid [addr] = 1;
     }
-  pc = (pc + 1) & WORD_MASK;
+  for (i = 0; i < 4; i++)
+    if (ac [i] != bt_ac [i])
+      mask |= BT_REG_AC0 << i;
+  if (fr != bt_fr)
+    mask |= BT_REG_FR;
+  if (mask)
+    {
+      tag |= BT_REGS;
+      *p++ = mask;
+      for (i = 0; i < 4; i++)
+	if (mask & (BT_REG_AC0 << i))
+	  p = btPutWord (p, bt_ac [i] = ac [i]);
+      if (mask & BT_REG_FR)
+	p = btPutWord (p, bt_fr = fr);
+    }
+  *btrace_tag = tag;
+  btrace_ptr = p;
+  btrace_recording = true;
+}
 
-  inst1110 =  (instruction >> 10) & 0x03;
-  inst98 = (instruction >> 8) & 0x03;
-  inst76 = (instruction >> 6) & 0x03;
-  instLowByte = instruction & BYTE_MASK;
-  count = instLowByte >> 1;
+// Writes by instructions that aren't being recorded still go in the
+// trace, as records of their own, so that the decoder's memory is right.
+static inline void btraceWrite (int addr, int value)
+{
+  uint8_t *p;
 
-  switch (inst98)
+  if (! btrace_recording)
     {
-    case 0:
-      if (base_page_split)
-	ea = signExtend (instLowByte);
-      else
-	ea = instLowByte;
-      break;
-    case 1:
-      ea = (pc + signExtend (instLowByte)) & WORD_MASK;
-      break;
-    case 2:
-    case 3:
-      ea = (ac [inst98] + signExtend (instLowByte)) & WORD_MASK;
+      if (btrace_ptr + 1 + 3 + 2 > btrace_buf + BTRACE_BUF_SIZE)
+	btraceFlush ();
+      *btrace_ptr++ = BT_WRITE;
     }
+  p = btrace_ptr;
+  p = btPutSigned (p, (int16_t) (addr - bt_write_addr));
+  p = btPutWord (p, value);
+  bt_write_addr = addr;
+  if (btrace_recording)
+    *btrace_tag |= BT_MEMW;
+  btrace_ptr = p;
+}
 
-  switch (instruction >> 10)
+// record memory written by the host on behalf of the guest
+void btraceHostWrite (int addr, int count)
+{
+  int i;
+
+  if (btrace_ptr + 7 + 2 * count > btrace_buf + BTRACE_BUF_SIZE)
+    btraceFlush ();
+  *btrace_ptr++ = BT_HOSTW;
+  btrace_ptr = btPutVarint (btrace_ptr, addr);
+  btrace_ptr = btPutVarint (btrace_ptr, count);
+  for (i = 0; i < count; i++)
+    btrace_ptr = btPutWord (btrace_ptr, mem [(addr + i) & WORD_MASK]);
+}
+
+void tstoreWriteHeader (void)
+{
+  uint8_t buf [TS_HEADER_SIZE];
+
+  tsHeaderEncode (& tstore_header, buf);
+  fwrite (buf, sizeof (buf), 1, tstore_f [TS_INDEX]);
+}
+
+void tstoreOpen (char *dir)
+{
+  char fn [PATH_MAX];
+  int i;
+
+  if ((mkdir (dir, 0777) < 0) && (errno != EEXIST))
+    {
+      fprintf (stderr, "can't create trace store directory '%s'\n", dir);
+      exit (2);
+    }
+  for (i = 0; i < TS_FILES; i++)
+    {
+      snprintf (fn, sizeof (fn), "%s/%s", dir, tstore_file_name [i]);
+      tstore_f [i] = fopen (fn, "wb");
+      if (! tstore_f [i])
+	{
+	  fprintf (stderr, "can't create trace store file '%s'\n", fn);
+	  exit (2);
+	}
+    }
+  tstore_pc = malloc (TS_BLOCK_SIZE * sizeof (uint16_t));
+  tstore_inst = malloc (TS_BLOCK_SIZE * sizeof (uint16_t));
+  tstore_xr = malloc (TS_BLOCK_SIZE * sizeof (uint16_t));
+  tstore_wtime = malloc (TSTORE_WRITE_BUF * sizeof (uint64_t));
+  tstore_waddr = malloc (TSTORE_WRITE_BUF * sizeof (uint16_t));
+  tstore_wvalue = malloc (TSTORE_WRITE_BUF * sizeof (uint16_t));
+  tstore_wkind = malloc (TSTORE_WRITE_BUF * sizeof (uint8_t));
+  tstore_list_next = malloc (65536 * sizeof (uint32_t));
+  tstore_list_addr = malloc (65536 * sizeof (uint16_t));
+  tstore_list_start = malloc (65536 * sizeof (uint32_t));
+  memcpy (tstore_header.magic, TSTORE_MAGIC, sizeof (tstore_header.magic));
+  tstore_header.block_shift = TS_BLOCK_SHIFT;
+  // rewritten with the totals when the store is closed
+  tstoreWriteHeader ();
+  tstore_open = true;
+}
+
+// write n values of the given size to a column file, little-endian
+void tstorePutColumn (int file, const void *v, int size, uint64_t n)
+{
+  uint8_t buf [4096];
+  uint64_t i;
+  int k = 0;
+
+  for (i = 0; i < n; i++)
+    {
+      switch (size)
+	{
+	case 2: tsPut16 (buf + k, ((const uint16_t *) v) [i]); break;
+	case 4: tsPut32 (buf + k, ((const uint32_t *) v) [i]); break;
+	case 8: tsPut64 (buf + k, ((const uint64_t *) v) [i]); break;
+	}
+      k += size;
+      if (k == sizeof (buf))
+	{
+	  fwrite (buf, 1, k, tstore_f [file]);
+	  k = 0;
+	}
+    }
+  fwrite (buf, 1, k, tstore_f [file]);
+}
+
+void tstoreFlushWrites (void)
+{
+  int n = tstore_write_count;
+
+  tstorePutColumn (TS_WTIME, tstore_wtime, sizeof (uint64_t), n);
+  tstorePutColumn (TS_WADDR, tstore_waddr, sizeof (uint16_t), n);
+  tstorePutColumn (TS_WVALUE, tstore_wvalue, sizeof (uint16_t), n);
+  fwrite (tstore_wkind, sizeof (uint8_t), n, tstore_f [TS_WKIND]);
+  tstore_write_count = 0;
+}
+
+void tstoreGrowBlock (void)
+{
+  tstore_block_room = tstore_block_room ? 2 * tstore_block_room : 65536;
+  tstore_block_waddr = realloc (tstore_block_waddr, tstore_block_room * sizeof (uint16_t));
+  tstore_post = realloc (tstore_post, tstore_block_room * sizeof (uint32_t));
+  if (! tstore_block_waddr || ! tstore_post)
+    {
+      fprintf (stderr, "out of memory for the trace store\n");
+      exit (2);
+    }
+}
+
+// Writes the current block's posting lists: its writes, counting sorted
+// on address, so that each address's writes stay in time order.
+void tstoreWriteLists (void)
+{
+  struct tstore_block *b = & tstore_block;
+  uint32_t start = 0;
+  uint32_t count;
+  uint32_t i;
+  int a;
+
+  memset (tstore_list_next, 0, 65536 * sizeof (uint32_t));
+  for (i = 0; i < b->writes; i++)
+    tstore_list_next [tstore_block_waddr [i]]++;
+  for (a = 0; a < 65536; a++)
+    if (tstore_list_next [a])
+      {
+	tstore_list_addr [b->lists] = a;
+	tstore_list_start [b->lists] = start;
+	b->lists++;
+	count = tstore_list_next [a];
+	tstore_list_next [a] = start;
+	start += count;
+      }
+  for (i = 0; i < b->writes; i++)
+    tstore_post [tstore_list_next [tstore_block_waddr [i]]++] = i;
+  tstorePutColumn (TS_WPOST, tstore_post, sizeof (uint32_t), b->writes);
+  tstorePutColumn (TS_WLIST_ADDR, tstore_list_addr, sizeof (uint16_t), b->lists);
+  tstorePutColumn (TS_WLIST_START, tstore_list_start, sizeof (uint32_t), b->lists);
+}
+
+void tstoreEndBlock (void)
+{
+  static uint8_t buf [TS_BLOCK_RECORD_SIZE];
+  struct tstore_block *b = & tstore_block;
+  int n = b->instructions;
+  uint64_t first_list;
+
+  tstorePutColumn (TS_PC, tstore_pc, sizeof (uint16_t), n);
+  tstorePutColumn (TS_INST, tstore_inst, sizeof (uint16_t), n);
+  tstorePutColumn (TS_XR, tstore_xr, sizeof (uint16_t), n);
+  tstoreWriteLists ();
+  tsBlockEncode (b, buf);
+  fwrite (buf, sizeof (buf), 1, tstore_f [TS_INDEX]);
+  tstore_header.block_count++;
+  tstore_header.instructions += n;
+  tstore_header.writes += b->writes;
+  first_list = b->first_list + b->lists;
+  memset (b, 0, sizeof (*b));
+  b->first_write = tstore_header.writes;
+  b->first_list = first_list;
+}
+
+void tstoreClose (void)
+{
+  int i;
+
+  tstoreEndBlock ();
+  tstoreFlushWrites ();
+  fseek (tstore_f [TS_INDEX], 0, SEEK_SET);
+  tstoreWriteHeader ();
+  for (i = 0; i < TS_FILES; i++)
+    fclose (tstore_f [i]);
+  tstore_open = false;
+}
+
+static inline void tstoreFetch (int addr, int instruction)
+{
+  struct tstore_block *b = & tstore_block;
+  int mode = (instruction >> 8) & 3;
+
+  if (b->instructions == TS_BLOCK_SIZE)
+    tstoreEndBlock ();
+  tstore_pc [b->instructions] = addr;
+  tstore_inst [b->instructions] = instruction;
+  tstore_xr [b->instructions] = (mode >= 2) ? ac [mode] : 0;
+  b->instructions++;
+  tsMapSet (b->pc_map, addr);
+}
+
+static inline void tstoreWrite (int addr, int value, int kind)
+{
+  struct tstore_block *b = & tstore_block;
+
+  if (tstore_write_count == TSTORE_WRITE_BUF)
+    tstoreFlushWrites ();
+  tstore_wtime [tstore_write_count] = inst_count;
+  tstore_waddr [tstore_write_count] = addr;
+  tstore_wvalue [tstore_write_count] = value;
+  tstore_wkind [tstore_write_count] = kind;
+  tstore_write_count++;
+  if (b->writes == tstore_block_room)
+    tstoreGrowBlock ();
+  tstore_block_waddr [b->writes] = addr;
+  b->writes++;
+  tsMapSet (b->write_map, addr);
+}
+
+// record memory written by the host on behalf of the guest
+void tstoreHostWrite (int addr, int count)
+{
+  int i;
+
+  for (i = 0; i < count; i++)
+    tstoreWrite ((addr + i) & WORD_MASK, mem [(addr + i) & WORD_MASK], TS_WRITE_HOST);
+}
+
+// set the trace_wait_* conditions for a trigger
+void armTrigger (struct trigger *t)
+{
+  trace_wait_pc = -1;
+  trace_wait_write = -1;
+  trace_wait_count = UINT64_MAX;
+  trace_wait_word = NULL;
+  switch (t->kind)
+    {
+    case TRIG_NONE:   break;
+    case TRIG_PC:     trace_wait_pc = t->value;  break;
+    case TRIG_WRITE:  trace_wait_write = t->value;  break;
+    case TRIG_COUNT:  trace_wait_count = t->value;  break;
+    case TRIG_WORD:
+      trace_wait_word = t->word;
+      memset (trace_word_match, 0, 65536);
+      break;
+    }
+  trace_armed = (t->kind != TRIG_NONE);
+}
+
+// The start trigger is rearmed when tracing stops, so that e.g. every
+// call of a routine can be traced, unless it is an instruction count.
+void traceTrigger (void)
+{
+  tracing = ! tracing;
+  if (tracing)
+    {
+      armTrigger (& trace_stop_trigger);
+      if (trace_window)
+	{
+	  trace_wait_count = inst_count + trace_window;
+	  trace_armed = true;
+	}
+    }
+  else if (trace_start_trigger.kind != TRIG_COUNT)
+    armTrigger (& trace_start_trigger);
+  else
+    armTrigger (& (struct trigger) { TRIG_NONE, 0, NULL });
+}
+
+// Does the word with the given code field address have the name being
+// waited for?  Names are only compared the first time each CFA is seen.
+static inline bool traceWordMatch (int cfa)
+{
+  char name [MAX_WORD_NAME];
+
+  if (! trace_word_match [cfa])
+    {
+      getWordName (cfa, name);
+      trace_word_match [cfa] = (strcmp (name, trace_wait_word) == 0) ? 2 : 1;
+    }
+  return trace_word_match [cfa] == 2;
+}
+
+void traceInstruction (int instruction)
+{
+  if (inst_trace)
+    {
+      char buf [80];
+      int i;
+
+      printStack ();
+      fprintf (trace_f, "\n");
+      for (i = 0; i < 4; i++)
+	fprintf (trace_f, "AC%d=%04x ", i, ac [i]);
+      fprintf (trace_f, "%s %s ",
+	       cy ? "cy" : "  ",
+	       lk ? "link" : "    ");
+      disassembleInstruction (pc, instruction, ac, base_page_split, buf);
+      fprintf (trace_f, "PC=%04x, instruction=%04x: %s\n", pc, instruction, buf);
+    }
+  if ((word_trace) && (pc == NEXT_ADDR))
+    {
+      if (! inst_trace)
+	printStack ();
+      fprintf (trace_f,"\n");
+      fprintf (trace_f,"executing word at %04x: %04x ", ac [2], mem [ac [2]]);
+      printWordName (mem [ac [2]]);
+      fprintf (trace_f,"\n");
+    }
+  if (btrace_f)
+    btraceFetch (pc, instruction);
+}
+
+// parse a trigger of the form pc=addr, write=addr, count=n, or word=name
+void parseTrigger (char *s, struct trigger *t)
+{
+  char *value = strchr (s, '=');
+  char *end;
+
+  if (! value)
+    goto bad;
+  value++;
+  if (strncmp (s, "word=", 5) == 0)
+    {
+      t->kind = TRIG_WORD;
+      t->word = value;
+      return;
+    }
+  if (strncmp (s, "pc=", 3) == 0)
+    t->kind = TRIG_PC;
+  else if (strncmp (s, "write=", 6) == 0)
+    t->kind = TRIG_WRITE;
+  else if (strncmp (s, "count=", 6) == 0)
+    t->kind = TRIG_COUNT;
+  else
+    goto bad;
+  t->value = strtoull (value, & end, (t->kind == TRIG_COUNT) ? 0 : 16);
+  if (*end || (*value == '\0') ||
+      ((t->kind != TRIG_COUNT) && (t->value > WORD_MASK)))
+    goto bad;
+  return;
+
+ bad:
+  fprintf (stderr, "malformed trigger '%s'\n", s);
+  exit (1);
+}
+
+// parse an address range of the form first-last, and set or clear it
+// in the trace filter
+void traceFilterRange (char *s, bool include)
+{
+  unsigned int first, last;
+  char extra;
+  unsigned int addr;
+
+  if ((sscanf (s, "%x-%x%c", & first, & last, & extra) != 2) ||
+      (first > last) || (last > WORD_MASK))
+    {
+      fprintf (stderr, "malformed address range '%s'\n", s);
+      exit (1);
+    }
+  if (include && ! trace_filter_used)
+    {
+      memset (trace_filter, 0, sizeof (trace_filter));
+      trace_filter_used = true;
+    }
+  for (addr = first; addr <= last; addr++)
+    {
+      if (include)
+	trace_filter [addr >> 3] |= 1 << (addr & 7);
+      else
+	trace_filter [addr >> 3] &= ~ (1 << (addr & 7));
+    }
+}
+
+void timelineOpen (char *fn)
+{
+  timeline_f = fopen (fn, "w");
+  if (! timeline_f)
+    {
+      fprintf (stderr, "can't create timeline file '%s'\n", fn);
+      exit (2);
+    }
+  setvbuf (timeline_f, NULL, _IOFBF, 1 << 20);
+  fprintf (timeline_f, "{\"traceEvents\":[\n");
+  fprintf (timeline_f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"psim\"}},\n");
+  fprintf (timeline_f, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"FIG-Forth\"}}");
+}
+
+// Must be called after the image is loaded.  TASK, the top word of the
+// initial dictionary, is a colon definition, so its code field gives
+// the address of DOCOL.
+void timelineStart (void)
+{
+  timeline_docol = mem [mem [FORTH_FORTH0] + 4];
+}
+
+bool timelineEvent (void)
+{
+  if (timeline_events >= timeline_budget)
+    {
+      timeline_dropped++;
+      return false;
+    }
+  timeline_events++;
+  fprintf (timeline_f, ",\n");
+  return true;
+}
+
+void timelineWord (int cfa, uint64_t start)
+{
+  char name [MAX_WORD_NAME];
+  char *p;
+
+  if (inst_count - start < timeline_min)
+    return;
+  if (! timelineEvent ())
+    return;
+  getWordName (cfa, name);
+  fprintf (timeline_f, "{\"name\":\"");
+  for (p = name; *p; p++)
+    {
+      if ((*p == '"') || (*p == '\\'))
+	fputc ('\\', timeline_f);
+      if (*p >= ' ')
+	fputc (*p, timeline_f);
+    }
+  fprintf (timeline_f, "\",\"ph\":\"X\",\"ts\":%" PRIu64 ",\"dur\":%" PRIu64 ",\"pid\":1,\"tid\":1}",
+	   start, inst_count - start);
+}
+
+void timelineInstant (char *name, char *arg1, int value1, char *arg2, int value2)
+{
+  if (! timelineEvent ())
+    return;
+  fprintf (timeline_f, "{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%" PRIu64 ",\"pid\":1,\"tid\":1,\"args\":{\"%s\":%d",
+	   name, inst_count, arg1, value1);
+  if (arg2)
+    fprintf (timeline_f, ",\"%s\":%d", arg2, value2);
+  fprintf (timeline_f, "}}");
+}
+
+// Called when a word is entered, with the word's code field address.
+// A colon definition pushes one word onto the return stack; it has
+// returned once the return stack pointer is back above that, which also
+// covers words that leave by discarding their return address, and QUIT
+// resetting the return stack.  Primitives end when the next word is
+// entered.
+void timelineWordEntry (int cfa)
+{
+  int rp = mem [FORTH_RP];
+
+  if (timeline_prim_cfa >= 0)
+    {
+      timelineWord (timeline_prim_cfa, timeline_prim_start);
+      timeline_prim_cfa = -1;
+    }
+  while (timeline_depth && (rp >= timeline_stack [timeline_depth - 1].rp))
+    {
+      timeline_depth--;
+      timelineWord (timeline_stack [timeline_depth].cfa,
+		    timeline_stack [timeline_depth].start);
+    }
+  if (mem [cfa] != timeline_docol)
+    {
+      timeline_prim_cfa = cfa;
+      timeline_prim_start = inst_count;
+    }
+  else if (timeline_depth < MAX_TIMELINE_DEPTH)
+    {
+      timeline_stack [timeline_depth].cfa = cfa;
+      timeline_stack [timeline_depth].start = inst_count;
+      timeline_stack [timeline_depth].rp = rp;
+      timeline_depth++;
+    }
+}
+
+void timelineClose (void)
+{
+  if (timeline_prim_cfa >= 0)
+    timelineWord (timeline_prim_cfa, timeline_prim_start);
+  while (timeline_depth--)
+    timelineWord (timeline_stack [timeline_depth].cfa,
+		  timeline_stack [timeline_depth].start);
+  fprintf (timeline_f, "\n],\"displayTimeUnit\":\"ns\",\"otherData\":{\"time_unit\":\"instructions\",\"dropped_events\":%" PRIu64 "}}\n",
+	   timeline_dropped);
+  fclose (timeline_f);
+  if (timeline_dropped)
+    fprintf (stderr, "timeline event budget exceeded, %" PRIu64 " events dropped\n",
+	     timeline_dropped);
+}
+
+// When the lockstep checker is running, each engine keeps a rolling hash
+// of the memory writes it makes.
+bool checking = false;
+uint64_t write_hash;
+
+static inline void hashWrite (int addr, int value)
+{
+  write_hash = (write_hash ^ (((uint64_t) addr << 16) | value)) * 0x100000001b3ULL;
+}
+
+// Data memory accesses by the core go through readMem() and writeMem(),
+// so that the instrumented variant can count them.  Instruction fetches
+// are not counted, as they are covered by the execution counts.
+static inline __attribute__ ((always_inline)) int readMem (bool hooks, int addr)
+{
+  if (hooks && mem_reads)
+    mem_reads [addr]++;
+  return mem [addr];
+}
+
+static inline void provenance (int addr, int source, int from)
+{
+  prov_source [addr] = source;
+  prov_pc [addr] = from;
+  prov_time [addr] = inst_count;
+}
+
+static inline __attribute__ ((always_inline)) void writeMem (bool hooks, int addr, int value)
+{
+  if (hooks && mem_writes)
+    mem_writes [addr]++;
+  if (hooks && btrace_f)
+    btraceWrite (addr, value);
+  if (hooks && tstore_open)
+    tstoreWrite (addr, value, TS_WRITE_INST);
+  if (hooks && (addr == trace_wait_write))
+    traceTrigger ();
+  if (hooks && checking)
+    hashWrite (addr, value);
+  if (hooks && prov_source)
+    provenance (addr, PROV_INST, prov_inst_addr);
+  mem [addr] = value;
+}
+
+// The instruction execution core is compiled into two variants.  The
+// plain variant has no instrumentation hooks at all; the instrumented
+// variant is used by run() when any profiling option is enabled.
+static inline __attribute__ ((always_inline)) void execute (bool hooks)
+{
+  // temporaries
+  int instruction;
+  int inst1110;
+  int inst98;
+  int inst76;
+  int instLowByte;
+  int count;
+  int ea = 0;
+  bool condition = false;
+  int temp;
+  int inst_addr;
+  
+  if (halt)
+    return;
+  inst_addr = pc;
+  instruction = mem [pc];
+  inst_count++;
+  cycle_count += opcode_info [instruction >> 10].cycles;
+  if (flight_ring)
+    {
+      struct flight_entry *e = & flight_ring [inst_count & flight_mask];
+      e->pc = pc;
+      e->inst = instruction;
+      e->ac [0] = ac [0];
+      e->ac [1] = ac [1];
+      e->ac [2] = ac [2];
+      e->ac [3] = ac [3];
+      e->flags = cy | (lk << 1) | (ov << 2) | (byte_mode << 3);
+      e->sp = sp;
+    }
+  if (hooks && exec_count)
+    exec_count [pc]++;
+  if (hooks && trace_armed)
+    {
+      if ((pc == trace_wait_pc) ||
+	  (inst_count == trace_wait_count) ||
+	  (trace_wait_word && (instruction == JMP_THRU_W) && traceWordMatch (ac [2])))
+	traceTrigger ();
+    }
+  if (hooks && timeline_f && (instruction == JMP_THRU_W))
+    timelineWordEntry (ac [2]);
+  if (live_stats && (instruction == JMP_THRU_W))
+    live_word = ac [2];
+  btrace_recording = false;
+  if (hooks && tstore_open)
+    tstoreFetch (pc, instruction);
+  if (hooks && prov_source)
+    prov_inst_addr = pc;
+  if (hooks && trace_output && tracing &&
+      (trace_filter [pc >> 3] & (1 << (pc & 7))))
+    traceInstruction (instruction);
+  pc = (pc + 1) & WORD_MASK;
+
+  inst1110 =  (instruction >> 10) & 0x03;
+  inst98 = (instruction >> 8) & 0x03;
+  inst76 = (instruction >> 6) & 0x03;
+  instLowByte = instruction & BYTE_MASK;
+  count = instLowByte >> 1;
+
+  switch (inst98)
+    {
+    case 0:
+      if (base_page_split)
+	ea = signExtend (instLowByte);
+      else
+	ea = instLowByte;
+      break;
+    case 1:
+      ea = (pc + signExtend (instLowByte)) & WORD_MASK;
+      break;
+    case 2:
+    case 3:
+      ea = (ac [inst98] + signExtend (instLowByte)) & WORD_MASK;
+    }
+
+  switch (instruction >> 10)
     {
     case 0x00:  // HALT
       halt = true;
@@ -807,7 +1545,8 @@ void executeInstruction ()
       break;
     case 0x1e:  // AISZ: add immediate, skip if zero
       ac [inst98] = (ac[inst98] + signExtend (instLowByte)) & WORD_MASK;
-      if (ac [inst98] == 0)
+      condition = (ac [inst98] == 0);
+      if (condition)
 	pc = (pc + 1) & WORD_MASK;
       break;
     case 0x1f:  // RTI: return from interrupt
@@ -818,105 +1557,122 @@ void executeInstruction ()
       pc = (pull () + instLowByte) & WORD_MASK;
       break;
     case 0x22:  // DECA: decimal add
-      ac [0] = decimalAdd (ac [0], mem [ea], cy);
+      ac [0] = decimalAdd (ac [0], readMem (hooks, ea), cy);
       break;
     case 0x23:  // ISZ: increment and skip if zero
-      mem [ea] = (mem [ea] + 1) & WORD_MASK;
+      temp = (readMem (hooks, ea) + 1) & WORD_MASK;
+      writeMem (hooks, ea, temp);
       if (byte_mode)
-	condition = ((mem [ea] & BYTE_MASK) == 0);
+	condition = ((temp & BYTE_MASK) == 0);
       else
-	condition = (mem [ea] == 0);
+	condition = (temp == 0);
       if (condition)
 	pc = (pc + 1) & WORD_MASK;
       break;
     case 0x24:  // SUBB: subtract with borrow
-      ac [0] = add (ac [0], mem [ea] ^ WORD_MASK, cy);
+      ac [0] = add (ac [0], readMem (hooks, ea) ^ WORD_MASK, cy);
       break;
     case 0x25:  // JSR @: jump to subroutine indirect
       push (pc);
-      pc = mem [ea];
+      pc = readMem (hooks, ea);
       break;
     case 0x26:  // JMP @: jump indirect
-      pc = mem [ea];
+      pc = readMem (hooks, ea);
       break;
     case 0x27:  // SKG: skip if greater
+      temp = readMem (hooks, ea);
       if (byte_mode)
 	condition = (signedValue (signExtend (ac [0])) >
-		     signedValue (signExtend (mem [ea])));
+		     signedValue (signExtend (temp)));
       else
 	condition = (signedValue (ac [0]) >
-		     signedValue (mem [ea]));
+		     signedValue (temp));
       if (condition)
 	pc = (pc + 1) & WORD_MASK;
       break;
     case 0x28:  // LD @: load indirect
-      ac [0] = mem [ mem [ea]];
+      ac [0] = readMem (hooks, readMem (hooks, ea));
       break;
     case 0x29:  // OR: logical or
-      ac [0] = ac [0] | mem [ea];
+      ac [0] = ac [0] | readMem (hooks, ea);
       break;
     case 0x2a:  // AND: logical and
-      ac [0] = ac [0] & mem [ea];
+      ac [0] = ac [0] & readMem (hooks, ea);
       break;
     case 0x2b:  // DSZ: decrement and skip if zero
-      mem [ea] = (mem [ea] - 1) & WORD_MASK;
+      temp = (readMem (hooks, ea) - 1) & WORD_MASK;
+      writeMem (hooks, ea, temp);
       if (byte_mode)
-	condition = ((mem [ea] & BYTE_MASK) == 0);
+	condition = ((temp & BYTE_MASK) == 0);
       else
-	condition = (mem [ea] == 0);
+	condition = (temp == 0);
       if (condition)
 	pc = (pc + 1) & WORD_MASK;
       break;
     case 0x2c:  // ST @: store indirect
-      mem [mem [ea]] = ac [0];
+      writeMem (hooks, readMem (hooks, ea), ac [0]);
       break;
     case 0x2e:  // SKAZ: skip if AND is zero
+      temp = readMem (hooks, ea);
       if (byte_mode)
-	condition = ((ac [0] & mem [ea] & 0xff) == 0);
+	condition = ((ac [0] & temp & 0xff) == 0);
       else
-	condition = ((ac [0] & mem [ea]) == 0);
+	condition = ((ac [0] & temp) == 0);
       if (condition)
 	pc = (pc + 1) & WORD_MASK;
       break;
     case 0x2f:  // LSEX: load with sign extend
-      ac [0] = signExtend (mem [ea]);
+      ac [0] = signExtend (readMem (hooks, ea));
       break;
     case 0x30:
     case 0x31:
     case 0x32:
     case 0x33:  // LD: load
-      ac [inst1110] = mem [ea];
+      ac [inst1110] = readMem (hooks, ea);
       break;
     case 0x34:
     case 0x35:
     case 0x36:
     case 0x37:  // ST: store
-      mem [ea] = ac [inst1110];
+      writeMem (hooks, ea, ac [inst1110]);
       break;
     case 0x38:
     case 0x39:
     case 0x3a:
     case 0x3b:  // ADD
-      ac [inst1110] = add (ac [inst1110], mem [ea], false);
+      ac [inst1110] = add (ac [inst1110], readMem (hooks, ea), false);
       break;
     case 0x3c:
     case 0x3d:
     case 0x3e:
     case 0x3f:  // SKNE: skip if not equal
+      temp = readMem (hooks, ea);
       if (byte_mode)
 	condition = ((ac [inst1110] & BYTE_MASK) !=
-		     (mem [ea] & BYTE_MASK));
+		     (temp & BYTE_MASK));
       else
-	condition = (ac [inst1110] != mem [ea]);
+	condition = (ac [inst1110] != temp);
       if (condition)
 	pc = (pc + 1) & WORD_MASK;
       break;
     case 0x21:
     case 0x2d:
     default:
+      illegal_opcode = true;
       halt = true;  // $$$ illegal opcode
       break;
     }
+  if (hooks && op_stats)
+    {
+      int op = instruction >> 10;
+      op_count [op]++;
+      if (opcode_info [op].flags & OP_MEMREF)
+	mode_count [(opcode_info [op].flags & OP_INDIRECT) != 0] [inst98]++;
+      if ((opcode_info [op].flags & OP_SKIP) && condition)
+	op_skips [op]++;
+    }
+  if (hooks && branch_taken && (opcode_info [instruction >> 10].flags & OP_BRANCH))
+    recordBranch (inst_addr, condition);
   if (ie0_defer)
     {
       ie [0] = true;
@@ -924,6 +1680,31 @@ void executeInstruction ()
     }
 }
 
+void executeInstruction (void)
+{
+  execute (false);
+}
+
+void executeInstrumented (void)
+{
+  execute (true);
+}
+
+// Record memory written by the host on behalf of the guest, in the
+// traces and the provenance of the words written.
+void hostWrote (int addr, int count, int source)
+{
+  int i;
+
+  if (btrace_f)
+    btraceHostWrite (addr, count);
+  if (tstore_open)
+    tstoreHostWrite (addr, count);
+  if (prov_source)
+    for (i = 0; i < count; i++)
+      provenance ((addr + i) & WORD_MASK, source, pc);
+}
+
 int loadLine (char *fn, int lineNo, char *buf, int expectedAddr)
 {
   int addr = expectedAddr;
@@ -942,8 +1723,9 @@ int loadLine (char *fn, int lineNo, char *buf, int expectedAddr)
       expectedAddr = addr;
     }
   
-  mem [addr++] = data;
-  return addr;
+  mem [addr] = data;
+  hostWrote (addr, 1, PROV_IMAGE);
+  return addr + 1;
 }
 
 void loadHexFile (char *name)
@@ -972,13 +1754,16 @@ void loadHexFile (char *name)
 
 bool consoleInputAvail ()
 {
-  return false;  // $$$
+  return consoleAvail ();
 }
 
-// blocking read one character from console
+// blocking read one character from console, or -1 at end of input or
+// when a signal has stopped the simulator
 int consoleInputCharacter (void)
 {
-  int b = fgetc (stdin);
+  int b = consoleGet ();
+  if (b < 0)
+    return b;
   b &= 0x7f;
   if (b == '\n')
     b = '\r';
@@ -989,11 +1774,13 @@ void consoleOutputCharacter (int c)
 {
   //if (c == '\r')
   //  c = '\n';
-  fprintf (stdout, "%c", c);
+  consolePut (c);
 }
 
 int get_mem_byte (int addr)
 {
+  if (mem_reads)
+    mem_reads [addr >> 1]++;
   if (addr & 1)
     return mem [addr >> 1] & 0xff;
   else
@@ -1002,94 +1789,1842 @@ int get_mem_byte (int addr)
 
 void put_mem_byte (int addr, int b)
 {
+  if (mem_writes)
+    mem_writes [addr >> 1]++;
   if (addr & 1)
     mem [addr >> 1] = ((mem [addr >> 1]) & 0xff00) | (b & 0xff);
   else
     mem [addr >> 1] = ((mem [addr >> 1]) & 0x00ff) | ((b & 0xff) << 8);
 }
 
-// addr is word addr
-#define BLOCK_SIZE 128
-void block_io (int addr, int block, bool read)
+void blockOpen (void)
 {
-  int baddr = addr << 1;
-  int count;
-  int b;
-  int new_pos;
-
-  //fprintf (stdout, "%sing block %d, addr %04x, byte addr %04x\n",
-  //	   (read ? "read" : "write"), block, addr, baddr);
-  if (block < 0)
-    return;  // error!
+  int i;
 
-  new_pos = block * BLOCK_SIZE;
-  //fprintf (stderr, "seeking to %d\n", new_pos);
-  if (fseek (block_f, new_pos, SEEK_SET) < 0)
+  for (i = 0; i < BLKDEV_DRIVES; i++)
     {
-      fprintf (stderr, "error seeking to %d\n", new_pos);
-      return;
-    }
-  count = BLOCK_SIZE;
-  while (count--)
-    {
-      if (read)
-	{
-	  b = fgetc (block_f);
-	  if (b < 0)
-	    {
-	      fprintf (stderr, "end of file\n");
-	      return;
-	    }
-	  put_mem_byte (baddr++, b);
-	}
-      else
+      if (! block_fn [i])
+	continue;
+      block_dev [i] = blkdevOpen (block_fn [i], & block_options);
+      if (! block_dev [i])
 	{
-	  b = get_mem_byte (baddr++);
-	  fputc (b, block_f);
+	  fprintf (stderr, "can't open block file '%s'\n", block_fn [i]);
+	  exit (2);
 	}
     }
 }
 
-#define ABSTTY_BASE    0x7e00
-#define ABSTTY_SIZE    0x0100
-
-#define ABSTTY_GETC    0x7e3b
-#define ABSTTY_PUTC    0x7e44
-#define ABSTTY_INTEST  0x7ecc
-
-#define ABSTTY_BLOCKIO 0x7eff  // my own hack for disk I/O
-
-void run (void)
+// counts a transfer of the block at addr in the memory statistics
+void blockCount (int addr, bool read)
 {
-  int c;
-
-  loadHexFile ("figforth_pace.obj");
+  int i;
 
-  block_f = fopen (block_fn, "r+b");
-  if (! block_f)
+  if (read)
     {
-      fprintf (stderr, "can't open block file '%s'\n", block_fn);
-      exit (2);
+      block_reads++;
+      if (mem_writes)
+	for (i = 0; i < BLKDEV_BLOCK_WORDS; i++)
+	  mem_writes [(addr + i) & WORD_MASK]++;
     }
-	
-  pc = 0x10;
+  else
+    {
+      block_writes++;
+      if (mem_reads)
+	for (i = 0; i < BLKDEV_BLOCK_WORDS; i++)
+	  mem_reads [(addr + i) & WORD_MASK]++;
+    }
+}
+
+// Records a finished DMA transfer as done now, which is when the guest
+// sees its block and status.
+void blockDmaDone (struct blkdma_done *r)
+{
+  int addr = r->words - mem;
+
+  if (r->read)
+    blockCount (addr, true);
+  if (r->read && (*r->status == BLKDMA_DONE))
+    hostWrote (addr, BLKDEV_BLOCK_WORDS, PROV_DISK);
+  hostWrote (r->status - mem, 1, PROV_DISK);
+  block_dma_pending--;
+}
+
+// Finishes the DMA transfers that the thread is done with.  Called
+// from run() while any are pending, so that the guest, polling the
+// status word, sees them finish.
+void blockDmaPoll (void)
+{
+  struct blkdma_done r;
+
+  while (blkdmaFinish (block_queue, false, & r))
+    blockDmaDone (& r);
+}
+
+// Waits for the DMA thread to finish with the devices, before this
+// thread uses them, and finishes its transfers.
+void blockDmaWait (void)
+{
+  struct blkdma_done r;
+
+  if (block_queue)
+    while (blkdmaFinish (block_queue, true, & r))
+      blockDmaDone (& r);
+}
+
+void blockFlush (void)
+{
+  int i;
+
+  blockDmaWait ();
+  for (i = 0; i < BLKDEV_DRIVES; i++)
+    if (block_dev [i])
+      blkdevFlush (block_dev [i]);
+}
+
+void blockClose (void)
+{
+  int i;
+
+  if (block_queue)
+    {
+      blkdmaDestroy (block_queue);
+      block_queue = NULL;
+    }
+  for (i = 0; i < BLKDEV_DRIVES; i++)
+    if (block_dev [i])
+      {
+	blkdevClose (block_dev [i]);
+	block_dev [i] = NULL;
+      }
+}
+
+// totals over all drives
+void blockStats (struct blkdev_stats *s)
+{
+  const struct blkdev_stats *d;
+  int i;
+
+  blockDmaWait ();
+  memset (s, 0, sizeof (*s));
+  for (i = 0; i < BLKDEV_DRIVES; i++)
+    {
+      if (! block_dev [i])
+	continue;
+      d = blkdevStats (block_dev [i]);
+      s->hits += d->hits;
+      s->misses += d->misses;
+      s->evictions += d->evictions;
+      s->write_backs += d->write_backs;
+      s->flushes += d->flushes;
+      s->prefetched += d->prefetched;
+      s->prefetch_hits += d->prefetch_hits;
+      s->overlay_blocks += d->overlay_blocks;
+    }
+}
+
+// the device of a 32-bit block number, whose high byte is the drive
+struct blkdev *blockDrive (uint32_t block, bool report)
+{
+  uint32_t drive = block >> BLKDEV_DRIVE_SHIFT;
+
+  if ((drive < BLKDEV_DRIVES) && block_dev [drive])
+    return block_dev [drive];
+  if (report)
+    fprintf (stderr, "no drive %" PRIu32 "\n", drive);
+  return NULL;
+}
+
+// addr is word addr, block is the 32-bit block number, with the drive
+// in its high byte.  Returns false if the transfer failed, which is
+// reported on stderr if report is set.
+#define BLOCK_SIZE BLKDEV_BLOCK_SIZE
+bool block_io (int addr, uint32_t block, bool read, bool report)
+{
+  uint16_t bounce [BLKDEV_BLOCK_WORDS];
+  uint16_t *words = & mem [addr];
+  struct blkdev *dev = blockDrive (block, report);
+  int i;
+
+  //fprintf (stdout, "%sing block %08x, addr %04x\n",
+  //	   (read ? "read" : "write"), block, addr);
+  if (! dev)
+    return false;
+  block &= BLKDEV_DRIVE_BLOCKS - 1;
+  blockDmaWait ();
+  blockCount (addr, read);
+
+  // a buffer that wraps around the end of memory is copied through a
+  // bounce buffer
+  if (addr + BLKDEV_BLOCK_WORDS > WORD_MASK + 1)
+    {
+      words = bounce;
+      if (! read)
+	for (i = 0; i < BLKDEV_BLOCK_WORDS; i++)
+	  bounce [i] = mem [(addr + i) & WORD_MASK];
+    }
+  if (read)
+    {
+      if (! blkdevRead (dev, block, words))
+	{
+	  if (report)
+	    fprintf (stderr, "end of file\n");
+	  return false;
+	}
+      if (words == bounce)
+	for (i = 0; i < BLKDEV_BLOCK_WORDS; i++)
+	  mem [(addr + i) & WORD_MASK] = bounce [i];
+      hostWrote (addr, BLKDEV_BLOCK_WORDS, PROV_DISK);
+    }
+  else if (! blkdevWrite (dev, block, words))
+    {
+      if (report)
+	fprintf (stderr, "can't write block %" PRIu32 "\n", block);
+      return false;
+    }
+  return true;
+}
+
+// Starts a transfer for the DMA trap, which sets the status word at
+// status when it is done.  Failures are only reported there, as a read
+// ahead past the end of a file is expected.  Without a DMA thread, or
+// for a buffer that wraps around the end of memory, the transfer is
+// done at once.  A block read is recorded as written by the disk when
+// it is copied to the buffer, as the transfer is finished.
+void block_dma (int addr, uint32_t block, bool read, int status)
+{
+  struct blkdev *dev;
+  struct blkdma_done r;
+
+  if ((! block_queue) || (addr + BLKDEV_BLOCK_WORDS > WORD_MASK + 1))
+    {
+      mem [status] = block_io (addr, block, read, false) ? BLKDMA_DONE : BLKDMA_ERROR;
+      hostWrote (status, 1, PROV_DISK);
+      return;
+    }
+  dev = blockDrive (block, false);
+  if (! dev)
+    {
+      mem [status] = BLKDMA_ERROR;
+      hostWrote (status, 1, PROV_DISK);
+      return;
+    }
+  while (! blkdmaStart (block_queue, dev, block & (BLKDEV_DRIVE_BLOCKS - 1),
+		       & mem [addr], read, & mem [status]))
+    if (blkdmaFinish (block_queue, true, & r))
+      blockDmaDone (& r);
+  block_dma_pending++;
+  if (! read)
+    blockCount (addr, false);
+  hostWrote (status, 1, PROV_DISK);
+}
+
+#define ABSTTY_BASE    0x7e00
+#define ABSTTY_SIZE    0x0100
+
+#define ABSTTY_GETC    0x7e3b
+#define ABSTTY_PUTC    0x7e44
+#define ABSTTY_INTEST  0x7ecc
+
+#define ABSTTY_INCLUDE 0x7efb  // read a host file, also my own
+#define ABSTTY_EXPECT  0x7efc  // read a line, also my own
+#define ABSTTY_TYPE    0x7efd  // write a string, also my own
+#define ABSTTY_PERF    0x7efe  // performance counters, also my own
+#define ABSTTY_BLOCKIO 0x7eff  // my own hack for disk I/O
+#define ABSTTY_BLOCKDMA 0x7efa  // asynchronous disk I/O, also my own
+
+// BLOCKIO takes ( addr lo hi flag ), where hi:lo is a 32-bit block
+// number: flag is 0 to write, 1 to read, or BLOCKIO_SYNC to flush
+// written blocks to the files of all drives
+#define BLOCKIO_SYNC 2
+
+// BLOCKDMA takes ( addr lo hi flag status ): it starts reading (flag 1)
+// or writing (flag 0) the block, and returns.  The word at status is
+// BLKDMA_BUSY until the transfer is done, then BLKDMA_DONE or
+// BLKDMA_ERROR.
+
+void trapPerf (int function)
+{
+  uint32_t result = perfCounter (function, inst_count, cycle_count);
+
+  ac [0] = result & WORD_MASK;
+  ac [1] = result >> 16;
+}
+
+// The predecoding engine, an alternative to execute().  Each
+// instruction is decoded once into decode_cache, with PC-relative
+// effective addresses and branch targets resolved, and is then
+// dispatched through a table of labels.  Entries are checked against
+// memory on every fetch, so that code which is modified, or read in by
+// block I/O, is decoded again.  It has no instrumentation hooks other
+// than the flight recorder and the lockstep checker's write hash.
+struct decoded
+{
+  uint16_t inst;   // instruction the entry was decoded from
+  bool valid;
+  uint8_t op;      // top six bits of the instruction
+  uint8_t r;       // register: bits 11-10 for LD, ST, ADD, SKNE, else 9-8
+  uint8_t r2;      // second register, bits 7-6
+  uint8_t mode;    // addressing mode, bits 9-8
+  uint8_t count;   // shift count
+  uint16_t ea;     // effective address, displacement if indexed, or BOC target
+  uint16_t imm;    // sign extended low byte
+};
+
+struct decoded *decode_cache = NULL;
+
+void decode (int addr, int instruction, struct decoded *d)
+{
+  int low = instruction & BYTE_MASK;
+
+  d->inst = instruction;
+  d->valid = true;
+  d->op = instruction >> 10;
+  d->r = (d->op >= 0x30) ? (instruction >> 10) & 0x03 : (instruction >> 8) & 0x03;
+  d->r2 = (instruction >> 6) & 0x03;
+  d->mode = (instruction >> 8) & 0x03;
+  d->count = low >> 1;
+  d->imm = signExtend (low);
+  if ((d->op >= 0x10) && (d->op <= 0x13))  // BOC
+    d->ea = (addr + 1 + signExtend (low)) & WORD_MASK;
+  else if (d->mode == 0)
+    d->ea = base_page_split ? signExtend (low) : low;
+  else if (d->mode == 1)
+    d->ea = (addr + 1 + signExtend (low)) & WORD_MASK;
+  else
+    d->ea = signExtend (low);
+}
+
+#define PD_EA(d) (((d)->mode < 2) ? (d)->ea : ((ac [(d)->mode] + (d)->ea) & WORD_MASK))
+
+#define PD_WRITE(addr, value)			\
+  do						\
+    {						\
+      if (checking)				\
+	hashWrite (addr, value);		\
+      mem [addr] = value;			\
+    }						\
+  while (0)
+
+#define PD_SKIP(cond)				\
+  do						\
+    {						\
+      if (cond)					\
+	pc = (pc + 1) & WORD_MASK;		\
+      goto next;				\
+    }						\
+  while (0)
+
+// Executes at most limit instructions, stopping early at a halt or when
+// the PC reaches the ABSTTY traps, which are left to run().
+void runPredecoded (int limit)
+{
+  static void *dispatch [64] =
+    {
+      [0x00] = && op_halt,
+      [0x01] = && op_cfr,
+      [0x02] = && op_crf,
+      [0x03] = && op_pushf,
+      [0x04] = && op_pullf,
+      [0x05] = && op_jsr,
+      [0x06] = && op_jmp,
+      [0x07] = && op_xchrs,
+      [0x08] = && op_rol,
+      [0x09] = && op_ror,
+      [0x0a] = && op_shl,
+      [0x0b] = && op_shr,
+      [0x0c ... 0x0f] = && op_flag,
+      [0x10 ... 0x13] = && op_boc,
+      [0x14] = && op_li,
+      [0x15] = && op_rand,
+      [0x16] = && op_rxor,
+      [0x17] = && op_rcpy,
+      [0x18] = && op_push,
+      [0x19] = && op_pull,
+      [0x1a] = && op_radd,
+      [0x1b] = && op_rxch,
+      [0x1c] = && op_cai,
+      [0x1d] = && op_radc,
+      [0x1e] = && op_aisz,
+      [0x1f] = && op_rti,
+      [0x20] = && op_rts,
+      [0x21] = && op_illegal,
+      [0x22] = && op_deca,
+      [0x23] = && op_isz,
+      [0x24] = && op_subb,
+      [0x25] = && op_jsr_ind,
+      [0x26] = && op_jmp_ind,
+      [0x27] = && op_skg,
+      [0x28] = && op_ld_ind,
+      [0x29] = && op_or,
+      [0x2a] = && op_and,
+      [0x2b] = && op_dsz,
+      [0x2c] = && op_st_ind,
+      [0x2d] = && op_illegal,
+      [0x2e] = && op_skaz,
+      [0x2f] = && op_lsex,
+      [0x30 ... 0x33] = && op_ld,
+      [0x34 ... 0x37] = && op_st,
+      [0x38 ... 0x3b] = && op_add,
+      [0x3c ... 0x3f] = && op_skne,
+    };
+  struct decoded *d;
+  int temp;
+  int ea;
+
+  while ((limit-- > 0) && (! halt) &&
+	 ! ((pc >= ABSTTY_BASE) && (pc <= ABSTTY_BASE + ABSTTY_SIZE)))
+    {
+      d = & decode_cache [pc];
+      if ((! d->valid) || (d->inst != mem [pc]))
+	decode (pc, mem [pc], d);
+      inst_count++;
+      cycle_count += opcode_info [d->op].cycles;
+      if (flight_ring)
+	{
+	  struct flight_entry *e = & flight_ring [inst_count & flight_mask];
+	  e->pc = pc;
+	  e->inst = d->inst;
+	  e->ac [0] = ac [0];
+	  e->ac [1] = ac [1];
+	  e->ac [2] = ac [2];
+	  e->ac [3] = ac [3];
+	  e->flags = cy | (lk << 1) | (ov << 2) | (byte_mode << 3);
+	  e->sp = sp;
+	}
+      pc = (pc + 1) & WORD_MASK;
+      goto *dispatch [d->op];
+
+    op_halt:
+      halt = true;
+      goto next;
+    op_cfr:
+      ac [d->r] = getFR ();
+      goto next;
+    op_crf:
+      setFR (ac [d->r]);
+      goto next;
+    op_pushf:
+      push (getFR ());
+      goto next;
+    op_pullf:
+      setFR (pull ());
+      goto next;
+    op_jsr:
+      push (pc);
+      pc = PD_EA (d);
+      goto next;
+    op_jmp:
+      pc = PD_EA (d);
+      goto next;
+    op_xchrs:
+      temp = ac [d->r];
+      if (sp < 0)
+	ac [d->r] = WORD_MASK;
+      else
+	{
+	  ac [d->r] = stack [sp];
+	  stack [sp] = temp;
+	}
+      goto next;
+    op_rol:
+      if (d->count == 0)
+	goto next;
+      if (byte_mode)
+	{
+	  if (d->inst & 1)
+	    {
+	      temp = rotateLeft ((ac [d->r] & BYTE_MASK) | (lk << 8), 9, d->count);
+	      lk = (temp >> 8) & 1;
+	    }
+	  else
+	    temp = rotateLeft (ac [d->r] & BYTE_MASK, 8, d->count);
+	  ac [d->r] = temp & BYTE_MASK;
+	}
+      else
+	{
+	  if (d->inst & 1)
+	    {
+	      temp = rotateLeft (ac [d->r] | (lk << 16), 17, d->count);
+	      lk = (temp >> 16) & 1;
+	    }
+	  else
+	    temp = rotateLeft (ac [d->r], 16, d->count);
+	  ac [d->r] = temp & WORD_MASK;
+	}
+      goto next;
+    op_ror:
+      if (d->count == 0)
+	goto next;
+      if (byte_mode)
+	{
+	  if (d->inst & 1)
+	    {
+	      temp = rotateRight ((ac [d->r] & BYTE_MASK) | (lk << 8), 9, d->count);
+	      lk = (temp >> 8) & 1;
+	    }
+	  else
+	    temp = rotateRight (ac [d->r] & BYTE_MASK, 8, d->count);
+	  ac [d->r] = temp & BYTE_MASK;
+	}
+      else
+	{
+	  if (d->inst & 1)
+	    {
+	      temp = rotateRight (ac [d->r] | (lk << 16), 17, d->count);
+	      lk = (temp >> 16) & 1;
+	    }
+	  else
+	    temp = rotateRight (ac [d->r], 16, d->count);
+	  ac [d->r] = temp & WORD_MASK;
+	}
+      goto next;
+    op_shl:
+      if (d->count == 0)
+	goto next;
+      temp = ac [d->r] << d->count;
+      if (byte_mode)
+	{
+	  ac [d->r] = temp & BYTE_MASK;
+	  if (d->inst & 1)
+	    lk = (temp >> 8) & 1;
+	}
+      else
+	{
+	  ac [d->r] = temp & WORD_MASK;
+	  if (d->inst & 1)
+	    lk = (temp >> 16) & 1;
+	}
+      goto next;
+    op_shr:
+      if (d->count == 0)
+	goto next;
+      if (byte_mode)
+	{
+	  temp = ac [d->r] & BYTE_MASK;
+	  if (d->inst & 1)
+	    temp |= lk << 8;
+	  ac [d->r] = (temp >> d->count) & BYTE_MASK;
+	}
+      else
+	{
+	  temp = ac [d->r];
+	  if (d->inst & 1)
+	    temp |= lk << 16;
+	  ac [d->r] = temp >> d->count;
+	}
+      goto next;
+    op_flag:
+      if (d->inst & 0x0080)
+	setFlag ((d->inst >> 8) & 0x0f);  // SFLG
+      else
+	pulseFlag ((d->inst >> 8) & 0x0f);  // PFLG
+      goto next;
+    op_boc:
+      switch ((d->inst >> 8) & 0xf)
+	{
+	case 0x0:  temp = stackFull ();  break;
+	case 0x1:  temp = (ac [0] & (byte_mode ? BYTE_MASK : WORD_MASK)) == 0;  break;
+	case 0x2:  temp = ((ac [0] >> (byte_mode ? 7 : 15)) & 1) == 0;  break;
+	case 0x3:  temp = ac [0] & 1;  break;
+	case 0x4:  temp = (ac [0] >> 1) & 1;  break;
+	case 0x5:  temp = (ac [0] & (byte_mode ? BYTE_MASK : WORD_MASK)) != 0;  break;
+	case 0x6:  temp = (ac [0] >> 2) & 1;  break;
+	case 0x7:  temp = continue_input;  break;
+	case 0x8:  temp = lk;  break;
+	case 0x9:  temp = ien;  break;
+	case 0xa:  temp = cy;  break;
+	case 0xb:  temp = (ac [0] >> (byte_mode ? 7 : 15)) & 1;  break;
+	case 0xc:  temp = ov;  break;
+	case 0xd:  temp = jc13;  break;
+	case 0xe:  temp = jc14;  break;
+	default:   temp = jc15;  break;
+	}
+      if (temp)
+	pc = d->ea;
+      goto next;
+    op_li:
+      ac [d->r] = d->imm;
+      goto next;
+    op_rand:
+      ac [d->r] &= ac [d->r2];
+      goto next;
+    op_rxor:
+      ac [d->r] ^= ac [d->r2];
+      goto next;
+    op_rcpy:
+      ac [d->r] = ac [d->r2];
+      goto next;
+    op_push:
+      push (ac [d->r]);
+      goto next;
+    op_pull:
+      ac [d->r] = pull ();
+      goto next;
+    op_radd:
+      ac [d->r] = add (ac [d->r], ac [d->r2], false);
+      goto next;
+    op_rxch:
+      temp = ac [d->r];
+      ac [d->r] = ac [d->r2];
+      ac [d->r2] = temp;
+      goto next;
+    op_cai:
+      ac [d->r] = ((ac [d->r] ^ WORD_MASK) + d->imm) & WORD_MASK;
+      goto next;
+    op_radc:
+      ac [d->r] = add (ac [d->r], ac [d->r2], cy);
+      goto next;
+    op_aisz:
+      ac [d->r] = (ac [d->r] + d->imm) & WORD_MASK;
+      PD_SKIP (ac [d->r] == 0);
+    op_rti:
+      pc = (pull () + (d->inst & BYTE_MASK)) & WORD_MASK;
+      ien = true;
+      goto next;
+    op_rts:
+      pc = (pull () + (d->inst & BYTE_MASK)) & WORD_MASK;
+      goto next;
+    op_deca:
+      ac [0] = decimalAdd (ac [0], mem [PD_EA (d)], cy);
+      goto next;
+    op_isz:
+      ea = PD_EA (d);
+      temp = (mem [ea] + 1) & WORD_MASK;
+      PD_WRITE (ea, temp);
+      PD_SKIP ((temp & (byte_mode ? BYTE_MASK : WORD_MASK)) == 0);
+    op_subb:
+      ac [0] = add (ac [0], mem [PD_EA (d)] ^ WORD_MASK, cy);
+      goto next;
+    op_jsr_ind:
+      push (pc);
+      pc = mem [PD_EA (d)];
+      goto next;
+    op_jmp_ind:
+      if (live_stats && (d->inst == JMP_THRU_W))
+	live_word = ac [2];
+      pc = mem [PD_EA (d)];
+      goto next;
+    op_skg:
+      temp = mem [PD_EA (d)];
+      if (byte_mode)
+	PD_SKIP (signedValue (signExtend (ac [0])) > signedValue (signExtend (temp)));
+      PD_SKIP (signedValue (ac [0]) > signedValue (temp));
+    op_ld_ind:
+      ac [0] = mem [mem [PD_EA (d)]];
+      goto next;
+    op_or:
+      ac [0] |= mem [PD_EA (d)];
+      goto next;
+    op_and:
+      ac [0] &= mem [PD_EA (d)];
+      goto next;
+    op_dsz:
+      ea = PD_EA (d);
+      temp = (mem [ea] - 1) & WORD_MASK;
+      PD_WRITE (ea, temp);
+      PD_SKIP ((temp & (byte_mode ? BYTE_MASK : WORD_MASK)) == 0);
+    op_st_ind:
+      ea = mem [PD_EA (d)];
+      PD_WRITE (ea, ac [0]);
+      goto next;
+    op_skaz:
+      temp = mem [PD_EA (d)];
+      PD_SKIP ((ac [0] & temp & (byte_mode ? BYTE_MASK : WORD_MASK)) == 0);
+    op_lsex:
+      ac [0] = signExtend (mem [PD_EA (d)]);
+      goto next;
+    op_ld:
+      ac [d->r] = mem [PD_EA (d)];
+      goto next;
+    op_st:
+      ea = PD_EA (d);
+      PD_WRITE (ea, ac [d->r]);
+      goto next;
+    op_add:
+      ac [d->r] = add (ac [d->r], mem [PD_EA (d)], false);
+      goto next;
+    op_skne:
+      temp = mem [PD_EA (d)];
+      PD_SKIP ((ac [d->r] ^ temp) & (byte_mode ? BYTE_MASK : WORD_MASK));
+    op_illegal:
+      illegal_opcode = true;
+      halt = true;
+      goto next;
+
+    next:
+      if (ie0_defer)
+	{
+	  ie [0] = true;
+	  ie0_defer = false;
+	}
+    }
+}
+
+// Lockstep checker.  The reference core and the predecoding engine are
+// run side by side, one instruction at a time, each on its own copy of
+// the machine state, and their registers, flags and memory write hashes
+// are compared every check_interval instructions.  Before each ABSTTY
+// trap the states are compared, and after it the predecoding engine's
+// state is copied from the reference, so the traps only run once.  With
+// an interval above one, a mismatch is pinned down by replaying the
+// interval from a checkpoint, comparing after every instruction.
+struct machine_state
+{
+  uint16_t *mem;
+  uint16_t ac [4];
+  uint16_t pc;
+  int sp;
+  uint16_t stack [STACK_SIZE];
+  bool halt;
+  bool ov;
+  bool cy;
+  bool lk;
+  bool ien;
+  bool byte_mode;
+  bool output_flag [4];
+  bool ie0_defer;
+  bool ie [6];
+  bool ir [6];
+  bool illegal_opcode;
+  uint64_t write_hash;
+};
+
+int check_interval = 0;
+int check_steps;
+struct machine_state check_alt;        // the predecoding engine's state
+uint16_t *check_mem;                   // and its memory
+struct machine_state check_point;      // both states at the last compare
+uint16_t *check_point_mem;
+uint64_t check_point_inst_count;
+uint64_t check_point_cycle_count;
+int check_addr;                        // last instruction executed
+int check_instruction;
+
+void saveState (struct machine_state *s)
+{
+  s->mem = mem;
+  memcpy (s->ac, ac, sizeof (ac));
+  s->pc = pc;
+  s->sp = sp;
+  memcpy (s->stack, stack, sizeof (stack));
+  s->halt = halt;
+  s->ov = ov;
+  s->cy = cy;
+  s->lk = lk;
+  s->ien = ien;
+  s->byte_mode = byte_mode;
+  memcpy (s->output_flag, output_flag, sizeof (output_flag));
+  s->ie0_defer = ie0_defer;
+  memcpy (s->ie, ie, sizeof (ie));
+  memcpy (s->ir, ir, sizeof (ir));
+  s->illegal_opcode = illegal_opcode;
+  s->write_hash = write_hash;
+}
+
+void loadState (struct machine_state *s)
+{
+  mem = s->mem;
+  memcpy (ac, s->ac, sizeof (ac));
+  pc = s->pc;
+  sp = s->sp;
+  memcpy (stack, s->stack, sizeof (stack));
+  halt = s->halt;
+  ov = s->ov;
+  cy = s->cy;
+  lk = s->lk;
+  ien = s->ien;
+  byte_mode = s->byte_mode;
+  memcpy (output_flag, s->output_flag, sizeof (output_flag));
+  ie0_defer = s->ie0_defer;
+  memcpy (ie, s->ie, sizeof (ie));
+  memcpy (ir, s->ir, sizeof (ir));
+  illegal_opcode = s->illegal_opcode;
+  write_hash = s->write_hash;
+}
+
+bool statesMatch (struct machine_state *a, struct machine_state *b)
+{
+  int i;
+
+  if ((memcmp (a->ac, b->ac, sizeof (a->ac)) != 0) ||
+      (a->pc != b->pc) ||
+      (a->sp != b->sp) ||
+      (a->halt != b->halt) ||
+      (a->ov != b->ov) ||
+      (a->cy != b->cy) ||
+      (a->lk != b->lk) ||
+      (a->ien != b->ien) ||
+      (a->byte_mode != b->byte_mode) ||
+      (memcmp (a->output_flag, b->output_flag, sizeof (a->output_flag)) != 0) ||
+      (a->ie0_defer != b->ie0_defer) ||
+      (memcmp (a->ie, b->ie, sizeof (a->ie)) != 0) ||
+      (memcmp (a->ir, b->ir, sizeof (a->ir)) != 0) ||
+      (a->write_hash != b->write_hash))
+    return false;
+  for (i = 0; i <= a->sp; i++)
+    if (a->stack [i] != b->stack [i])
+      return false;
+  return true;
+}
+
+void checkLine (char *name, int a, int b)
+{
+  fprintf (stderr, "%-10s %04x       %04x%s\n", name, a, b, (a != b) ? "   *" : "");
+}
+
+void checkReport (int addr, int instruction, struct machine_state *ref)
+{
+  struct machine_state *alt = & check_alt;
+  char buf [80];
+  char name [16];
+  int ref_fr;
+  int alt_fr;
+  int i;
+
+  loadState (alt);
+  alt_fr = getFR ();
+  loadState (ref);
+  ref_fr = getFR ();
+
+  disassembleInstruction (addr, instruction, ref->ac, base_page_split, buf);
+  fprintf (stderr, "engines diverged at instruction %" PRIu64 ", PC=%04x, instruction=%04x: %s\n",
+	   inst_count, addr, instruction, buf);
+  fprintf (stderr, "           reference  predecode\n");
+  checkLine ("PC", ref->pc, alt->pc);
+  for (i = 0; i < 4; i++)
+    {
+      sprintf (name, "AC%d", i);
+      checkLine (name, ref->ac [i], alt->ac [i]);
+    }
+  checkLine ("FR", ref_fr, alt_fr);
+  checkLine ("halt", ref->halt, alt->halt);
+  checkLine ("SP", ref->sp & WORD_MASK, alt->sp & WORD_MASK);
+  for (i = 0; (i <= ref->sp) || (i <= alt->sp); i++)
+    {
+      sprintf (name, "stack %d", i);
+      checkLine (name, ref->stack [i], alt->stack [i]);
+    }
+  fprintf (stderr, "%-10s %016" PRIx64 " %016" PRIx64 "%s\n", "writes",
+	   ref->write_hash, alt->write_hash,
+	   (ref->write_hash != alt->write_hash) ? "   *" : "");
+  for (i = 0; i < 65536; i++)
+    if (ref->mem [i] != alt->mem [i])
+      {
+	sprintf (name, "mem %04x", i);
+	checkLine (name, ref->mem [i], alt->mem [i]);
+      }
+}
+
+// takes a checkpoint of the reference state, which is also the state of
+// the predecoding engine
+void checkPoint (void)
+{
+  if (check_interval <= 1)
+    return;
+  saveState (& check_point);
+  memcpy (check_point_mem, mem, 65536 * sizeof (uint16_t));
+  check_point_inst_count = inst_count;
+  check_point_cycle_count = cycle_count;
+}
+
+// makes the predecoding engine's state a copy of the reference's
+void checkSync (void)
+{
+  saveState (& check_alt);
+  check_alt.mem = check_mem;
+  memcpy (check_mem, mem, 65536 * sizeof (uint16_t));
+  checkPoint ();
+}
+
+// executes one instruction on each engine, leaving the reference state
+// current
+void checkExecute (void)
+{
+  struct machine_state ref;
+  uint64_t ref_inst_count;
+  uint64_t ref_cycle_count;
+
+  check_addr = pc;
+  check_instruction = mem [pc];
+  executeInstrumented ();
+  saveState (& ref);
+  ref_inst_count = inst_count;
+  ref_cycle_count = cycle_count;
+  loadState (& check_alt);
+  runPredecoded (1);
+  saveState (& check_alt);
+  loadState (& ref);
+  inst_count = ref_inst_count;
+  cycle_count = ref_cycle_count;
+}
+
+void checkCompare (void)
+{
+  struct machine_state ref;
+  uint16_t *ref_mem = mem;
+  int i;
+
+  check_steps = 0;
+  saveState (& ref);
+  if (statesMatch (& ref, & check_alt))
+    {
+      checkPoint ();
+      return;
+    }
+
+  if (check_interval > 1)
+    {
+      // replay from the checkpoint to find the first divergence
+      memcpy (ref_mem, check_point_mem, 65536 * sizeof (uint16_t));
+      memcpy (check_mem, check_point_mem, 65536 * sizeof (uint16_t));
+      check_alt = check_point;
+      check_alt.mem = check_mem;
+      loadState (& check_point);
+      inst_count = check_point_inst_count;
+      cycle_count = check_point_cycle_count;
+      for (i = 0; i < check_interval; i++)
+	{
+	  checkExecute ();
+	  saveState (& ref);
+	  if (! statesMatch (& ref, & check_alt))
+	    break;
+	}
+    }
+  checkReport (check_addr, check_instruction, & ref);
+  halt = true;
+}
+
+void checkStep (void)
+{
+  checkExecute ();
+  if (++check_steps >= check_interval)
+    checkCompare ();
+}
+
+// Write the per-address execution counts, one "addr: count" line per
+// executed address, in the same style as the object file.  Counts from
+// several runs can be summed by lstcount.py.
+void writeProfile (char *fn)
+{
+  FILE *f;
+  int addr;
+
+  f = fopen (fn, "w");
+  if (! f)
+    {
+      fprintf (stderr, "can't create profile file '%s'\n", fn);
+      return;
+    }
+  for (addr = 0; addr < 65536; addr++)
+    if (exec_count [addr])
+      fprintf (f, "%04x: %" PRIu64 "\n", addr, exec_count [addr]);
+  fclose (f);
+}
+
+// FIG-Forth memory layout, for the heatmap region summaries.  The
+// boundary between the dictionary and the data stack moves as the
+// dictionary grows; the stack region is the part printStack() examines.
+struct region
+{
+  char *name;
+  int first;
+  int last;
+} forth_regions [] =
+  {
+    { "base page",       0x0000, FORTH_DICT - 1 },
+    { "dictionary",      FORTH_DICT, FORTH_S0 - FORTH_STACK_DEPTH - 1 },
+    { "data stack",      FORTH_S0 - FORTH_STACK_DEPTH, FORTH_S0 - 1 },
+    { "TIB/return stack", FORTH_S0, FORTH_UVARS - 1 },
+    { "user area",       FORTH_UVARS, FORTH_BUFFS - 1 },
+    { "block buffers",   FORTH_BUFFS, FORTH_TOPMEM - 1 },
+    { "unused",          FORTH_TOPMEM, 0xffff },
+  };
+
+#define HOT_WORD_COUNT 16
+
+// Write the data read and write counts as CSV, one line for each
+// address that was accessed, and summarize them by region on stderr.
+// Block I/O counts one access per word transferred, and the string
+// services (TYPE, EXPECT, INCLUDE) one per byte.
+void writeHeatmap (char *fn)
+{
+  FILE *f;
+  int addr;
+  unsigned int i, j;
+  uint64_t reads, writes;
+  int hot [HOT_WORD_COUNT];
+  int hot_count = 0;
+
+  f = fopen (fn, "w");
+  if (! f)
+    {
+      fprintf (stderr, "can't create heatmap file '%s'\n", fn);
+      return;
+    }
+  fprintf (f, "addr,reads,writes\n");
+  for (addr = 0; addr < 65536; addr++)
+    if (mem_reads [addr] || mem_writes [addr])
+      fprintf (f, "%04x,%" PRIu64 ",%" PRIu64 "\n",
+	       addr, mem_reads [addr], mem_writes [addr]);
+  fclose (f);
+
+  fprintf (stderr, "%-17s %-9s %12s %12s %8s\n",
+	   "region", "range", "reads", "writes", "words");
+  for (i = 0; i < sizeof (forth_regions) / sizeof (struct region); i++)
+    {
+      int used = 0;
+      reads = 0;
+      writes = 0;
+      for (addr = forth_regions [i].first; addr <= forth_regions [i].last; addr++)
+	{
+	  reads += mem_reads [addr];
+	  writes += mem_writes [addr];
+	  if (mem_reads [addr] || mem_writes [addr])
+	    used++;
+	}
+      fprintf (stderr, "%-17s %04x-%04x %12" PRIu64 " %12" PRIu64 " %8d\n",
+	       forth_regions [i].name,
+	       forth_regions [i].first, forth_regions [i].last,
+	       reads, writes, used);
+    }
+
+  // The most heavily accessed words outside the base page are the
+  // candidates for moving into it, where they can be directly addressed.
+  for (addr = 0x0100; addr < 65536; addr++)
+    {
+      uint64_t n = mem_reads [addr] + mem_writes [addr];
+      if (! n)
+	continue;
+      for (i = 0; i < (unsigned) hot_count; i++)
+	if (n > mem_reads [hot [i]] + mem_writes [hot [i]])
+	  break;
+      if (i >= HOT_WORD_COUNT)
+	continue;
+      if (hot_count < HOT_WORD_COUNT)
+	hot_count++;
+      for (j = hot_count - 1; j > i; j--)
+	hot [j] = hot [j - 1];
+      hot [i] = addr;
+    }
+  fprintf (stderr, "\nmost accessed words above base page:\n");
+  for (i = 0; i < (unsigned) hot_count; i++)
+    fprintf (stderr, "  %04x %12" PRIu64 " reads %12" PRIu64 " writes\n",
+	     hot [i], mem_reads [hot [i]], mem_writes [hot [i]]);
+}
+
+// Write the source of every word of memory that was written as CSV.
+void writeProvenance (char *fn)
+{
+  FILE *f;
+  int addr;
+
+  f = fopen (fn, "w");
+  if (! f)
+    {
+      fprintf (stderr, "can't create provenance file '%s'\n", fn);
+      return;
+    }
+  fprintf (f, "addr,value,source,pc,time\n");
+  for (addr = 0; addr < 65536; addr++)
+    if (prov_source [addr] != PROV_NONE)
+      fprintf (f, "%04x,%04x,%s,%04x,%" PRIu64 "\n",
+	       addr, mem [addr], prov_source_name [prov_source [addr]],
+	       prov_pc [addr], prov_time [addr]);
+  fclose (f);
+}
+
+void showProvenance (const char *what, int addr)
+{
+  addr &= WORD_MASK;
+  fprintf (stderr, "%-12s [%04x] = %04x  ", what, addr, mem [addr]);
+  switch (prov_source [addr])
+    {
+    case PROV_NONE:
+      fprintf (stderr, "never written\n");
+      break;
+    case PROV_IMAGE:
+      fprintf (stderr, "loaded from image\n");
+      break;
+    case PROV_DISK:
+      fprintf (stderr, "read from disk at instruction %" PRIu64 "\n", prov_time [addr]);
+      break;
+    case PROV_CONSOLE:
+      fprintf (stderr, "read from console at instruction %" PRIu64 "\n", prov_time [addr]);
+      break;
+    case PROV_FILE:
+      fprintf (stderr, "read from INCLUDE file at instruction %" PRIu64 "\n", prov_time [addr]);
+      break;
+    default:
+      fprintf (stderr, "written by instruction %" PRIu64 " at %04x\n",
+	       prov_time [addr], prov_pc [addr]);
+    }
+}
+
+// Where did the values that the machine stopped on come from?
+void provenanceReport (void)
+{
+  char what [16];
+  int i;
+
+  showProvenance ("instruction", pc - 1);
+  for (i = 0; i < 4; i++)
+    {
+      sprintf (what, "@AC%d", i);
+      showProvenance (what, ac [i]);
+    }
+  showProvenance ("@IP-1", ac [1] - 1);  // the CFA NEXT last fetched
+}
+
+// Write the opcode mix, addressing mode and skip statistics as CSV.
+// Opcodes that differ only in register number are combined.
+void writeOpStats (char *fn)
+{
+  FILE *f;
+  int op, op2;
+  int i;
+  uint64_t count, skips;
+
+  f = fopen (fn, "w");
+  if (! f)
+    {
+      fprintf (stderr, "can't create opcode statistics file '%s'\n", fn);
+      return;
+    }
+  fprintf (f, "category,name,count,taken\n");
+  for (op = 0; op < 64; op++)
+    {
+      for (op2 = 0; op2 < op; op2++)
+	if (strcmp (opcode_info [op2].name, opcode_info [op].name) == 0)
+	  break;
+      if (op2 < op)
+	continue;  // already reported
+      count = 0;
+      skips = 0;
+      for (op2 = op; op2 < 64; op2++)
+	if (strcmp (opcode_info [op2].name, opcode_info [op].name) == 0)
+	  {
+	    count += op_count [op2];
+	    skips += op_skips [op2];
+	  }
+      if (opcode_info [op].flags & OP_SKIP)
+	fprintf (f, "opcode,%s,%" PRIu64 ",%" PRIu64 "\n",
+		 opcode_info [op].name, count, skips);
+      else
+	fprintf (f, "opcode,%s,%" PRIu64 ",\n", opcode_info [op].name, count);
+    }
+  for (i = 0; i < 4; i++)
+    fprintf (f, "mode,%s,%" PRIu64 ",\n", addr_mode_name [i], mode_count [0] [i]);
+  for (i = 0; i < 4; i++)
+    fprintf (f, "mode,%s indirect,%" PRIu64 ",\n", addr_mode_name [i], mode_count [1] [i]);
+  fclose (f);
+}
+
+#define BRANCH_MIN_COUNT   100   // sites executed fewer times aren't classified
+#define BRANCH_BIAS        0.90  // fraction one way to be considered biased
+#define BRANCH_MISPREDICT  0.20  // mispredict rate to be considered bad
+#define BRANCH_REPORT_MAX  20
+
+char *branchClass (int addr)
+{
+  uint64_t taken = branch_taken [addr];
+  uint64_t executed = taken + branch_not_taken [addr];
+
+  if (executed < BRANCH_MIN_COUNT)
+    return "";
+  if (branch_mispredicts [addr] >= BRANCH_MISPREDICT * executed)
+    return "mispredicted";
+  if (taken >= BRANCH_BIAS * executed)
+    return "taken-biased";
+  if (taken <= (1.0 - BRANCH_BIAS) * executed)
+    return "not-taken-biased";
+  return "";
+}
+
+// branch sites in order of decreasing execution count
+static int compareBranchSites (const void *a, const void *b)
+{
+  int addr_a = * (const int *) a;
+  int addr_b = * (const int *) b;
+  uint64_t n_a = branch_taken [addr_a] + branch_not_taken [addr_a];
+  uint64_t n_b = branch_taken [addr_b] + branch_not_taken [addr_b];
+
+  if (n_a != n_b)
+    return (n_a < n_b) ? 1 : -1;
+  return addr_a - addr_b;
+}
+
+// Write taken/not-taken counts for every executed BOC and skip site as
+// CSV, classifying the sites that are strongly biased or that a two-bit
+// predictor handles badly.  A BOC that is usually taken, or a skip that
+// usually skips, is a candidate for reordering so that the common path
+// falls through.  The most frequently executed of those, and of the
+// mispredicted sites, are also summarized on stderr.
+void writeBranchStats (char *fn)
+{
+  FILE *f;
+  int addr;
+  int *sites;
+  int site_count = 0;
+  int i;
+  int reported;
+  char kind [40];
+
+  f = fopen (fn, "w");
+  if (! f)
+    {
+      fprintf (stderr, "can't create branch statistics file '%s'\n", fn);
+      return;
+    }
+
+  sites = calloc (65536, sizeof (int));
+  for (addr = 0; addr < 65536; addr++)
+    if (branch_taken [addr] || branch_not_taken [addr])
+      sites [site_count++] = addr;
+  qsort (sites, site_count, sizeof (int), compareBranchSites);
+
+  fprintf (f, "addr,instruction,kind,executed,taken,not_taken,mispredicted,class\n");
+  for (i = 0; i < site_count; i++)
+    {
+      uint64_t taken, executed;
+
+      addr = sites [i];
+      taken = branch_taken [addr];
+      executed = taken + branch_not_taken [addr];
+      if (opcode_info [mem [addr] >> 10].flags & OP_BOC)
+	sprintf (kind, "BOC %s", boc_cond [(mem [addr] >> 8) & 0xf]);
+      else
+	sprintf (kind, "%s", opcode_info [mem [addr] >> 10].name);
+      fprintf (f, "%04x,%04x,%s,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%s\n",
+	       addr, mem [addr], kind, executed, taken,
+	       branch_not_taken [addr], branch_mispredicts [addr],
+	       branchClass (addr));
+    }
+  fclose (f);
+
+  fprintf (stderr, "most frequently executed taken-biased or mispredicted branch sites:\n");
+  for (i = 0, reported = 0; (i < site_count) && (reported < BRANCH_REPORT_MAX); i++)
+    {
+      char *class;
+
+      addr = sites [i];
+      class = branchClass (addr);
+      if ((! *class) || (strcmp (class, "not-taken-biased") == 0))
+	continue;  // falling through is already the common case
+      disassembleInstruction (addr, mem [addr], ac, base_page_split, kind);
+      fprintf (stderr, "  %04x %-20s %12" PRIu64 " taken %12" PRIu64 " not taken %12" PRIu64 " mispredicted  %s\n",
+	       addr, kind, branch_taken [addr], branch_not_taken [addr],
+	       branch_mispredicts [addr], class);
+      reported++;
+    }
+  free (sites);
+}
+
+// The flight recorder dump is formatted by hand and written with
+// write (), so that it can be done from a signal handler.
+char *flightHex (char *p, unsigned value)
+{
+  int i;
+
+  for (i = 12; i >= 0; i -= 4)
+    *p++ = "0123456789abcdef" [(value >> i) & 0xf];
+  return p;
+}
+
+char *flightDecimal (char *p, uint64_t value)
+{
+  char digits [20];
+  int n = 0;
+
+  do
+    {
+      digits [n++] = '0' + (value % 10);
+      value /= 10;
+    }
+  while (value);
+  while (n)
+    *p++ = digits [--n];
+  return p;
+}
+
+char *flightString (char *p, const char *s)
+{
+  while (*s)
+    *p++ = *s++;
+  return p;
+}
+
+void flightDump (const char *reason)
+{
+  char buf [4096];
+  char *p = buf;
+  uint64_t first;
+  uint64_t n;
+  struct flight_entry *e;
+  int fd;
+  int i;
+
+  fd = open (flight_fn, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  if (fd < 0)
+    return;
+  first = (inst_count > flight_mask) ? inst_count - flight_mask : 1;
+  p = flightString (p, "# psim flight recorder: ");
+  p = flightString (p, reason);
+  p = flightString (p, " after ");
+  p = flightDecimal (p, inst_count);
+  p = flightString (p, " instructions\n# count pc inst ac0 ac1 ac2 ac3 sp flags\n");
+  for (n = first; n <= inst_count; n++)
+    {
+      e = & flight_ring [n & flight_mask];
+      p = flightDecimal (p, n);
+      *p++ = ' ';
+      p = flightHex (p, e->pc);
+      *p++ = ' ';
+      p = flightHex (p, e->inst);
+      for (i = 0; i < 4; i++)
+	{
+	  *p++ = ' ';
+	  p = flightHex (p, e->ac [i]);
+	}
+      *p++ = ' ';
+      p = flightDecimal (p, (int16_t) e->sp + 1);
+      p = flightString (p, (e->flags & FL_CY)   ? " cy"   : "");
+      p = flightString (p, (e->flags & FL_LK)   ? " link" : "");
+      p = flightString (p, (e->flags & FL_OV)   ? " ov"   : "");
+      p = flightString (p, (e->flags & FL_BYTE) ? " byte" : "");
+      *p++ = '\n';
+      if (p > buf + sizeof (buf) - 100)
+	{
+	  if (write (fd, buf, p - buf) < 0)
+	    break;
+	  p = buf;
+	}
+    }
+  if (p > buf)
+    if (write (fd, buf, p - buf) < 0)
+      p = buf;
+  close (fd);
+}
+
+void guestViewOpen (char *name)
+{
+  char shm_name [256];
+  int fd;
+  void *p;
+
+  snprintf (shm_name, sizeof (shm_name), "%s%s", (name [0] == '/') ? "" : "/", name);
+  fd = shm_open (shm_name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if ((fd < 0) || (ftruncate (fd, GUESTVIEW_SIZE) < 0))
+    {
+      fprintf (stderr, "can't create shared memory '%s'\n", shm_name);
+      exit (2);
+    }
+  p = mmap (NULL, GUESTVIEW_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close (fd);
+  if (p == MAP_FAILED)
+    {
+      fprintf (stderr, "can't map shared memory '%s'\n", shm_name);
+      exit (2);
+    }
+  guest_view = p;
+  guest_view->version = GUESTVIEW_VERSION;
+  guest_view->pid = getpid ();
+  atomic_store_explicit (& guest_view->running, 1, memory_order_relaxed);
+  atomic_thread_fence (memory_order_release);
+  guest_view->magic = GUESTVIEW_MAGIC;
+  mem = (uint16_t *) ((char *) p + GUESTVIEW_MEM_OFFSET);
+}
+
+// The snapshot is published like a seqlock: generation is odd while it
+// is being written, and becomes even again, advanced by two, when it is
+// complete.
+void guestViewPublish (bool running)
+{
+  uint32_t gen = atomic_load_explicit (& guest_view->generation, memory_order_relaxed);
+
+  atomic_store_explicit (& guest_view->generation, gen + 1, memory_order_relaxed);
+  atomic_thread_fence (memory_order_release);
+  guest_view->inst_count = inst_count;
+  guest_view->pc = pc;
+  memcpy (guest_view->ac, ac, sizeof (ac));
+  guest_view->fr = getFR ();
+  guest_view->sp = sp;
+  memcpy (guest_view->stack, stack, sizeof (stack));
+  atomic_store_explicit (& guest_view->running, running, memory_order_relaxed);
+  atomic_store_explicit (& guest_view->generation, gen + 2, memory_order_release);
+}
+
+void guestViewUpdate (void)
+{
+  guestViewPublish (true);
+}
+
+void guestViewStop (void)
+{
+  guestViewPublish (false);
+}
+
+// A reader that copied memory while the simulator was stopped must see
+// the generation change if memory changes after this.
+void guestViewResume (void)
+{
+  guestViewPublish (true);
+  atomic_thread_fence (memory_order_seq_cst);
+}
+
+void liveStatsUpdate (void)
+{
+  struct simstats_counters c;
+  char name [MAX_WORD_NAME];
+
+  c.instructions = inst_count;
+  c.cycles = cycle_count;
+  c.block_reads = block_reads;
+  c.block_writes = block_writes;
+  c.console_in = console_in_count;
+  c.console_out = console_out_count;
+  getWordName (live_word, name);
+  simstatsUpdate (live_stats, & c, pc, live_word, name);
+}
+
+uint64_t cpuNanoseconds (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_PROCESS_CPUTIME_ID, & ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Guest MIPS is computed over the time spent executing, which excludes
+// the time spent waiting for console input, so that runs of the same
+// workload can be compared.
+void writeStats (uint64_t wall_ns, uint64_t cpu_ns)
+{
+  uint64_t exec_ns = wall_ns - console_wait_ns;
+  double mips = exec_ns ? inst_count * 1.0e3 / exec_ns : 0.0;
+  double mcps = exec_ns ? cycle_count * 1.0e3 / exec_ns : 0.0;
+  struct blkdev_stats totals;
+  const struct blkdev_stats *bs = & totals;
+  struct blkdma_stats no_dma = { 0, 0, 0 };
+  const struct blkdma_stats *ds = & no_dma;
+  FILE *f;
+
+  blockStats (& totals);
+  if (block_queue)
+    ds = blkdmaStats (block_queue);
+
+  if (stats)
+    {
+      fprintf (stderr, "instructions:        %" PRIu64 "\n", inst_count);
+      fprintf (stderr, "cycles:              %" PRIu64 " (approximate)\n", cycle_count);
+      fprintf (stderr, "wall time:           %.3f s\n", wall_ns / 1.0e9);
+      fprintf (stderr, "  console input wait %.3f s\n", console_wait_ns / 1.0e9);
+      fprintf (stderr, "  executing          %.3f s\n", exec_ns / 1.0e9);
+      fprintf (stderr, "cpu time:            %.3f s\n", cpu_ns / 1.0e9);
+      fprintf (stderr, "guest MIPS:          %.2f\n", mips);
+      fprintf (stderr, "guest MCPS:          %.2f\n", mcps);
+      fprintf (stderr, "block reads:         %" PRIu64 " (%" PRIu64 " bytes)\n",
+	       block_reads, block_reads * BLOCK_SIZE);
+      fprintf (stderr, "block writes:        %" PRIu64 " (%" PRIu64 " bytes)\n",
+	       block_writes, block_writes * BLOCK_SIZE);
+      if (block_options.cache_blocks)
+	fprintf (stderr, "block cache:         %" PRIu64 " hits, %" PRIu64 " misses, %"
+		 PRIu64 " evictions, %" PRIu64 " written back\n",
+		 bs->hits, bs->misses, bs->evictions, bs->write_backs);
+      if (block_options.prefetch_blocks)
+	fprintf (stderr, "block prefetch:      %" PRIu64 " blocks read ahead, %" PRIu64 " used\n",
+		 bs->prefetched, bs->prefetch_hits);
+      if (block_queue)
+	fprintf (stderr, "block DMA:           %" PRIu64 " transfers, %" PRIu64 " waits, %"
+		 PRIu64 " with the queue full\n", ds->transfers, ds->waits, ds->full);
+      if (block_options.cow)
+	fprintf (stderr, "block overlay:       %" PRIu64 " blocks %s\n", bs->overlay_blocks,
+		 (block_options.cow == BLKDEV_COW_COMMIT) ? "to commit" : "discarded");
+      fprintf (stderr, "console:             %" PRIu64 " characters in, %" PRIu64 " out\n",
+	       console_in_count, console_out_count);
+    }
+
+  if (! stats_json_fn)
+    return;
+  f = fopen (stats_json_fn, "w");
+  if (! f)
+    {
+      fprintf (stderr, "can't create stats file '%s'\n", stats_json_fn);
+      return;
+    }
+  fprintf (f, "{\n");
+  fprintf (f, "  \"instructions\": %" PRIu64 ",\n", inst_count);
+  fprintf (f, "  \"cycles\": %" PRIu64 ",\n", cycle_count);
+  fprintf (f, "  \"wall_ns\": %" PRIu64 ",\n", wall_ns);
+  fprintf (f, "  \"console_wait_ns\": %" PRIu64 ",\n", console_wait_ns);
+  fprintf (f, "  \"exec_ns\": %" PRIu64 ",\n", exec_ns);
+  fprintf (f, "  \"cpu_ns\": %" PRIu64 ",\n", cpu_ns);
+  fprintf (f, "  \"mips\": %.3f,\n", mips);
+  fprintf (f, "  \"mcps\": %.3f,\n", mcps);
+  fprintf (f, "  \"block_reads\": %" PRIu64 ",\n", block_reads);
+  fprintf (f, "  \"block_read_bytes\": %" PRIu64 ",\n", block_reads * BLOCK_SIZE);
+  fprintf (f, "  \"block_writes\": %" PRIu64 ",\n", block_writes);
+  fprintf (f, "  \"block_write_bytes\": %" PRIu64 ",\n", block_writes * BLOCK_SIZE);
+  fprintf (f, "  \"block_cache_hits\": %" PRIu64 ",\n", bs->hits);
+  fprintf (f, "  \"block_cache_misses\": %" PRIu64 ",\n", bs->misses);
+  fprintf (f, "  \"block_cache_evictions\": %" PRIu64 ",\n", bs->evictions);
+  fprintf (f, "  \"block_write_backs\": %" PRIu64 ",\n", bs->write_backs);
+  fprintf (f, "  \"block_prefetched\": %" PRIu64 ",\n", bs->prefetched);
+  fprintf (f, "  \"block_prefetch_hits\": %" PRIu64 ",\n", bs->prefetch_hits);
+  fprintf (f, "  \"block_overlay_blocks\": %" PRIu64 ",\n", bs->overlay_blocks);
+  fprintf (f, "  \"block_dma_transfers\": %" PRIu64 ",\n", ds->transfers);
+  fprintf (f, "  \"block_dma_waits\": %" PRIu64 ",\n", ds->waits);
+  fprintf (f, "  \"block_dma_full\": %" PRIu64 ",\n", ds->full);
+  fprintf (f, "  \"console_in\": %" PRIu64 ",\n", console_in_count);
+  fprintf (f, "  \"console_out\": %" PRIu64 "\n", console_out_count);
+  fprintf (f, "}\n");
+  fclose (f);
+}
+
+void sigint_handler (int sig)
+{
+  (void) sig;
+  interrupted = true;
+  halt = true;
+}
+
+// read a console character, for GETC and EXPECT, halting at the end
+// of input
+int trapGetc (void)
+{
+  int c;
+  uint64_t wait_start;
+  uint64_t wait_ns;
+
+  if (live_stats)
+    liveStatsUpdate ();  // show where we are while waiting
+  if (guest_view)
+    guestViewStop ();
+  console_in_count++;
+  wait_start = simstatsNow ();
+  c = consoleInputCharacter ();
+  if (c < 0)
+    {
+      halt = true;  // the console has gone away, as if it hung up
+      c = 0x0d;
+    }
+  wait_ns = simstatsNow () - wait_start;
+  console_wait_ns += wait_ns;
+  if (timeline_f)
+    timelineInstant ("GETC", "char", c, "wait_us", wait_ns / 1000);
+  if (guest_view)
+    guestViewResume ();
+  return c;
+}
+
+void trapPutc (int c)
+{
+  c &= 0x7f;
+  console_out_count++;
+  if (timeline_f)
+    timelineInstant ("PUTC", "char", c, NULL, 0);
+  consoleOutputCharacter (c);
+  if (c == 0x0d)
+    consoleOutputCharacter (0x0a);
+}
+
+// TYPE ( addr count -- ) for FIG-Forth: write count characters from
+// byte address addr to the console at once, as EMIT would write them
+void hostType (void)
+{
+  uint8_t buf [512];
+  int addr = mem [(ac [3] + 1) & WORD_MASK];
+  int count = (int16_t) mem [ac [3]];
+  int n = 0;
+  int c;
+
+  if (timeline_f)
+    timelineInstant ("TYPE", "addr", addr, "count", count);
+  for (; count > 0; count--)
+    {
+      if (n >= (int) sizeof (buf) - 1)
+	{
+	  consoleWrite (buf, n);
+	  n = 0;
+	}
+      c = get_mem_byte (addr) & 0x7f;
+      addr = (addr + 1) & WORD_MASK;
+      buf [n++] = c;
+      if (c == 0x0d)
+	buf [n++] = 0x0a;
+      console_out_count++;
+    }
+  consoleWrite (buf, n);
+}
+
+// Host files being read by the FIG-Forth INCLUDE, innermost last.
+// Each is mapped, and handed to the interpreter a line at a time.
+#define INCLUDE_DEPTH    8
+#define INCLUDE_LINE_MAX 80   // as QUERY reads
+struct include
+{
+  char name [256];
+  char *text;
+  size_t size;
+  size_t pos;
+  int line;
+  int tib;          // byte address the lines are copied to
+  uint8_t saved [INCLUDE_LINE_MAX + 2];  // what the lines replaced
+} include_stack [INCLUDE_DEPTH];
+int include_depth = 0;
+
+void includeClose (void)
+{
+  struct include *f = & include_stack [--include_depth];
+
+  if (f->text)
+    munmap (f->text, f->size);
+}
+
+// The interpreter went back to the console, after an error in an
+// included file, so forget the files.
+void includeAbandon (void)
+{
+  struct include *f;
+
+  while (include_depth)
+    {
+      f = & include_stack [include_depth - 1];
+      fprintf (stderr, "INCLUDE of '%s' abandoned at line %d\n", f->name, f->line);
+      includeClose ();
+    }
+}
+
+bool includeOpen (int addr)
+{
+  struct include *f;
+  struct stat st;
+  int count = get_mem_byte (addr);
+  int fd;
+  int i;
+
+  if (include_depth == INCLUDE_DEPTH)
+    {
+      fprintf (stderr, "INCLUDE nested too deeply\n");
+      return false;
+    }
+  f = & include_stack [include_depth];
+  for (i = 0; i < count; i++)
+    f->name [i] = get_mem_byte ((addr + 1 + i) & WORD_MASK) & 0x7f;
+  f->name [count] = '\0';
+  fd = open (f->name, O_RDONLY);
+  if (fd < 0)
+    return false;
+  if (fstat (fd, & st) < 0)
+    {
+      close (fd);
+      return false;
+    }
+  f->size = st.st_size;
+  f->text = NULL;
+  if (f->size)
+    {
+      f->text = mmap (NULL, f->size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (f->text == MAP_FAILED)
+	{
+	  close (fd);
+	  return false;
+	}
+    }
+  close (fd);
+  f->pos = 0;
+  f->line = 0;
+  f->tib = -1;
+  include_depth++;
+  return true;
+}
+
+// Copy the next line of the innermost file to byte address addr, in
+// the form EXPECT leaves it, and return 1.  At the end of the file,
+// restore what was at addr when the file was opened, so that the rest
+// of the line containing INCLUDE is interpreted, and return 0.  A line
+// too long for the TIB is an error: report it, and return -1, for
+// INCLUDE to abort.
+int includeRead (int addr)
+{
+  struct include *f;
+  size_t end;
+  size_t len;
+  int n = 0;
+  int i;
+  int c;
+
+  if (! include_depth)
+    return 0;
+  f = & include_stack [include_depth - 1];
+  if (f->tib < 0)
+    {
+      f->tib = addr;
+      for (i = 0; i < INCLUDE_LINE_MAX + 2; i++)
+	f->saved [i] = get_mem_byte ((addr + i) & WORD_MASK);
+    }
+  if (f->pos >= f->size)
+    {
+      for (i = 0; i < INCLUDE_LINE_MAX + 2; i++)
+	put_mem_byte ((f->tib + i) & WORD_MASK, f->saved [i]);
+      hostWrote ((f->tib >> 1) & WORD_MASK,
+		 ((f->tib + INCLUDE_LINE_MAX + 1) >> 1) - (f->tib >> 1) + 1, PROV_FILE);
+      includeClose ();
+      return 0;
+    }
+
+  f->line++;
+  for (end = f->pos; (end < f->size) && (f->text [end] != '\n'); end++)
+    ;
+  len = end - f->pos;
+  if (len && (f->text [end - 1] == '\r'))
+    len--;
+  if (len > INCLUDE_LINE_MAX)
+    {
+      fprintf (stderr, "line %d of '%s' is longer than %d characters\n",
+	       f->line, f->name, INCLUDE_LINE_MAX);
+      return -1;
+    }
+  for (; f->pos < end; f->pos++)
+    {
+      c = f->text [f->pos] & 0x7f;
+      if (c == '\r')
+	continue;
+      if (c < ' ')
+	c = ' ';  // tabs and other controls separate words
+      put_mem_byte ((addr + n++) & WORD_MASK, c);
+    }
+  if (f->pos < f->size)
+    f->pos++;  // the newline
+  put_mem_byte ((addr + n) & WORD_MASK, ' ');
+  put_mem_byte ((addr + n + 1) & WORD_MASK, 0);
+  hostWrote ((addr >> 1) & WORD_MASK, ((addr + n + 1) >> 1) - (addr >> 1) + 1, PROV_FILE);
+  return 1;
+}
+
+// (INCLUDE) ( addr 0 -- f ) opens the file named by the counted string
+// at byte address addr, ( addr 1 -- n ) reads its next line to addr
+void hostInclude (void)
+{
+  int addr = mem [(ac [3] + 1) & WORD_MASK];
+
+  if (ac [0] == 0)
+    ac [0] = includeOpen (addr);
+  else
+    ac [0] = includeRead (addr) & WORD_MASK;
+}
+
+// EXPECT ( addr count -- ) for FIG-Forth: read a line of up to count
+// characters into byte address addr, echoing it and handling the
+// backspace character in AC0, as the FIG-Forth definition does.  The
+// line is terminated by two nulls, and the carriage return is echoed
+// as a blank.  At the end of input the line ends, and the simulator
+// halts.
+void hostExpect (void)
+{
+  int start = mem [(ac [3] + 1) & WORD_MASK];
+  int end = start + (int16_t) mem [ac [3]];
+  int last = start;
+  int i = start;
+  int c;
+
+  if (include_depth)
+    includeAbandon ();
+  do
+    {
+      c = trapGetc ();
+      if (c == ac [0])
+	{
+	  if (i == start)
+	    trapPutc (0x07);
+	  else
+	    {
+	      i--;
+	      trapPutc (0x08);
+	    }
+	  continue;
+	}
+      if (c == 0x0d)
+	{
+	  end = i;  // LEAVE, storing a null and echoing a blank
+	  put_mem_byte (i & WORD_MASK, 0);
+	  c = ' ';
+	}
+      else
+	put_mem_byte (i & WORD_MASK, c);
+      put_mem_byte ((i + 1) & WORD_MASK, 0);
+      if (i + 1 > last)
+	last = i + 1;
+      trapPutc (c);
+      i++;
+    }
+  while ((i < end) && ! halt);
+  hostWrote ((start >> 1) & WORD_MASK, ((last >> 1) - (start >> 1)) + 1, PROV_CONSOLE);
+}
+
+void run (void)
+{
+  uint64_t start_ns;
+  uint64_t start_cpu_ns;
+  uint32_t block;
+  int batch;
+  bool batch_updates = live_stats || guest_view;
+
+  loadHexFile ("figforth_pace.obj");
+  if (timeline_f)
+    timelineStart ();
+
+  blockOpen ();
+  // the lockstep checker and the traces need every write to memory in
+  // instruction order, so they get transfers done at once
+  if (block_dma_depth && ! check_interval && ! btrace_f && ! tstore_open)
+    {
+      block_queue = blkdmaCreate (block_dma_depth);
+      if (! block_queue)
+	{
+	  fprintf (stderr, "can't start the block DMA thread\n");
+	  exit (2);
+	}
+    }
+	
+  start_ns = simstatsNow ();
+  start_cpu_ns = cpuNanoseconds ();
+  pc = 0x10;
   halt = false;
+  if (check_interval)
+    checkSync ();
   while (! halt)
     {
+      if (block_dma_pending)
+	blockDmaPoll ();
       if ((pc >= ABSTTY_BASE) &&
 	  (pc <= ABSTTY_BASE + ABSTTY_SIZE))
 	{
+	  if (check_interval)
+	    {
+	      checkCompare ();
+	      if (halt)
+		break;
+	    }
 	  switch (pc)
 	    {
 	    case ABSTTY_GETC:
-	      ac [0] = consoleInputCharacter ();
+	      ac [0] = trapGetc ();
 	      pc = pull ();
 	      break;
 	    case ABSTTY_PUTC:
-	      c = ac [0] & 0x7f;
-	      consoleOutputCharacter (c);
-	      if (c == 0x0d)
-		consoleOutputCharacter (0x0a);
+	      trapPutc (ac [0]);
+	      pc = pull ();
+	      break;
+	    case ABSTTY_TYPE:
+	      hostType ();
+	      pc = pull ();
+	      break;
+	    case ABSTTY_EXPECT:
+	      hostExpect ();
+	      pc = pull ();
+	      break;
+	    case ABSTTY_INCLUDE:
+	      hostInclude ();
 	      pc = pull ();
 	      break;
 	    case ABSTTY_INTEST:
@@ -1099,18 +3634,104 @@ void run (void)
 	      else
 		pc = (pull () + 1) & WORD_MASK;
 	      break;
+	    case ABSTTY_PERF:
+	      trapPerf (ac [0]);
+	      pc = pull ();
+	      break;
 	    case ABSTTY_BLOCKIO:
-	      block_io (mem [ac [3] + 2], mem [ac [3] + 1], mem [ac [3]] != 0);
+	      if (mem [ac [3]] == BLOCKIO_SYNC)
+		{
+		  blockFlush ();
+		  pc = pull ();
+		  break;
+		}
+	      block = ((uint32_t) mem [(ac [3] + 1) & WORD_MASK] << 16) | mem [(ac [3] + 2) & WORD_MASK];
+	      if (timeline_f)
+		timelineInstant ((mem [ac [3]] != 0) ? "block read" : "block write",
+				 "block", block, "addr", mem [(ac [3] + 3) & WORD_MASK]);
+	      block_io (mem [(ac [3] + 3) & WORD_MASK], block, mem [ac [3]] != 0, true);
+	      pc = pull ();
+	      break;
+	    case ABSTTY_BLOCKDMA:
+	      block = ((uint32_t) mem [(ac [3] + 2) & WORD_MASK] << 16) | mem [(ac [3] + 3) & WORD_MASK];
+	      if (timeline_f)
+		timelineInstant ((mem [(ac [3] + 1) & WORD_MASK] != 0) ? "block dma read" : "block dma write",
+				 "block", block, "addr", mem [(ac [3] + 4) & WORD_MASK]);
+	      block_dma (mem [(ac [3] + 4) & WORD_MASK], block,
+			 mem [(ac [3] + 1) & WORD_MASK] != 0, mem [ac [3]]);
 	      pc = pull ();
 	      break;
 	    default:
 	      halt = true;
 	    }
+	  if (check_interval)
+	    checkSync ();
 	}
+      else if (check_interval)
+	checkStep ();
+      else if (decode_cache)
+	{
+	  batch = SIMSTATS_BATCH - (inst_count & (SIMSTATS_BATCH - 1));
+	  // a guest waiting for a transfer polls its status word
+	  if (block_dma_pending && (batch > BLOCK_DMA_POLL))
+	    batch = BLOCK_DMA_POLL;
+	  runPredecoded (batch);
+	}
+      else if (instrumented)
+	executeInstrumented ();
       else
 	executeInstruction ();
+      if (batch_updates && ((inst_count & (SIMSTATS_BATCH - 1)) == 0))
+	{
+	  if (live_stats)
+	    liveStatsUpdate ();
+	  if (guest_view)
+	    guestViewUpdate ();
+	}
     }
+  consoleStop ();
+  blockFlush ();  // before the stats, which count its writes
+  if (illegal_opcode)
+    printf ("illegal opcode %04x at %04x\n", mem [(pc - 1) & WORD_MASK],
+	    (pc - 1) & WORD_MASK);
   printf ("halted at %04x\n", pc);
+  if (stats || stats_json_fn)
+    writeStats (simstatsNow () - start_ns, cpuNanoseconds () - start_cpu_ns);
+  if (live_stats)
+    {
+      liveStatsUpdate ();
+      simstatsDestroy (live_stats);
+    }
+  if (guest_view)
+    guestViewStop ();  // left in place for inspection, until removed
+  if (flight_ring)
+    {
+      flightDump (illegal_opcode ? "illegal opcode" :
+		  interrupted ? "interrupted" : "halt");
+      fprintf (stderr, "last %" PRIu64 " instructions written to '%s'\n",
+	       (inst_count > flight_mask) ? (uint64_t) flight_mask + 1 : inst_count,
+	       flight_fn);
+    }
+  if (prov_source)
+    {
+      provenanceReport ();
+      writeProvenance (provenance_fn);
+    }
+  if (profile_fn)
+    writeProfile (profile_fn);
+  if (heatmap_fn)
+    writeHeatmap (heatmap_fn);
+  if (opstats_fn)
+    writeOpStats (opstats_fn);
+  if (branch_fn)
+    writeBranchStats (branch_fn);
+  if (btrace_f)
+    btraceClose ();
+  if (tstore_open)
+    tstoreClose ();
+  if (timeline_f)
+    timelineClose ();
+  blockClose ();
 }
 
 
@@ -1126,6 +3747,18 @@ void restore_tty_settings (void)
   tcsetattr(STDIN_FILENO, TCSANOW, & orig_trm); // restore original settings
 }
 
+void sigsegv_handler (int sig)
+{
+  static const char msg [] = "simulator crashed, flight recorder written\n";
+
+  restore_tty_settings ();
+  flightDump ("SIGSEGV");
+  if (write (STDERR_FILENO, msg, sizeof (msg) - 1) < 0)
+    sig = SIGSEGV;
+  signal (sig, SIG_DFL);
+  raise (sig);
+}
+
 void set_tty_raw (bool raw)
 {
   struct termios trm;
@@ -1147,8 +3780,26 @@ void set_tty_raw (bool raw)
 					     settings */
 }
 
+// returns the value of an option that takes an argument, and advances
+// past it
+char *optionValue (int *argc, char ***argv)
+{
+  if (*argc < 2)
+    {
+      fprintf (stderr, "'%s' must be followed by a value\n", (*argv) [0]);
+      exit (1);
+    }
+  (*argc)--;
+  (*argv)++;
+  return (*argv) [0];
+}
+
 int main (int argc, char *argv [])
 {
+  struct sigaction sa;
+  char *engine = "reference";
+
+  memset (trace_filter, 0xff, sizeof (trace_filter));
   while (--argc)
     {
       argv++;
@@ -1160,6 +3811,177 @@ int main (int argc, char *argv [])
 	{
 	  inst_trace = true;
 	}
+      else if (strcmp (argv [0], "--trace-start") == 0)
+	{
+	  parseTrigger (optionValue (& argc, & argv), & trace_start_trigger);
+	}
+      else if (strcmp (argv [0], "--trace-stop") == 0)
+	{
+	  parseTrigger (optionValue (& argc, & argv), & trace_stop_trigger);
+	}
+      else if (strcmp (argv [0], "--trace-window") == 0)
+	{
+	  trace_window = strtoull (optionValue (& argc, & argv), NULL, 0);
+	}
+      else if (strcmp (argv [0], "--trace-include") == 0)
+	{
+	  traceFilterRange (optionValue (& argc, & argv), true);
+	}
+      else if (strcmp (argv [0], "--trace-exclude") == 0)
+	{
+	  traceFilterRange (optionValue (& argc, & argv), false);
+	}
+      else if (strcmp (argv [0], "--engine") == 0)
+	{
+	  engine = optionValue (& argc, & argv);
+	  if ((strcmp (engine, "reference") != 0) &&
+	      (strcmp (engine, "predecode") != 0))
+	    {
+	      fprintf (stderr, "engine must be reference or predecode\n");
+	      exit (1);
+	    }
+	}
+      else if (strcmp (argv [0], "--check") == 0)
+	{
+	  check_interval = strtol (optionValue (& argc, & argv), NULL, 0);
+	  if (check_interval < 1)
+	    {
+	      fprintf (stderr, "check interval must be at least one\n");
+	      exit (1);
+	    }
+	}
+      else if (strcmp (argv [0], "--stats") == 0)
+	{
+	  stats = true;
+	}
+      else if (strcmp (argv [0], "--block-cache") == 0)
+	{
+	  block_options.cache_blocks = strtol (optionValue (& argc, & argv), NULL, 0);
+	  if (block_options.cache_blocks < 0)
+	    {
+	      fprintf (stderr, "block cache size can't be negative\n");
+	      exit (1);
+	    }
+	}
+      else if (strcmp (argv [0], "--block-cow") == 0)
+	{
+	  char *mode = optionValue (& argc, & argv);
+
+	  if (strcmp (mode, "discard") == 0)
+	    block_options.cow = BLKDEV_COW_DISCARD;
+	  else if (strcmp (mode, "commit") == 0)
+	    block_options.cow = BLKDEV_COW_COMMIT;
+	  else
+	    {
+	      fprintf (stderr, "block copy-on-write mode must be discard or commit\n");
+	      exit (1);
+	    }
+	}
+      else if (strcmp (argv [0], "--block-latency") == 0)
+	{
+	  block_options.latency_us = strtol (optionValue (& argc, & argv), NULL, 0);
+	  if (block_options.latency_us < 0)
+	    {
+	      fprintf (stderr, "block latency can't be negative\n");
+	      exit (1);
+	    }
+	}
+      else if (strcmp (argv [0], "--block-dma") == 0)
+	{
+	  block_dma_depth = strtol (optionValue (& argc, & argv), NULL, 0);
+	  if (block_dma_depth < 0)
+	    {
+	      fprintf (stderr, "block DMA queue depth can't be negative\n");
+	      exit (1);
+	    }
+	}
+      else if (strcmp (argv [0], "--drive") == 0)
+	{
+	  int drive = strtol (optionValue (& argc, & argv), NULL, 0);
+
+	  if ((drive < 0) || (drive >= BLKDEV_DRIVES))
+	    {
+	      fprintf (stderr, "drive must be 0 to %d\n", BLKDEV_DRIVES - 1);
+	      exit (1);
+	    }
+	  block_fn [drive] = optionValue (& argc, & argv);
+	}
+      else if (strcmp (argv [0], "--block-prefetch") == 0)
+	{
+	  block_options.prefetch_blocks = strtol (optionValue (& argc, & argv), NULL, 0);
+	  if (block_options.prefetch_blocks < 0)
+	    {
+	      fprintf (stderr, "block prefetch distance can't be negative\n");
+	      exit (1);
+	    }
+	}
+      else if (strcmp (argv [0], "--stats-json") == 0)
+	{
+	  stats_json_fn = optionValue (& argc, & argv);
+	}
+      else if (strcmp (argv [0], "--shared-mem") == 0)
+	{
+	  guest_view_name = optionValue (& argc, & argv);
+	}
+      else if (strcmp (argv [0], "--live-stats") == 0)
+	{
+	  live_stats_enabled = true;
+	}
+      else if (strcmp (argv [0], "--flight-recorder") == 0)
+	{
+	  long size = strtol (optionValue (& argc, & argv), NULL, 0);
+
+	  if ((size < 0) || (size > FLIGHT_MAX_SIZE))
+	    {
+	      fprintf (stderr, "flight recorder size must be 0 to %d\n", FLIGHT_MAX_SIZE);
+	      exit (1);
+	    }
+	  flight_size = size;
+	}
+      else if (strcmp (argv [0], "--flight-file") == 0)
+	{
+	  flight_fn = optionValue (& argc, & argv);
+	}
+      else if (strcmp (argv [0], "--timeline") == 0)
+	{
+	  timeline_fn = optionValue (& argc, & argv);
+	}
+      else if (strcmp (argv [0], "--timeline-events") == 0)
+	{
+	  timeline_budget = strtoull (optionValue (& argc, & argv), NULL, 0);
+	}
+      else if (strcmp (argv [0], "--timeline-min") == 0)
+	{
+	  timeline_min = strtoull (optionValue (& argc, & argv), NULL, 0);
+	}
+      else if (strcmp (argv [0], "--btrace") == 0)
+	{
+	  btrace_fn = optionValue (& argc, & argv);
+	}
+      else if (strcmp (argv [0], "--trace-store") == 0)
+	{
+	  tstore_dir = optionValue (& argc, & argv);
+	}
+      else if (strcmp (argv [0], "--profile") == 0)
+	{
+	  profile_fn = optionValue (& argc, & argv);
+	}
+      else if (strcmp (argv [0], "--provenance") == 0)
+	{
+	  provenance_fn = optionValue (& argc, & argv);
+	}
+      else if (strcmp (argv [0], "--heatmap") == 0)
+	{
+	  heatmap_fn = optionValue (& argc, & argv);
+	}
+      else if (strcmp (argv [0], "--opstats") == 0)
+	{
+	  opstats_fn = optionValue (& argc, & argv);
+	}
+      else if (strcmp (argv [0], "--branches") == 0)
+	{
+	  branch_fn = optionValue (& argc, & argv);
+	}
       else
 	{
 	  fprintf (stderr, "unrecognized argument '%s'\n", argv [0]);
@@ -1167,9 +3989,119 @@ int main (int argc, char *argv [])
 	}
     }
   if (word_trace || inst_trace)
-    trace_f = stdout;  // $$$
+    {
+      trace_f = stdout;  // $$$
+      trace_output = true;
+      instrumented = true;
+    }
+  trace_word_match = calloc (65536, sizeof (uint8_t));
+  if ((trace_start_trigger.kind != TRIG_NONE) ||
+      (trace_stop_trigger.kind != TRIG_NONE) ||
+      trace_window)
+    {
+      tracing = false;
+      if (trace_start_trigger.kind == TRIG_NONE)
+	traceTrigger ();  // start tracing immediately
+      else
+	armTrigger (& trace_start_trigger);
+    }
+  if (live_stats_enabled)
+    live_stats = simstatsCreate ("psim");
+  if (guest_view_name)
+    guestViewOpen (guest_view_name);
+  if (flight_size)
+    {
+      // round up to a power of two
+      for (flight_mask = 1; flight_mask < flight_size; flight_mask <<= 1)
+	;
+      flight_ring = calloc (flight_mask, sizeof (struct flight_entry));
+      if (! flight_ring)
+	{
+	  fprintf (stderr, "can't allocate flight recorder\n");
+	  exit (2);
+	}
+      flight_mask--;
+    }
+  if (timeline_fn)
+    {
+      timelineOpen (timeline_fn);
+      instrumented = true;
+    }
+  if (btrace_fn)
+    {
+      btraceOpen (btrace_fn);
+      trace_output = true;
+      instrumented = true;
+    }
+  if (tstore_dir)
+    {
+      tstoreOpen (tstore_dir);
+      instrumented = true;
+    }
+  if (profile_fn)
+    {
+      exec_count = calloc (65536, sizeof (uint64_t));
+      instrumented = true;
+    }
+  if (opstats_fn)
+    {
+      op_stats = true;
+      instrumented = true;
+    }
+  if (branch_fn)
+    {
+      branch_taken = calloc (65536, sizeof (uint64_t));
+      branch_not_taken = calloc (65536, sizeof (uint64_t));
+      branch_mispredicts = calloc (65536, sizeof (uint64_t));
+      branch_predictor = calloc (65536, sizeof (uint8_t));
+      instrumented = true;
+    }
+  if (provenance_fn)
+    {
+      prov_source = calloc (65536, sizeof (uint8_t));
+      prov_pc = calloc (65536, sizeof (uint16_t));
+      prov_time = calloc (65536, sizeof (uint64_t));
+      instrumented = true;
+    }
+  if (heatmap_fn)
+    {
+      mem_reads = calloc (65536, sizeof (uint64_t));
+      mem_writes = calloc (65536, sizeof (uint64_t));
+      instrumented = true;
+    }
+
+  if (check_interval)
+    {
+      decode_cache = calloc (65536, sizeof (struct decoded));
+      check_mem = calloc (65536, sizeof (uint16_t));
+      check_point_mem = calloc (65536, sizeof (uint16_t));
+      checking = true;
+      instrumented = true;
+    }
+  else if (strcmp (engine, "predecode") == 0)
+    {
+      if (instrumented)
+	fprintf (stderr, "profiling and tracing use the reference engine\n");
+      else
+	decode_cache = calloc (65536, sizeof (struct decoded));
+    }
+
+  // let an interrupted or terminated run halt cleanly, so that profiles
+  // get written and cached blocks reach the block file
+  memset (& sa, 0, sizeof (sa));
+  sa.sa_handler = sigint_handler;
+  sigaction (SIGINT, & sa, NULL);
+  sigaction (SIGTERM, & sa, NULL);
+  sigaction (SIGHUP, & sa, NULL);
+  if (flight_ring)
+    {
+      sa.sa_handler = sigsegv_handler;
+      sigaction (SIGSEGV, & sa, NULL);
+    }
+
   get_tty_settings ();
   set_tty_raw (true);
+  consoleStart (inst_trace || word_trace, & halt);
   run ();
   restore_tty_settings ();
   exit (0);
@@ -0,0 +1,105 @@
+// Live statistics in POSIX shared memory, shared by psim and isim
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "simstats.h"
+
+#define IPS_INTERVAL 100000000  // nanoseconds over which ips is measured
+
+static char shm_name [32];
+static uint64_t ips_ns;
+static uint64_t ips_instructions;
+
+uint64_t simstatsNow (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, & ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+struct simstats *simstatsCreate (const char *sim)
+{
+  struct simstats *s;
+  int fd;
+
+  snprintf (shm_name, sizeof (shm_name), "/" SIMSTATS_PREFIX "%d", (int) getpid ());
+  fd = shm_open (shm_name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0)
+    {
+      perror ("can't create live statistics segment");
+      return NULL;
+    }
+  if (ftruncate (fd, sizeof (struct simstats)) < 0)
+    {
+      perror ("can't size live statistics segment");
+      close (fd);
+      shm_unlink (shm_name);
+      return NULL;
+    }
+  s = mmap (NULL, sizeof (struct simstats), PROT_READ | PROT_WRITE,
+	    MAP_SHARED, fd, 0);
+  close (fd);
+  if (s == MAP_FAILED)
+    {
+      perror ("can't map live statistics segment");
+      shm_unlink (shm_name);
+      return NULL;
+    }
+  s->version = SIMSTATS_VERSION;
+  s->pid = getpid ();
+  strncpy (s->sim, sim, sizeof (s->sim) - 1);
+  atomic_store_explicit (& s->running, 1, memory_order_relaxed);
+  ips_ns = simstatsNow ();
+  atomic_store_explicit (& s->update_ns, ips_ns, memory_order_relaxed);
+  // monitors ignore the segment until the header is complete
+  atomic_thread_fence (memory_order_release);
+  s->magic = SIMSTATS_MAGIC;
+  return s;
+}
+
+void simstatsUpdate (struct simstats *s, struct simstats_counters *c,
+		     int pc, int word_cfa, const char *word)
+{
+  uint64_t now = simstatsNow ();
+  uint32_t seq;
+
+  if ((now - ips_ns) >= IPS_INTERVAL)
+    {
+      atomic_store_explicit (& s->ips,
+			     (c->instructions - ips_instructions) * 1000000000ULL / (now - ips_ns),
+			     memory_order_relaxed);
+      ips_ns = now;
+      ips_instructions = c->instructions;
+    }
+  atomic_store_explicit (& s->update_ns, now, memory_order_relaxed);
+  atomic_store_explicit (& s->instructions, c->instructions, memory_order_relaxed);
+  atomic_store_explicit (& s->cycles, c->cycles, memory_order_relaxed);
+  atomic_store_explicit (& s->block_reads, c->block_reads, memory_order_relaxed);
+  atomic_store_explicit (& s->block_writes, c->block_writes, memory_order_relaxed);
+  atomic_store_explicit (& s->console_in, c->console_in, memory_order_relaxed);
+  atomic_store_explicit (& s->console_out, c->console_out, memory_order_relaxed);
+  atomic_store_explicit (& s->pc, pc, memory_order_relaxed);
+  if (word_cfa != (int) atomic_load_explicit (& s->word_cfa, memory_order_relaxed))
+    {
+      seq = atomic_load_explicit (& s->word_seq, memory_order_relaxed);
+      atomic_store_explicit (& s->word_seq, seq + 1, memory_order_relaxed);
+      atomic_thread_fence (memory_order_release);
+      strncpy (s->word, word, SIMSTATS_WORD_SIZE - 1);
+      atomic_store_explicit (& s->word_cfa, word_cfa, memory_order_relaxed);
+      atomic_store_explicit (& s->word_seq, seq + 2, memory_order_release);
+    }
+}
+
+void simstatsDestroy (struct simstats *s)
+{
+  atomic_store_explicit (& s->running, 0, memory_order_relaxed);
+  shm_unlink (shm_name);
+  munmap (s, sizeof (struct simstats));
+}
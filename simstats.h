@@ -0,0 +1,63 @@
+// Live statistics published by psim and isim in a POSIX shared memory
+// segment named "/ns16sim.<pid>", for ns16top or any other monitor.
+//
+// The simulator updates the segment every SIMSTATS_BATCH instructions,
+// and around console and block I/O, with relaxed atomic stores, so a
+// monitor sees each counter whole but not necessarily consistent with
+// the others.  The current word name is protected by word_seq, which is
+// odd while the name is being written.
+
+#include <stdatomic.h>
+
+#define SIMSTATS_PREFIX  "ns16sim."
+#define SIMSTATS_MAGIC   0x3631534e  // "NS16"
+#define SIMSTATS_VERSION 1
+
+#define SIMSTATS_BATCH 0x10000  // instructions between updates, power of two
+
+#define SIMSTATS_WORD_SIZE 32
+
+struct simstats
+{
+  uint32_t magic;
+  uint32_t version;
+  int32_t pid;
+  char sim [8];                  // "psim" or "isim"
+  _Atomic uint32_t running;      // cleared when the simulator halts
+  _Atomic uint64_t update_ns;    // host monotonic time of last update
+  _Atomic uint64_t instructions;
+  _Atomic uint64_t ips;          // instructions per second, recently
+  _Atomic uint64_t cycles;       // approximate microcycles
+  _Atomic uint64_t block_reads;
+  _Atomic uint64_t block_writes;
+  _Atomic uint64_t console_in;   // characters
+  _Atomic uint64_t console_out;
+  _Atomic uint32_t pc;
+  _Atomic uint32_t word_cfa;     // FORTH word executing, W at its JMP @(W)
+  _Atomic uint32_t word_seq;
+  char word [SIMSTATS_WORD_SIZE];
+};
+
+// the simulator's own counters, copied to the segment by simstatsUpdate
+struct simstats_counters
+{
+  uint64_t instructions;
+  uint64_t cycles;
+  uint64_t block_reads;
+  uint64_t block_writes;
+  uint64_t console_in;
+  uint64_t console_out;
+};
+
+// Returns NULL, after reporting the reason, if the segment can't be
+// created.
+struct simstats *simstatsCreate (const char *sim);
+
+void simstatsUpdate (struct simstats *s, struct simstats_counters *c,
+		     int pc, int word_cfa, const char *word);
+
+// Marks the simulator halted and removes the segment name; monitors
+// that already have it mapped can still read the final values.
+void simstatsDestroy (struct simstats *s);
+
+uint64_t simstatsNow (void);  // host monotonic time in nanoseconds
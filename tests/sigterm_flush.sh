@@ -0,0 +1,67 @@
+#!/bin/sh
+# Checks that a block FIG-Forth has written back, but that is still in
+# psim's write-back block cache, reaches the block file when psim is
+# stopped by SIGTERM while it waits at the prompt, and when its input
+# ends.  Run from the directory holding psim and figforth_pace.obj:
+#
+#	sh tests/sigterm_flush.sh
+
+tmp=$(mktemp -d) || exit 2
+trap 'rm -rf "$tmp"' EXIT
+
+# UPDATE block n, then read enough others that FIG-Forth writes it back
+update ()
+{
+  printf 'HEX %s %s BLOCK ! UPDATE : T 20 10 DO I BLOCK DROP LOOP ; T\n' $2 $1
+}
+
+# waits up to five seconds for psim to stop
+stopped ()
+{
+  i=0
+  while kill -0 $pid 2> /dev/null; do
+    i=$((i + 1))
+    if [ $i -gt 5 ]; then
+      kill -KILL $pid
+      return 1
+    fi
+    sleep 1
+  done
+  return 0
+}
+
+# checks that block $1 of the file starts with the bytes $2
+check ()
+{
+  if [ "$(od -A n -t x1 -j $(($1 * 128)) -N 2 "$tmp/blocks")" != " $2" ]; then
+    echo "FAIL: block $1 was not written to the file $3"
+    cat "$tmp/out"
+    exit 1
+  fi
+}
+
+head -c 8192 /dev/zero | tr '\000' ' ' > "$tmp/blocks"
+
+mkfifo "$tmp/in"
+./psim --flight-recorder 0 --drive 0 "$tmp/blocks" < "$tmp/in" > "$tmp/out" 2>&1 &
+pid=$!
+exec 3> "$tmp/in"
+update 3 5A5A >&3
+sleep 1
+kill -TERM $pid
+if ! stopped; then
+  echo "FAIL: psim did not stop on SIGTERM"
+  exit 1
+fi
+exec 3>&-
+check 3 "5a 5a" "on SIGTERM"
+
+update 4 6B6B | ./psim --flight-recorder 0 --drive 0 "$tmp/blocks" > "$tmp/out" 2>&1 &
+pid=$!
+if ! stopped; then
+  echo "FAIL: psim did not stop at the end of input"
+  exit 1
+fi
+check 4 "6b 6b" "at the end of input"
+
+echo "PASS"
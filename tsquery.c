@@ -0,0 +1,477 @@
+// Query an indexed trace store written by "psim --trace-store dir".
+// The column files are mapped rather than read, the per-block maps in
+// the index are used to skip blocks that can't contain an answer, and
+// the per-block posting lists are used to go straight to the writes to
+// an address, so that queries over billions of instructions take
+// milliseconds.
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "pdis.h"
+#include "tstore.h"
+
+#define WORD_MASK 0xffff
+
+char *dir;
+
+// a block of the index, decoded, with its maps left in the mapping
+struct block
+{
+  uint64_t first_write;
+  uint32_t instructions;
+  uint32_t writes;
+  uint64_t first_list;
+  uint32_t lists;
+  const uint8_t *write_map;
+  const uint8_t *pc_map;
+};
+
+struct block *block;
+uint64_t block_count;
+uint64_t instructions;
+uint64_t writes;
+uint64_t lists;
+
+// the columns, little-endian, see tstore.h
+const uint8_t *pc_col;
+const uint8_t *inst_col;
+const uint8_t *xr_col;
+const uint8_t *wtime_col;
+const uint8_t *waddr_col;
+const uint8_t *wvalue_col;
+const uint8_t *wkind_col;
+const uint8_t *wpost_col;
+const uint8_t *wlist_addr_col;
+const uint8_t *wlist_start_col;
+
+uint64_t max_results = UINT64_MAX;
+uint64_t results = 0;
+
+uint64_t *found;  // writes found in a block, see writers ()
+uint32_t found_room;
+
+static inline uint16_t get16 (const uint8_t *col, uint64_t i)
+{
+  return tsGet16 (col + 2 * i);
+}
+
+static inline uint32_t get32 (const uint8_t *col, uint64_t i)
+{
+  return tsGet32 (col + 4 * i);
+}
+
+static inline uint64_t get64 (const uint8_t *col, uint64_t i)
+{
+  return tsGet64 (col + 8 * i);
+}
+
+// Maps a column file, returning the number of elements in *count.
+// An empty file maps to NULL.
+void *mapColumn (char *name, size_t size, uint64_t *count)
+{
+  char fn [PATH_MAX];
+  struct stat st;
+  void *p;
+  int fd;
+
+  snprintf (fn, sizeof (fn), "%s/%s", dir, name);
+  fd = open (fn, O_RDONLY);
+  if ((fd < 0) || (fstat (fd, & st) < 0))
+    {
+      fprintf (stderr, "can't open trace store file '%s'\n", fn);
+      exit (2);
+    }
+  *count = st.st_size / size;
+  if (! st.st_size)
+    {
+      close (fd);
+      return NULL;
+    }
+  p = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close (fd);
+  if (p == MAP_FAILED)
+    {
+      fprintf (stderr, "can't map trace store file '%s'\n", fn);
+      exit (2);
+    }
+  return p;
+}
+
+void openStore (void)
+{
+  struct tstore_header header;
+  const uint8_t *index;
+  const uint8_t *p;
+  uint64_t posts;
+  uint64_t n;
+  uint64_t i;
+
+  index = mapColumn ("index", 1, & n);
+  if (n >= TS_HEADER_SIZE)
+    tsHeaderDecode (index, & header);
+  if ((n < TS_HEADER_SIZE) ||
+      (memcmp (header.magic, TSTORE_MAGIC, sizeof (header.magic)) != 0) ||
+      (header.block_shift != TS_BLOCK_SHIFT))
+    {
+      fprintf (stderr, "'%s' is not a trace store\n", dir);
+      exit (2);
+    }
+  block_count = (n - TS_HEADER_SIZE) / TS_BLOCK_RECORD_SIZE;
+  block = malloc ((block_count ? block_count : 1) * sizeof (struct block));
+  if (! block)
+    {
+      fprintf (stderr, "out of memory\n");
+      exit (2);
+    }
+  for (i = 0; i < block_count; i++)
+    {
+      p = index + TS_HEADER_SIZE + i * TS_BLOCK_RECORD_SIZE;
+      block [i].first_write = tsGet64 (p);
+      block [i].instructions = tsGet32 (p + 8);
+      block [i].writes = tsGet32 (p + 12);
+      block [i].first_list = tsGet64 (p + 16);
+      block [i].lists = tsGet32 (p + 24);
+      block [i].write_map = p + TS_BLOCK_WRITE_MAP;
+      block [i].pc_map = p + TS_BLOCK_PC_MAP;
+    }
+  pc_col = mapColumn ("pc", sizeof (uint16_t), & instructions);
+  inst_col = mapColumn ("inst", sizeof (uint16_t), & n);
+  xr_col = mapColumn ("xr", sizeof (uint16_t), & n);
+  wtime_col = mapColumn ("wtime", sizeof (uint64_t), & writes);
+  waddr_col = mapColumn ("waddr", sizeof (uint16_t), & n);
+  wvalue_col = mapColumn ("wvalue", sizeof (uint16_t), & n);
+  wkind_col = mapColumn ("wkind", sizeof (uint8_t), & n);
+  wpost_col = mapColumn ("wpost", sizeof (uint32_t), & posts);
+  wlist_addr_col = mapColumn ("wlist_addr", sizeof (uint16_t), & lists);
+  wlist_start_col = mapColumn ("wlist_start", sizeof (uint32_t), & n);
+  if (n < lists)
+    lists = n;
+
+  // A store that wasn't closed, because the simulator crashed, has
+  // blocks and columns that may not agree, so use only what all of
+  // them cover.
+  for (i = 0; i < block_count; i++)
+    if ((block [i].first_write + block [i].writes > writes) ||
+	(block [i].first_write + block [i].writes > posts) ||
+	(block [i].first_list + block [i].lists > lists) ||
+	(((i << TS_BLOCK_SHIFT) + block [i].instructions) > instructions))
+      break;
+  if (i < block_count)
+    fprintf (stderr, "trace store is incomplete, using the first %" PRIu64 " blocks\n", i);
+  block_count = i;
+}
+
+void showInstruction (uint64_t time)
+{
+  uint16_t ac [4] = { 0, 0, 0, 0 };
+  char buf [80];
+  uint64_t i = time - 1;
+  uint16_t pc = get16 (pc_col, i);
+  uint16_t inst = get16 (inst_col, i);
+
+  ac [2] = ac [3] = get16 (xr_col, i);
+  disassembleInstruction (pc, inst, ac, false, buf);
+  printf ("pc %04x  %04x  %s", pc, inst, buf);
+}
+
+void showWrite (uint64_t w)
+{
+  uint64_t time = get64 (wtime_col, w);
+
+  printf ("time %12" PRIu64 "  [%04x] <- %04x  ", time, get16 (waddr_col, w), get16 (wvalue_col, w));
+  if (wkind_col [w] == TS_WRITE_HOST)
+    printf ("host write");
+  else
+    showInstruction (time);
+  printf ("\n");
+}
+
+bool enough (void)
+{
+  return results >= max_results;
+}
+
+// does the map have any address in first..last set?
+bool mapAny (const uint8_t *map, int first, int last)
+{
+  int a;
+
+  for (a = first; a <= last; )
+    {
+      if ((! (a & 7)) && (a + 7 <= last))
+	{
+	  if (map [a >> 3])
+	    return true;
+	  a += 8;
+	}
+      else
+	{
+	  if (tsMapTest (map, a))
+	    return true;
+	  a++;
+	}
+    }
+  return false;
+}
+
+// the first posting list of a block for an address at or above addr,
+// as an index within the block, or b->lists if there isn't one
+uint32_t findList (struct block *b, int addr)
+{
+  uint32_t lo = 0;
+  uint32_t hi = b->lists;
+  uint32_t mid;
+
+  while (lo < hi)
+    {
+      mid = lo + (hi - lo) / 2;
+      if (get16 (wlist_addr_col, b->first_list + mid) < addr)
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
+  return lo;
+}
+
+// where a posting list of a block starts in wpost, relative to the
+// block's first write; list b->lists starts where the last one ends
+uint32_t listStart (struct block *b, uint32_t l)
+{
+  return (l < b->lists) ? get32 (wlist_start_col, b->first_list + l) : b->writes;
+}
+
+// the write at position p of a block's posting lists
+uint64_t posting (struct block *b, uint32_t p)
+{
+  return b->first_write + get32 (wpost_col, b->first_write + p);
+}
+
+// the first position in p..end - 1 of a posting list whose write is
+// after the given time, or end if there isn't one
+uint32_t postingAfter (struct block *b, uint32_t p, uint32_t end, uint64_t time)
+{
+  uint32_t mid;
+
+  while (p < end)
+    {
+      mid = p + (end - p) / 2;
+      if (get64 (wtime_col, posting (b, mid)) <= time)
+	p = mid + 1;
+      else
+	end = mid;
+    }
+  return p;
+}
+
+void lastWriter (int addr, uint64_t time)
+{
+  struct block *b;
+  int64_t i;
+  uint32_t l;
+  uint32_t p;
+
+  i = (int64_t) block_count - 1;
+  if (tsBlock (time) < block_count)
+    i = tsBlock (time);
+  for (; i >= 0; i--)
+    {
+      b = & block [i];
+      if (! tsMapTest (b->write_map, addr))
+	continue;
+      l = findList (b, addr);
+      if ((l == b->lists) || (get16 (wlist_addr_col, b->first_list + l) != addr))
+	continue;
+      p = postingAfter (b, listStart (b, l), listStart (b, l + 1), time);
+      if (p > listStart (b, l))
+	{
+	  showWrite (posting (b, p - 1));
+	  return;
+	}
+    }
+  printf ("[%04x] not written at or before time %" PRIu64 "\n", addr, time);
+}
+
+int compareWrites (const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t *) a;
+  uint64_t y = *(const uint64_t *) b;
+
+  return (x > y) - (x < y);
+}
+
+// The writes to first..last in each block are gathered from the
+// posting lists of the addresses and put back in time order.
+void writers (int first, int last, uint64_t t0, uint64_t t1)
+{
+  struct block *b;
+  uint64_t i;
+  uint32_t n;
+  uint32_t l;
+  uint32_t p;
+  uint32_t end;
+  uint32_t k;
+
+  for (i = tsBlock (t0); (i <= tsBlock (t1)) && (i < block_count) && ! enough (); i++)
+    {
+      b = & block [i];
+      if (! mapAny (b->write_map, first, last))
+	continue;
+      if (b->writes > found_room)
+	{
+	  found_room = b->writes;
+	  found = realloc (found, found_room * sizeof (uint64_t));
+	  if (! found)
+	    {
+	      fprintf (stderr, "out of memory\n");
+	      exit (2);
+	    }
+	}
+      n = 0;
+      for (l = findList (b, first);
+	   (l < b->lists) && (get16 (wlist_addr_col, b->first_list + l) <= last);
+	   l++)
+	{
+	  end = listStart (b, l + 1);
+	  p = (t0 > 0) ? postingAfter (b, listStart (b, l), end, t0 - 1) : listStart (b, l);
+	  for (; (p < end) && (get64 (wtime_col, posting (b, p)) <= t1); p++)
+	    found [n++] = posting (b, p);
+	}
+      qsort (found, n, sizeof (uint64_t), compareWrites);
+      for (k = 0; (k < n) && ! enough (); k++)
+	{
+	  showWrite (found [k]);
+	  results++;
+	}
+    }
+}
+
+void executed (int first, int last, uint64_t t0, uint64_t t1)
+{
+  uint64_t b;
+  uint64_t time;
+  uint64_t end;
+
+  if (t0 < 1)
+    t0 = 1;
+  if (t1 > instructions)
+    t1 = instructions;
+  for (b = tsBlock (t0); (b <= tsBlock (t1)) && (b < block_count) && ! enough (); b++)
+    {
+      if (! mapAny (block [b].pc_map, first, last))
+	continue;
+      time = (b << TS_BLOCK_SHIFT) + 1;
+      end = time + block [b].instructions - 1;
+      if (time < t0)
+	time = t0;
+      if (end > t1)
+	end = t1;
+      for (; (time <= end) && ! enough (); time++)
+	if ((get16 (pc_col, time - 1) >= first) && (get16 (pc_col, time - 1) <= last))
+	  {
+	    printf ("time %12" PRIu64 "  ", time);
+	    showInstruction (time);
+	    printf ("\n");
+	    results++;
+	  }
+    }
+}
+
+void info (void)
+{
+  uint64_t host = 0;
+  uint64_t w;
+
+  for (w = 0; w < writes; w++)
+    host += wkind_col [w] == TS_WRITE_HOST;
+  printf ("instructions:  %" PRIu64 "\n", instructions);
+  printf ("memory writes: %" PRIu64 " (%" PRIu64 " by the host)\n", writes, host);
+  printf ("index blocks:  %" PRIu64 " of %d instructions\n", block_count, TS_BLOCK_SIZE);
+}
+
+// parse an address or address range first-last, in hex
+void parseRange (char *s, int *first, int *last)
+{
+  char *end;
+
+  *first = strtol (s, & end, 16);
+  *last = *first;
+  if (*end == '-')
+    *last = strtol (end + 1, & end, 16);
+  if (*end || (*first < 0) || (*last > WORD_MASK) || (*first > *last))
+    {
+      fprintf (stderr, "bad address range '%s'\n", s);
+      exit (1);
+    }
+}
+
+void usage (FILE *f)
+{
+  fprintf (f, "usage: tsquery [-n max] dir info\n"
+	      "       tsquery [-n max] dir last-writer addr [time]\n"
+	      "       tsquery [-n max] dir writers first[-last] [t0 [t1]]\n"
+	      "       tsquery [-n max] dir executed first[-last] [t0 [t1]]\n"
+	      "addresses are hex, times are instruction counts\n");
+}
+
+int main (int argc, char *argv [])
+{
+  char *query;
+  int first, last;
+  uint64_t t0 = 0;
+  uint64_t t1 = UINT64_MAX;
+
+  argc--;
+  argv++;
+  if ((argc >= 2) && (strcmp (argv [0], "-n") == 0))
+    {
+      max_results = strtoull (argv [1], NULL, 0);
+      argc -= 2;
+      argv += 2;
+    }
+  if (argc < 2)
+    {
+      usage (stderr);
+      exit (1);
+    }
+  dir = argv [0];
+  query = argv [1];
+  if (argc >= 4)
+    t0 = strtoull (argv [3], NULL, 0);
+  if (argc >= 5)
+    t1 = strtoull (argv [4], NULL, 0);
+
+  openStore ();
+  if ((strcmp (query, "info") == 0) && (argc == 2))
+    info ();
+  else if ((strcmp (query, "last-writer") == 0) && (argc >= 3) && (argc <= 4))
+    {
+      parseRange (argv [2], & first, & last);
+      lastWriter (first, (argc == 4) ? t0 : UINT64_MAX);
+    }
+  else if ((strcmp (query, "writers") == 0) && (argc >= 3) && (argc <= 5))
+    {
+      parseRange (argv [2], & first, & last);
+      writers (first, last, t0, t1);
+    }
+  else if ((strcmp (query, "executed") == 0) && (argc >= 3) && (argc <= 5))
+    {
+      parseRange (argv [2], & first, & last);
+      executed (first, last, t0, t1);
+    }
+  else
+    {
+      usage (stderr);
+      exit (1);
+    }
+  exit (0);
+}
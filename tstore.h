@@ -0,0 +1,153 @@
+// Indexed execution trace store, written by "psim --trace-store dir"
+// and queried by tsquery.
+//
+// The store is a directory of column files, each an array of
+// little-endian values, whatever the host's byte order:
+//
+//   pc      16-bit address of each instruction executed
+//   inst    16-bit instruction
+//   xr      16-bit value of the index register used by the
+//           instruction, or zero if it doesn't use one
+//   wtime   64-bit time of each memory write
+//   waddr   16-bit address written
+//   wvalue  16-bit value written
+//   wkind   8-bit TS_WRITE_INST or TS_WRITE_HOST
+//   wpost   32-bit write index, relative to the first write of its
+//           block, of each write, grouped by address within each
+//           block, in address order, and in time order within an
+//           address: the per-address posting lists
+//   wlist_addr   16-bit address of each posting list, in order
+//   wlist_start  32-bit index in wpost, relative to the first write of
+//                its block, at which the list starts; it ends where the
+//                next list of the block starts
+//
+// Time is the instruction count: the instruction at index i of the
+// instruction columns was executed at time i + 1.  A write made by an
+// instruction has that instruction's time; a write made by the host on
+// behalf of the guest (e.g., block I/O) has the time of the last
+// instruction executed before it.  The write columns are in time order.
+//
+// The index file starts with a TS_HEADER_SIZE byte header, followed by
+// a TS_BLOCK_RECORD_SIZE byte record for each TS_BLOCK_SIZE
+// instructions, each laid out as the struct below without padding.  A
+// block records which addresses were written and which were executed
+// in it, so that queries only need to look at the blocks that can
+// answer them, and where its posting lists are, so that finding the
+// writes to an address costs time in proportion to the answer.
+
+#define TSTORE_MAGIC "NS16TS02"
+
+#define TS_BLOCK_SHIFT 20
+#define TS_BLOCK_SIZE  (1 << TS_BLOCK_SHIFT)
+
+#define TS_WRITE_INST 0
+#define TS_WRITE_HOST 1
+
+#define TS_HEADER_SIZE       32  // bytes in the file
+#define TS_BLOCK_RECORD_SIZE (32 + 2 * 8192)
+#define TS_BLOCK_WRITE_MAP   32  // offsets of the maps in a record
+#define TS_BLOCK_PC_MAP      (32 + 8192)
+
+struct tstore_header
+{
+  char magic [8];
+  uint32_t block_shift;
+  uint32_t block_count;
+  uint64_t instructions;
+  uint64_t writes;
+};
+
+// The address maps are bitmaps, bit (addr & 7) of byte (addr >> 3), so
+// that they are the same in memory and in the file.
+struct tstore_block
+{
+  uint64_t first_write;     // index in the write columns
+  uint32_t instructions;
+  uint32_t writes;
+  uint64_t first_list;      // index in the wlist columns
+  uint32_t lists;           // addresses written
+  uint32_t reserved;
+  uint8_t write_map [65536 / 8];  // addresses written
+  uint8_t pc_map [65536 / 8];     // addresses executed
+};
+
+// the block containing the given time
+static inline uint64_t tsBlock (uint64_t time)
+{
+  return time ? (time - 1) >> TS_BLOCK_SHIFT : 0;
+}
+
+static inline void tsMapSet (uint8_t *map, int addr)
+{
+  map [addr >> 3] |= 1 << (addr & 7);
+}
+
+static inline bool tsMapTest (const uint8_t *map, int addr)
+{
+  return (map [addr >> 3] >> (addr & 7)) & 1;
+}
+
+// little-endian values
+
+static inline void tsPut16 (uint8_t *p, uint16_t v)
+{
+  p [0] = v;
+  p [1] = v >> 8;
+}
+
+static inline void tsPut32 (uint8_t *p, uint32_t v)
+{
+  tsPut16 (p, v);
+  tsPut16 (p + 2, v >> 16);
+}
+
+static inline void tsPut64 (uint8_t *p, uint64_t v)
+{
+  tsPut32 (p, v);
+  tsPut32 (p + 4, v >> 32);
+}
+
+static inline uint16_t tsGet16 (const uint8_t *p)
+{
+  return p [0] | (p [1] << 8);
+}
+
+static inline uint32_t tsGet32 (const uint8_t *p)
+{
+  return tsGet16 (p) | ((uint32_t) tsGet16 (p + 2) << 16);
+}
+
+static inline uint64_t tsGet64 (const uint8_t *p)
+{
+  return tsGet32 (p) | ((uint64_t) tsGet32 (p + 4) << 32);
+}
+
+static inline void tsHeaderEncode (const struct tstore_header *h, uint8_t *p)
+{
+  memcpy (p, h->magic, sizeof (h->magic));
+  tsPut32 (p + 8, h->block_shift);
+  tsPut32 (p + 12, h->block_count);
+  tsPut64 (p + 16, h->instructions);
+  tsPut64 (p + 24, h->writes);
+}
+
+static inline void tsHeaderDecode (const uint8_t *p, struct tstore_header *h)
+{
+  memcpy (h->magic, p, sizeof (h->magic));
+  h->block_shift = tsGet32 (p + 8);
+  h->block_count = tsGet32 (p + 12);
+  h->instructions = tsGet64 (p + 16);
+  h->writes = tsGet64 (p + 24);
+}
+
+static inline void tsBlockEncode (const struct tstore_block *b, uint8_t *p)
+{
+  tsPut64 (p, b->first_write);
+  tsPut32 (p + 8, b->instructions);
+  tsPut32 (p + 12, b->writes);
+  tsPut64 (p + 16, b->first_list);
+  tsPut32 (p + 24, b->lists);
+  tsPut32 (p + 28, b->reserved);
+  memcpy (p + TS_BLOCK_WRITE_MAP, b->write_map, sizeof (b->write_map));
+  memcpy (p + TS_BLOCK_PC_MAP, b->pc_map, sizeof (b->pc_map));
+}